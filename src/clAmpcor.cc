@@ -4,9 +4,24 @@
 #include "clFFT2d.h"
 #include "clCorrelator.h"
 #include "clOversampler.h"
+#include "clReduction.h"
+#include "clCoarseSearch.h"
+#include "clSpectrumCache.h"
+#include "clProfiler.h"
+#include "clOffsetWriter.h"
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <cstdio>
+#include <chrono>
+
+#include <sys/stat.h>
 
 #include <nlohmann/json.hpp>
 using json = nlohmann::json;
@@ -36,11 +51,33 @@ void cl::Ampcor::Ampcor::read_parameters_from_json(const std::string& filename)
         referenceImageName = settings.at("reference").value("slc", "reference.slc");
         referenceImageWidth = settings.at("reference").value("width", 0);
         referenceImageHeight = settings.at("reference").value("height", 0);
-        secondaryImageName = settings.at("secondary").value("slc", "secondary.slc");
+        // a single secondary image, or a list of them (stack mode) sharing the reference
+        const json secondarySlc = settings.at("secondary").value("slc", json("secondary.slc"));
+        secondaryImageNames.clear();
+        if (secondarySlc.is_array())
+            for (const auto& name : secondarySlc)
+                secondaryImageNames.push_back(name.get<std::string>());
+        else
+            secondaryImageNames.push_back(secondarySlc.get<std::string>());
+        secondaryImageName = secondaryImageNames.front();
         secondaryImageWidth = settings.at("secondary").value("width", 0);
         secondaryImageHeight = settings.at("secondary").value("height", 0);
 
         offsetImageName = settings.at("offset").value("slc", "offset.slc");
+        grossOffsetImageName = settings.value("gross_offset", json::object()).value("slc", "");
+        snrImageName = settings.value("snr", json::object()).value("slc", "snr.slc");
+        covImageName = settings.value("covariance", json::object()).value("slc", "cov.slc");
+        // windows with snr below the threshold are flagged (with nan offsets), 0 = off
+        thresholdSNR = settings.value("snr", json::object()).value("threshold", 0.0f);
+        // the peak neighbourhood excluded from the noise (original size)
+        correlationSurfaceStatSize = settings.value("snr", json::object()).value("stat_size", 21);
+        // optional validity mask, per window (offset size) or per pixel (reference image size)
+        maskImageName = settings.value("mask", json::object()).value("file", "");
+        maskType = settings.value("mask", json::object()).value("type", "window");
+        maskMinValidFraction = settings.value("mask", json::object()).value("min_valid_fraction", 0.5f);
+        // windows without data are skipped, with nan offsets
+        skipNoData = settings.value("nodata", json::object()).value("skip", true);
+        maxZeroFraction = settings.value("nodata", json::object()).value("max_zero_fraction", 0.5f);
 
         windowWidthRaw = settings.at("window").value("width", 64);
         windowHeightRaw = settings.at("window").value("height", 64);
@@ -79,28 +116,129 @@ void cl::Ampcor::Ampcor::read_parameters_from_json(const std::string& filename)
         else
             numberWindowDown = std::min(numberWindowDown, nWin);
 
+        // coarse-to-fine search: a decimated search over the full range,
+        //  followed by a full-resolution search over a small range around the coarse offsets
+        pyramidFactor = settings.value("pyramid", json::object()).value("factor", 1);
+        pyramidFactor = std::max(1, std::min(pyramidFactor, std::min(windowWidthRaw, windowHeightRaw)));
+        if (pyramidFactor > 1) {
+            int_type fineRange = settings.at("pyramid").value("half_search_range_fine", pyramidFactor);
+            halfSearchRangeAcrossFine = std::max(1, std::min(fineRange, halfSearchRangeAcrossRaw));
+            halfSearchRangeDownFine = std::max(1, std::min(fineRange, halfSearchRangeDownRaw));
+        }
+        else {
+            halfSearchRangeAcrossFine = halfSearchRangeAcrossRaw;
+            halfSearchRangeDownFine = halfSearchRangeDownRaw;
+        }
+
+        // oversampling the complex windows before correlation, in power of 2
+        rawDataOversamplingFactor = settings.value("raw_oversampling", json::object()).value("factor", 1);
+        rawDataOversamplingFactor = next_power_of_2(std::max(rawDataOversamplingFactor, 1));
+
         windowWidth = windowWidthRaw*rawDataOversamplingFactor;
         windowHeight = windowHeightRaw*rawDataOversamplingFactor;
-        secondaryWindowWidth = secondaryWindowWidthRaw*rawDataOversamplingFactor;
-        secondaryWindowHeight = secondaryWindowHeightRaw*rawDataOversamplingFactor;
+        // the correlation is done over the (fine) search range
+        secondaryWindowWidth = (windowWidthRaw + 2*halfSearchRangeAcrossFine)*rawDataOversamplingFactor;
+        secondaryWindowHeight = (windowHeightRaw + 2*halfSearchRangeDownFine)*rawDataOversamplingFactor;
 
         correlationSurfaceWidth = secondaryWindowWidth - windowWidth + 1;
         correlationSurfaceHeight = secondaryWindowHeight - windowHeight + 1;
 
         halfZoomWindowSizeRaw = settings.at("correlation_surface_zoom_in").value(
-                "half_range", std::min(halfSearchRangeAcrossRaw, 4));
+                "half_range", std::min(halfSearchRangeAcrossFine, 4));
 
         halfZoomWindowSizeRaw = std::min(halfZoomWindowSizeRaw,
-            std::min(correlationSurfaceWidth, correlationSurfaceHeight)/2);
+            std::min(correlationSurfaceWidth, correlationSurfaceHeight)/(2*rawDataOversamplingFactor));
 
         oversamplingFactor = settings.at("correlation_surface_zoom_in").value(
                 "oversampling_factor", 32);
 
-        zoomWindowSize = 2*halfZoomWindowSizeRaw;
-        correlationSurfaceSizeOversampled = zoomWindowSize*oversamplingFactor;
+        correlationMethod = settings.value("correlation", json::object()).value("method", "auto");
+        correlationMode = settings.value("correlation", json::object()).value("mode", "amplitude");
+        // persistent cache of the window spectra, shared by the runs of a pair network
+        spectrumCacheDirectory = settings.value("spectrum_cache", json::object()).value("directory", "");
+        // compiled kernels, cached per source, build options, device and driver
+        programCacheDirectory = settings.value("program_cache", json::object()).value("directory", "");
+        specializeKernels = settings.value("kernels", json::object()).value("specialize", true);
+        // per-stage timing of the device commands and host stages, with a Chrome trace timeline
+        profilingEnabled = settings.value("profiling", json::object()).value("enabled", false);
+        profilingTraceName = settings.value("profiling", json::object()).value("trace", "trace.json");
+        // the device type, cpu e.g. for PoCL
+        const std::string device = settings.value("device", json::object()).value("type", "gpu");
+        deviceType = device == "cpu" ? CL_DEVICE_TYPE_CPU
+            : device == "all" ? CL_DEVICE_TYPE_ALL : CL_DEVICE_TYPE_GPU;
+        // periodic checkpoint of the completed window groups, to resume an interrupted run
+        const json checkpoint = settings.value("checkpoint", json::object());
+        checkpointName = checkpoint.value("enabled", true)
+            ? checkpoint.value("file", offsetImageName + ".checkpoint") : std::string();
+        checkpointInterval = checkpoint.value("interval", 60.0f);
+        // the settings changing the outputs
+        json outputSettings = settings;
+        outputSettings.erase("checkpoint");
+        outputSettings.erase("profiling");
+        settingsHash = hash_fnv1a(outputSettings.dump());
+
+        // sparse mode: offsets at a list of points (across, down), the centers of the windows,
+        //  instead of a grid, returned as a single row in the order of the list
+        pointListName = settings.value("points", json::object()).value("file", "");
+        pointList.clear();
+        pointLineSpan = 0;
+        if (!pointListName.empty()) {
+            std::ifstream pointFile(pointListName);
+            if (pointFile.fail()) {
+                std::cerr << "The point list " << pointListName << " does not exist. \n";
+                exit(EXIT_FAILURE);
+            }
+            // one point per line, lines starting with # are comments
+            for (std::string point; std::getline(pointFile, point); ) {
+                std::istringstream fields(point);
+                double across, down;
+                if (point.empty() || point[0] == '#' || !(fields >> across >> down))
+                    continue;
+                pointList.push_back(make_int2(std::lround(across), std::lround(down)));
+            }
+            numberWindowAcross = pointList.size();
+            numberWindowDown = 1;
+            // windows starting within the line span are read together
+            pointLineSpan = std::max(0, settings.at("points").value("line_span", windowHeightRaw));
+        }
+        numberWindows = numberWindowAcross*numberWindowDown;
+
+        numberWindowAcrossInBatch = settings.value("batch", json::object()).value("across", 32);
+        numberWindowAcrossInBatch = std::max(1, std::min(numberWindowAcrossInBatch, numberWindowAcross));
+
+        oversamplingMethod = settings.at("correlation_surface_zoom_in").value("method", "dft");
+        oversamplingHalfRange = settings.at("correlation_surface_zoom_in").value("half_range_dft", 1.5f);
+
+        // analytic estimators, done in the peak search, skip the oversampling
+        if (oversamplingMethod == "parabolic")
+            subpixelEstimator = 1;
+        else if (oversamplingMethod == "gaussian")
+            subpixelEstimator = 2;
+        else if (oversamplingMethod == "sinc")
+            subpixelEstimator = 3;
+        else
+            subpixelEstimator = 0;
+
+        zoomWindowSize = 2*halfZoomWindowSizeRaw*rawDataOversamplingFactor;
+        if (subpixelEstimator != 0) {
+            // no oversampled surface
+            correlationSurfaceSizeOversampled = 0;
+            correlationSurfacePeakOversampled = 0;
+        }
+        else if (oversamplingMethod == "fft") {
+            // the whole zoom window is oversampled
+            correlationSurfaceSizeOversampled = zoomWindowSize*oversamplingFactor;
+            correlationSurfacePeakOversampled = zoomWindowSize/2*oversamplingFactor;
+        }
+        else {
+            // only (-half_range_dft, half_range_dft) around the coarse peak
+            correlationSurfacePeakOversampled = static_cast<int_type>(std::ceil(oversamplingHalfRange*oversamplingFactor));
+            correlationSurfaceSizeOversampled = 2*correlationSurfacePeakOversampled+1;
+        }
 
         std::cout << "Processing Ampcor between " << referenceImageName
-            << " and " << secondaryImageName << "\n"
+            << " and " << secondaryImageName
+            << (secondaryImageNames.size() > 1 ? " ... " + secondaryImageNames.back() : "") << "\n"
             << "Template window size "
                 << make_int2(windowWidth, windowHeight) << "\n"
             << "Search window size "
@@ -108,7 +246,14 @@ void cl::Ampcor::Ampcor::read_parameters_from_json(const std::string& filename)
             << "starting pixel (center of the first window)"
                 << make_int2(secondaryStartPixelAcross, secondaryStartPixelDown) << "\n"
             << "number of windows "
-                << make_int2(numberWindowAcross, numberWindowDown) << "\n" << "\n";
+                << make_int2(numberWindowAcross, numberWindowDown) << "\n";
+        if (!pointList.empty())
+            std::cout << "windows at " << pointList.size() << " points from " << pointListName << "\n";
+        if (pyramidFactor > 1)
+            std::cout << "coarse search decimated by " << pyramidFactor
+                << ", full-resolution half search range "
+                << make_int2(halfSearchRangeAcrossFine, halfSearchRangeDownFine) << "\n";
+        std::cout << "\n";
 
     } catch (const json::type_error& e) {
         std::cerr << "JSON type error: " << e.what() << std::endl;
@@ -119,10 +264,11 @@ void cl::Ampcor::Ampcor::read_parameters_from_json(const std::string& filename)
     }
 }
 
-void cl::Ampcor::Ampcor::run()
+void cl::Ampcor::Ampcor::run(const std::string& filename)
 {
     // read settings
-    read_parameters_from_json("ampcor.json");
+    read_parameters_from_json(filename);
+    bytesRead = 0;
 
     // open reference and secondary image files
     std::ifstream referenceFile(referenceImageName, std::ios::binary);
@@ -130,439 +276,1186 @@ void cl::Ampcor::Ampcor::run()
         std::cerr << "The reference image file does not exist. \n";
         exit(EXIT_FAILURE);
     }
-    std::ifstream secondaryFile(secondaryImageName, std::ios::binary);
-    if (secondaryFile.fail()){
-        std::cerr << "The secondary image file does not exist. \n";
-        exit(EXIT_FAILURE);
+    const int_type numberSecondaries = secondaryImageNames.size();
+    std::vector<std::ifstream> secondaryFiles(numberSecondaries);
+    for(int_type iSecondary=0; iSecondary<numberSecondaries; iSecondary++) {
+        secondaryFiles[iSecondary].open(secondaryImageNames[iSecondary], std::ios::binary);
+        if (secondaryFiles[iSecondary].fail()){
+            std::cerr << "The secondary image file " << secondaryImageNames[iSecondary] << " does not exist. \n";
+            exit(EXIT_FAILURE);
+        }
     }
 
     // ******* OpenCL initialization *********
     // initialize the opencl handles
-    clHandle handle(CL_DEVICE_TYPE_GPU);
+    clHandle handle(deviceType);
     cl::Context& context = handle.context;
     cl::Device& device = handle.device;
-    // build the kernel program
-    handle.program = cl::Ampcor::Program(context);
-    cl::Program& program = handle.program;
-    cl::CommandQueue queue(context, device);
+    // build the kernel program, specialized for the sizes of the fft and the correlation surface
+    //  (the other sizes, e.g. in a coarse search, use the generic kernels)
+    std::ostringstream specialization;
+    if (specializeKernels) {
+        const int_type fftWidth = next_power_of_2(secondaryWindowWidth);
+        const int_type fftHeight = next_power_of_2(secondaryWindowHeight);
+        specialization << "-DCL_AMPCOR_FFT_WIDTH=" << fftWidth
+            << " -DCL_AMPCOR_FFT_HEIGHT=" << fftHeight
+            << " -DCL_AMPCOR_FFT_LOG2_WIDTH=" << static_cast<int_type>(std::log2(fftWidth))
+            << " -DCL_AMPCOR_FFT_LOG2_HEIGHT=" << static_cast<int_type>(std::log2(fftHeight))
+            << " -DCL_AMPCOR_CORRELATION_SIZES"
+            << " -DCL_AMPCOR_REGION_WIDTH=" << correlationSurfaceWidth
+            << " -DCL_AMPCOR_REGION_HEIGHT=" << correlationSurfaceHeight
+            << " -DCL_AMPCOR_STORAGE_WIDTH=" << fftWidth
+            << " -DCL_AMPCOR_STORAGE_HEIGHT=" << fftHeight
+            << " -DCL_AMPCOR_WINDOW_WIDTH=" << windowWidth
+            << " -DCL_AMPCOR_WINDOW_HEIGHT=" << windowHeight
+            << " -DCL_AMPCOR_SEARCH_WIDTH=" << secondaryWindowWidth
+            << " -DCL_AMPCOR_SEARCH_HEIGHT=" << secondaryWindowHeight
+            << " -DCL_AMPCOR_ZOOM_SIZE=" << zoomWindowSize;
+    }
     //CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE TBD - CL_QUEUE_PROPERTIES
+    cl::CommandQueue queue(context, device, profilingEnabled ? CL_QUEUE_PROFILING_ENABLE : 0);
+    // the processors take the profiler from the handle
+    std::unique_ptr<cl::Ampcor::Profiler> profiler;
+    if (profilingEnabled)
+        profiler.reset(new cl::Ampcor::Profiler(queue));
+    handle.profiler = profiler.get();
+    {
+        cl::Ampcor::HostTimer timer(profiler.get(), "build_program");
+        handle.program = cl::Ampcor::Program(context, programCacheDirectory, specialization.str());
+    }
+    cl::Program& program = handle.program;
 
     // ******* CPU/host Buffers *************
+    // the windows are processed in groups, read together in a pair of image strips
+    // on a grid (pointLineSpan = 0), each row of windows is a group; its positions are computed,
+    //  and its gross offsets and window mask are read, one row at a time, when it is processed,
+    //  so that the host memory does not grow with the number of windows
+    // with a point list, the windows sorted by lines form groups of the windows starting within
+    //  pointLineSpan lines; the positions, gross offsets and mask of all points are kept for the sort
+    const bool onGrid = pointList.empty();
+    const bool windowMasked = !maskImageName.empty() && maskType != "pixel";
+    const bool pixelMasked = !maskImageName.empty() && maskType == "pixel";
+    std::ifstream grossOffsetFile, windowMaskFile;
+    if (!grossOffsetImageName.empty())
+        grossOffsetFile.open(grossOffsetImageName, std::ios::binary);
+    if (windowMasked)
+        windowMaskFile.open(maskImageName, std::ios::binary);
+
+    // the first pixel (across, down) of a reference window, from the center of its search window
+    auto windowPositionAt = [&](const int_type across, const int_type down) {
+        return make_int2(across - secondaryWindowWidthRaw/2 + halfSearchRangeAcrossRaw,
+            down - secondaryWindowHeightRaw/2 + halfSearchRangeDownRaw);
+    };
+    // gross offsets (across, down) of n windows from index, rounded to pixels, zero if not provided
+    std::vector<cl_float2> grossOffsetLine;
+    auto readGrossOffsets = [&](const int_type index, const int_type n, cl_int2* gross) {
+        if (grossOffsetImageName.empty()) {
+            std::fill(gross, gross+n, make_int2(0, 0));
+            return;
+        }
+        grossOffsetLine.resize(n);
+        grossOffsetFile.seekg(static_cast<size_type>(index)*cfloatBytes);
+        grossOffsetFile.read(reinterpret_cast<char *>(grossOffsetLine.data()), n*cfloatBytes);
+        if (!grossOffsetFile) {
+            std::cerr << "Failed to read the gross offset image " << grossOffsetImageName
+                << " of size " << make_int2(numberWindowAcross, numberWindowDown) << "\n";
+            exit(EXIT_FAILURE);
+        }
+        for(int_type k=0; k<n; k++)
+            gross[k] = make_int2(std::lround(grossOffsetLine[k].x), std::lround(grossOffsetLine[k].y));
+    };
+    // validity mask of n windows from index, masked windows are not processed
+    auto readWindowMask = [&](const int_type index, const int_type n, unsigned char* mask) {
+        if (!windowMasked) {
+            std::fill(mask, mask+n, 1);
+            return;
+        }
+        windowMaskFile.seekg(index);
+        windowMaskFile.read(reinterpret_cast<char *>(mask), n);
+        if (!windowMaskFile) {
+            std::cerr << "Failed to read the window mask " << maskImageName << "\n";
+            exit(EXIT_FAILURE);
+        }
+        for(int_type k=0; k<n; k++)
+            mask[k] = (mask[k] != 0);
+    };
+
+    // the points, sorted by lines into groups
+    std::vector<cl_int2> pointPosition, pointGrossOffset;
+    std::vector<unsigned char> pointMask;
+    std::vector<int_type> windowOrder, groupStart;
+    int_type numberGroups = numberWindowDown;
+    if (!onGrid) {
+        pointPosition.resize(numberWindows);
+        for(int_type index=0; index<numberWindows; index++)
+            pointPosition[index] = windowPositionAt(pointList[index].x, pointList[index].y);
+        pointGrossOffset.resize(numberWindows);
+        readGrossOffsets(0, numberWindows, pointGrossOffset.data());
+        pointMask.resize(numberWindows);
+        readWindowMask(0, numberWindows, pointMask.data());
+
+        windowOrder.resize(numberWindows);
+        for(int_type index=0; index<numberWindows; index++)
+            windowOrder[index] = index;
+        std::stable_sort(windowOrder.begin(), windowOrder.end(),
+            [&](const int_type a, const int_type b) {
+                return pointPosition[a].y < pointPosition[b].y
+                    || (pointPosition[a].y == pointPosition[b].y && pointPosition[a].x < pointPosition[b].x); });
+        for(int_type k=0; k<numberWindows; k++) {
+            if (groupStart.empty()
+                || pointPosition[windowOrder[k]].y - pointPosition[windowOrder[groupStart.back()]].y > pointLineSpan)
+                groupStart.push_back(k);
+        }
+        numberGroups = groupStart.size();
+        groupStart.push_back(numberWindows);
+    }
+
+    // the windows of a group: their indices in the output, positions, gross offsets and mask,
+    //  the windows (and their shifted search windows) outside the images are masked out
+    std::vector<int_type> groupIndices;
+    std::vector<cl_int2> groupPositions, groupGrossOffsets;
+    std::vector<unsigned char> groupMask;
+    auto loadGroup = [&](const int_type iGroup) {
+        const int_type n = onGrid ? numberWindowAcross : groupStart[iGroup+1] - groupStart[iGroup];
+        groupIndices.resize(n);
+        groupPositions.resize(n);
+        groupGrossOffsets.resize(n);
+        groupMask.resize(n);
+        if (onGrid) {
+            const int_type first = iGroup*numberWindowAcross;
+            for(int_type k=0; k<n; k++) {
+                groupIndices[k] = first + k;
+                groupPositions[k] = windowPositionAt(secondaryStartPixelAcross + k*skipSampleAcross,
+                    secondaryStartPixelDown + iGroup*skipSampleDown);
+            }
+            readGrossOffsets(first, n, groupGrossOffsets.data());
+            readWindowMask(first, n, groupMask.data());
+        }
+        else {
+            for(int_type k=0; k<n; k++) {
+                const int_type index = windowOrder[groupStart[iGroup]+k];
+                groupIndices[k] = index;
+                groupPositions[k] = pointPosition[index];
+                groupGrossOffsets[k] = pointGrossOffset[index];
+                groupMask[k] = pointMask[index];
+            }
+        }
+        for(int_type k=0; k<n; k++) {
+            const cl_int2& position = groupPositions[k];
+            const int_type secondaryAcross = position.x - halfSearchRangeAcrossRaw + groupGrossOffsets[k].x;
+            const int_type secondaryDown = position.y - halfSearchRangeDownRaw + groupGrossOffsets[k].y;
+            if (position.x < 0 || position.x + windowWidthRaw > referenceImageWidth
+                || position.y < 0 || position.y + windowHeightRaw > referenceImageHeight
+                || secondaryAcross < 0 || secondaryAcross + secondaryWindowWidthRaw > secondaryImageWidth
+                || secondaryDown < 0 || secondaryDown + secondaryWindowHeightRaw > secondaryImageHeight)
+                groupMask[k] = 0;
+        }
+        return n;
+    };
+
+    // the reference strip covers the windows of a group,
+    //  the secondary strip covers all (shifted) search windows of a group
+    // the positions and gross offsets of all windows, in the group order, key the spectrum caches
+    const int_type referenceStripHeight = windowHeightRaw + pointLineSpan;
+    int_type secondaryStripHeight = secondaryWindowHeightRaw;
+    int_type maxGroupSize = 1;
+    cl_ulong positionHash = 0, grossOffsetHash = 0;
+    for(int_type iGroup=0; iGroup<numberGroups; iGroup++) {
+        const int_type n = loadGroup(iGroup);
+        int_type minDown = INT_MAX, maxDown = INT_MIN;
+        for(int_type k=0; k<n; k++) {
+            if (!groupMask[k])
+                continue;
+            minDown = std::min(minDown, groupPositions[k].y + groupGrossOffsets[k].y);
+            maxDown = std::max(maxDown, groupPositions[k].y + groupGrossOffsets[k].y);
+        }
+        if (minDown <= maxDown)
+            secondaryStripHeight = std::max(secondaryStripHeight, secondaryWindowHeightRaw + maxDown - minDown);
+        maxGroupSize = std::max(maxGroupSize, n);
+        positionHash = iGroup == 0 ? hash_fnv1a(groupPositions.data(), n*sizeof(cl_int2))
+            : hash_fnv1a(groupPositions.data(), n*sizeof(cl_int2), positionHash);
+        grossOffsetHash = iGroup == 0 ? hash_fnv1a(groupGrossOffsets.data(), n*sizeof(cl_int2))
+            : hash_fnv1a(groupGrossOffsets.data(), n*sizeof(cl_int2), grossOffsetHash);
+    }
+
+    // validity mask per pixel, a window is kept if enough pixels of its reference window are valid
+    //  read for each group, the same lines as its reference strip
+    std::ifstream pixelMaskFile;
+    std::vector<unsigned char> maskLines;
+    if (pixelMasked) {
+        pixelMaskFile.open(maskImageName, std::ios::binary);
+        maskLines.resize(referenceImageWidth*referenceStripHeight);
+    }
+    const int_type minValid = static_cast<int_type>(std::ceil(maskMinValidFraction*windowWidthRaw*windowHeightRaw));
+    auto applyPixelMask = [&](const int_type n) {
+        // from the first window to process (the masked windows may be outside the image)
+        int_type lineStart = INT_MAX;
+        for(int_type k=0; k<n; k++)
+            if (groupMask[k])
+                lineStart = std::min(lineStart, groupPositions[k].y);
+        if (lineStart == INT_MAX)
+            return;
+        lineStart = std::max(lineStart, 0);
+        const int_type lines = std::min(referenceStripHeight, referenceImageHeight - lineStart);
+        if (lines <= 0)
+            return;
+        pixelMaskFile.seekg(static_cast<size_type>(lineStart)*referenceImageWidth);
+        pixelMaskFile.read(reinterpret_cast<char *>(maskLines.data()), lines*referenceImageWidth);
+        if (!pixelMaskFile) {
+            std::cerr << "Failed to read the pixel mask " << maskImageName << "\n";
+            exit(EXIT_FAILURE);
+        }
+        for(int_type k=0; k<n; k++) {
+            if (!groupMask[k])
+                continue;
+            const cl_int2& position = groupPositions[k];
+            int_type valid = 0;
+            for(int_type row=0; row<windowHeightRaw; row++) {
+                auto line = maskLines.begin() + (position.y - lineStart + row)*referenceImageWidth;
+                valid += std::count_if(line + position.x, line + position.x + windowWidthRaw,
+                    [](unsigned char m) { return m != 0; });
+            }
+            groupMask[k] = (valid >= minValid);
+        }
+    };
+
     // Create read buffers for reference/secondary images
-    size_type referenceBufferSize = referenceImageWidth*windowHeightRaw*cfloatBytes;
+    size_type referenceBufferSize = referenceImageWidth*referenceStripHeight*cfloatBytes;
     char * referenceBufferHost = new char[referenceBufferSize];
     // Create read buffers for secondary images
-    size_type secondaryBufferSize = secondaryImageWidth*secondaryWindowHeightRaw*cfloatBytes;
-    char * secondaryBufferHost = new char[secondaryBufferSize];
+    size_type secondaryBufferSize = secondaryImageWidth*secondaryStripHeight*cfloatBytes;
+    std::vector<std::vector<char>> secondaryBuffersHost(numberSecondaries, std::vector<char>(secondaryBufferSize));
+
+    // offset, snr and covariance (xx, yy, xy) of the windows in a group, one for each secondary image,
+    //  written to the output files once the group is done
+    std::vector<std::vector<cl_float2>> groupOffsets(numberSecondaries, std::vector<cl_float2>(maxGroupSize));
+    std::vector<std::vector<cl_float>> groupSnr(numberSecondaries, std::vector<cl_float>(maxGroupSize));
+    std::vector<std::vector<cl_float>> groupCov(numberSecondaries, std::vector<cl_float>(3*maxGroupSize));
+    // max locations for all windows in a batch
+    const int_type batch = numberWindowAcrossInBatch;
+    std::vector<cl_int2> offsetRaw(batch), offsetFrac(batch);
+    // sub-pixel offsets relative to the max locations
+    std::vector<cl_float2> offsetSubpixel(batch);
+    std::vector<cl_float> snrBatch(batch), covBatch(3*batch);
+    // shifts of the search windows from the coarse search
+    std::vector<cl_int2> offsetShift(batch, make_int2(0, 0));
+    // (col, row) of the first pixel of each window in the strips
+    std::vector<cl_int2> referenceOrigins(batch), secondaryOrigins(batch);
+    // origins of all windows in a group, and the windows with data to be processed
+    std::vector<cl_int2> groupReferenceOrigins(maxGroupSize), groupSecondaryOrigins(maxGroupSize);
+    std::vector<cl_int> groupValid(numberSecondaries*maxGroupSize, 1);
+    std::vector<int_type> groupWindows;
+    groupWindows.reserve(maxGroupSize);
+    int_type numberWindowsSkipped = 0, numberWindowsMasked = 0;
+    // masked windows and windows without data get nan offsets, k is the window in the group
+    auto skipWindow = [&](const int_type iSecondary, const int_type k) {
+        numberWindowsSkipped++;
+        groupOffsets[iSecondary][k] = make_float2(NAN, NAN);
+        groupSnr[iSecondary][k] = 0.0f;
+        groupCov[iSecondary][3*k] = groupCov[iSecondary][3*k+1] = 99.0f;
+        groupCov[iSecondary][3*k+2] = 0.0f;
+    };
+
+    // in a stack, the output files are numbered after the secondary images, e.g., offset_1.slc
+    auto stackFileName = [&](const std::string& name, const int_type iSecondary) {
+        if (numberSecondaries == 1)
+            return name;
+        const size_type dot = name.find_last_of('.');
+        const size_type split = (dot == std::string::npos || dot < name.find_last_of('/')+1) ? name.size() : dot;
+        return name.substr(0, split) + "_" + std::to_string(iSecondary) + name.substr(split);
+    };
+    // the checkpoint records the groups completed in order, for the settings and input files of this run:
+    //  the images, gross offsets, mask and point list, by size and modification time
+    std::ostringstream checkpointKey;
+    checkpointKey << std::hex << settingsHash << std::dec << " groups " << numberGroups;
+    std::vector<std::string> inputNames{referenceImageName};
+    inputNames.insert(inputNames.end(), secondaryImageNames.begin(), secondaryImageNames.end());
+    inputNames.insert(inputNames.end(), {grossOffsetImageName, maskImageName, pointListName});
+    for (const auto& name : inputNames) {
+        struct stat info;
+        if (!name.empty() && ::stat(name.c_str(), &info) == 0)
+            checkpointKey << " " << info.st_size << " " << info.st_mtime;
+        else
+            checkpointKey << " -";
+    }
+    int_type firstGroup = 0;
+    if (!checkpointName.empty()) {
+        std::ifstream checkpointFile(checkpointName);
+        if (checkpointFile) {
+            try {
+                const json checkpoint = json::parse(checkpointFile);
+                if (checkpoint.at("key").get<std::string>() == checkpointKey.str())
+                    firstGroup = std::min(checkpoint.at("completed").get<int_type>(), numberGroups);
+            }
+            catch (const json::exception& e) {
+                // an incomplete checkpoint, start over
+            }
+        }
+    }
 
-    // offset image
-    cl_float2* offset_image = new cl_float2[numberWindowAcross*numberWindowDown];
-    cl_int2 offsetRaw, offsetFrac;
+    // the outputs are written group by group
+    std::vector<std::unique_ptr<cl::Ampcor::OffsetWriter>> offsetWriters;
+    for(int_type iSecondary=0; iSecondary<numberSecondaries; iSecondary++) {
+        offsetWriters.emplace_back(new cl::Ampcor::OffsetWriter(stackFileName(offsetImageName, iSecondary),
+            stackFileName(snrImageName, iSecondary), stackFileName(covImageName, iSecondary), numberWindows,
+            firstGroup > 0));
+        // the outputs of the completed groups are lost with a new file
+        if (!offsetWriters[iSecondary]->resumed())
+            firstGroup = 0;
+    }
+    if (firstGroup > 0)
+        std::cout << "Resuming from the checkpoint " << checkpointName << ", "
+            << firstGroup << " out of " << numberGroups << " window groups are done \n";
+
+    // the outputs are synced to the disk before the checkpoint is replaced (written and renamed),
+    //  so that it never covers the groups not in the files, also pre-sized or memory-mapped
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+    auto saveCheckpoint = [&](const int_type completed) {
+        cl::Ampcor::HostTimer timer(profiler.get(), "checkpoint");
+        for(int_type iSecondary=0; iSecondary<numberSecondaries; iSecondary++)
+            offsetWriters[iSecondary]->flush();
+        const std::string temporaryName = checkpointName + ".tmp";
+        {
+            std::ofstream checkpointFile(temporaryName);
+            checkpointFile << json({{"key", checkpointKey.str()}, {"completed", completed}}).dump() << "\n";
+            if (!checkpointFile.flush()) {
+                std::cerr << "Failed to write the checkpoint " << temporaryName << std::endl;
+                return;
+            }
+        }
+        if (std::rename(temporaryName.c_str(), checkpointName.c_str()) != 0)
+            std::cerr << "Failed to save the checkpoint " << checkpointName << std::endl;
+        lastCheckpoint = std::chrono::steady_clock::now();
+    };
+    auto writeGroup = [&](const int_type iGroup, const int_type* windows, const int_type numberGroupWindows) {
+        {
+            cl::Ampcor::HostTimer timer(profiler.get(), "write_outputs");
+            for(int_type iSecondary=0; iSecondary<numberSecondaries; iSecondary++)
+                offsetWriters[iSecondary]->write(windows, numberGroupWindows, groupOffsets[iSecondary].data(),
+                    groupSnr[iSecondary].data(), groupCov[iSecondary].data());
+        }
+        if (!checkpointName.empty() && iGroup+1 < numberGroups
+            && std::chrono::duration<float>(std::chrono::steady_clock::now() - lastCheckpoint).count()
+                >= checkpointInterval)
+            saveCheckpoint(iGroup+1);
+    };
 
     // ******** GPU/device Buffers ***************
+    // all windows in a batch are stored contiguously
     // for fft, we need to pad zero to a size in power of 2
     int windowWidthP2 = next_power_of_2(secondaryWindowWidth);
     int windowHeightP2 = next_power_of_2(secondaryWindowHeight);
 
+    // image strips covering a row of windows
+    cl::Buffer referenceStrip(context, CL_MEM_READ_ONLY, referenceBufferSize);
+    std::vector<cl::Buffer> secondaryStrips;
+    for(int_type iSecondary=0; iSecondary<numberSecondaries; iSecondary++)
+        secondaryStrips.emplace_back(context, CL_MEM_READ_ONLY, secondaryBufferSize);
+    cl::Buffer& secondaryStrip = secondaryStrips.front();
+    // window origins in the strips
+    cl::Buffer referenceWindowOrigins(context, CL_MEM_READ_ONLY, batch*sizeof(cl_int2));
+    cl::Buffer secondaryWindowOrigins(context, CL_MEM_READ_WRITE, batch*sizeof(cl_int2));
+    // window origins and flags of all windows in a group, for the no-data detection
+    cl::Buffer groupReferenceWindowOrigins(context, CL_MEM_READ_ONLY, maxGroupSize*sizeof(cl_int2));
+    cl::Buffer groupSecondaryWindowOrigins(context, CL_MEM_READ_ONLY, maxGroupSize*sizeof(cl_int2));
+    cl::Buffer groupWindowValid(context, CL_MEM_WRITE_ONLY, maxGroupSize*sizeof(cl_int));
+    // search windows over the full search range, and their shifts, for the coarse search
+    cl::Buffer secondaryWindowOriginsFull(context, CL_MEM_READ_ONLY, batch*sizeof(cl_int2));
+    cl::Buffer secondaryWindowShifts(context, CL_MEM_READ_WRITE, batch*sizeof(cl_int2));
+
+    // raw data oversampling of the complex windows
+    // raw windows, not padded: the windows in power of 2 are oversampled by FFT, the others by
+    //  a matrix (zoom) DFT, since the zero padding to a power of 2 would ring at the window edges
+    const int_type referenceWindowRawWidth = windowWidthRaw;
+    const int_type referenceWindowRawHeight = windowHeightRaw;
+    const int_type secondaryWindowRawWidth = secondaryWindowWidth/rawDataOversamplingFactor;
+    const int_type secondaryWindowRawHeight = secondaryWindowHeight/rawDataOversamplingFactor;
+    cl::Buffer referenceWindowRaw, secondaryWindowRaw;
+    // oversampled windows, stacked along rows, used as strips to gather the amplitudes
+    cl::Buffer referenceWindowOS, secondaryWindowOS;
+    cl::Buffer referenceWindowOSOrigins, secondaryWindowOSOrigins;
+    if (rawDataOversamplingFactor > 1) {
+        const int_type r2 = rawDataOversamplingFactor*rawDataOversamplingFactor;
+        referenceWindowRaw = cl::Buffer(context, CL_MEM_READ_WRITE,
+            batch*referenceWindowRawWidth*referenceWindowRawHeight*cfloatBytes);
+        secondaryWindowRaw = cl::Buffer(context, CL_MEM_READ_WRITE,
+            batch*secondaryWindowRawWidth*secondaryWindowRawHeight*cfloatBytes);
+        referenceWindowOS = cl::Buffer(context, CL_MEM_READ_WRITE,
+            batch*r2*referenceWindowRawWidth*referenceWindowRawHeight*cfloatBytes);
+        secondaryWindowOS = cl::Buffer(context, CL_MEM_READ_WRITE,
+            batch*r2*secondaryWindowRawWidth*secondaryWindowRawHeight*cfloatBytes);
+        // window b starts at row b*height
+        std::vector<cl_int2> origins(batch);
+        for (int_type b=0; b<batch; b++)
+            origins[b] = make_int2(0, b*rawDataOversamplingFactor*referenceWindowRawHeight);
+        referenceWindowOSOrigins = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            batch*sizeof(cl_int2), origins.data());
+        for (int_type b=0; b<batch; b++)
+            origins[b] = make_int2(0, b*rawDataOversamplingFactor*secondaryWindowRawHeight);
+        secondaryWindowOSOrigins = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            batch*sizeof(cl_int2), origins.data());
+    }
+
     // reference image (windowWidth, windowHeight), but enlarged to the secondary window size
     cl::Buffer referenceWindow(context, CL_MEM_READ_WRITE,
-        windowWidthP2*windowHeightP2*cfloatBytes);
+        batch*windowWidthP2*windowHeightP2*cfloatBytes);
     // secondary image, window + secondary range
     cl::Buffer secondaryWindow(context, CL_MEM_READ_WRITE,
-        windowWidthP2*windowHeightP2*cfloatBytes);
+        batch*windowWidthP2*windowHeightP2*cfloatBytes);
 
     // reference image sum and sum square
     cl::Buffer referenceWindowSum2(context, CL_MEM_READ_WRITE,
-        cfloatBytes);
+        batch*cfloatBytes);
     // secondary image sum area table
     cl::Buffer secondaryWindowSAT2(context, CL_MEM_READ_WRITE,
-        secondaryWindowHeight*secondaryWindowWidth*cfloatBytes);
+        batch*secondaryWindowHeight*secondaryWindowWidth*cfloatBytes);
 
     // correlation surfaces
     cl::Buffer correlationSurface(context, CL_MEM_READ_WRITE,
-        windowWidthP2*windowHeightP2*cfloatBytes);
+        batch*windowWidthP2*windowHeightP2*cfloatBytes);
     cl::Buffer correlationSurfaceZoom(context, CL_MEM_READ_WRITE,
-        zoomWindowSize*zoomWindowSize*cfloatBytes);
-    cl::Buffer correlationSurfaceOS(context, CL_MEM_READ_WRITE,
-        correlationSurfaceSizeOversampled*correlationSurfaceSizeOversampled*cfloatBytes);
+        batch*zoomWindowSize*zoomWindowSize*cfloatBytes);
+    // oversampled, only when no analytic sub-pixel estimator is used
+    cl::Buffer correlationSurfaceOS;
+    if (subpixelEstimator == 0)
+        correlationSurfaceOS = cl::Buffer(context, CL_MEM_READ_WRITE,
+            batch*correlationSurfaceSizeOversampled*correlationSurfaceSizeOversampled*cfloatBytes);
 
     // correlation surface max location/offset
     cl::Buffer corrSurfaceMaxLoc(context, CL_MEM_READ_WRITE,
-        sizeof(cl_int2));
+        batch*sizeof(cl_int2));
+    cl::Buffer corrSurfaceMaxLocOS(context, CL_MEM_READ_WRITE,
+        batch*sizeof(cl_int2));
+    cl::Buffer corrSurfaceSubpixel(context, CL_MEM_READ_WRITE,
+        batch*cfloatBytes);
+    // snr and offset covariance
+    cl::Buffer corrSurfaceSNR(context, CL_MEM_READ_WRITE,
+        batch*sizeof(cl_float));
+    cl::Buffer corrSurfaceCov(context, CL_MEM_READ_WRITE,
+        3*batch*sizeof(cl_float));
+
+    // correlate the complex windows (coherent) or their amplitudes
+    const int_type coherent = (correlationMode == "complex") ? 1 : 0;
 
     // get kernels from the program
-    // kernel to take amplitude values for reference window
-    cl::Kernel referenceAmplitudeKernel;
-    CL_CHECK_ERROR(referenceAmplitudeKernel= cl::Kernel(program, "matrix_complex_amplitude"));
-    CL_CHECK_ERROR(referenceAmplitudeKernel.setArg(0, referenceWindow));
-    CL_CHECK_ERROR(referenceAmplitudeKernel.setArg(1, windowWidth));
-    CL_CHECK_ERROR(referenceAmplitudeKernel.setArg(2, windowHeight));
-    CL_CHECK_ERROR(referenceAmplitudeKernel.setArg(3, windowWidthP2));
-    CL_CHECK_ERROR(referenceAmplitudeKernel.setArg(4, windowHeightP2));
-    cl::NDRange referenceAmplitudeKernel_globalSize(windowWidthP2, windowHeightP2);
-
-    // kernel to take amplitude values for reference window
-    cl::Kernel secondaryAmplitudeKernel;
-    CL_CHECK_ERROR(secondaryAmplitudeKernel= cl::Kernel(program, "matrix_complex_amplitude"));
-    CL_CHECK_ERROR(secondaryAmplitudeKernel.setArg(0, secondaryWindow));
-    CL_CHECK_ERROR(secondaryAmplitudeKernel.setArg(1, secondaryWindowWidth));
-    CL_CHECK_ERROR(secondaryAmplitudeKernel.setArg(2, secondaryWindowHeight));
-    CL_CHECK_ERROR(secondaryAmplitudeKernel.setArg(3, windowWidthP2));
-    CL_CHECK_ERROR(secondaryAmplitudeKernel.setArg(4, windowHeightP2));
-    cl::NDRange secondaryAmplitudeKernel_globalSize(windowWidthP2, windowHeightP2);
-
-    // kernel to compute sum and sum square of the reference window
-    cl::Kernel referenceSumKernel;
-    CL_CHECK_ERROR(referenceSumKernel=cl::Kernel(program, "matrix_sum_sum2"));
+    // kernel to gather the reference windows from the strip, take amplitudes, pad zeros,
+    //  and compute the sum and sum square - for normalization
+    cl::Kernel referenceGatherKernel;
     size_type maxWorkGroupSize;
-    CL_CHECK_ERROR(referenceSumKernel.getWorkGroupInfo(device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
-    maxWorkGroupSize = std::min(next_power_of_2(windowHeight*windowWidth), maxWorkGroupSize);
-    CL_CHECK_ERROR(referenceSumKernel.setArg(0, referenceWindow));
-    CL_CHECK_ERROR(referenceSumKernel.setArg(1, referenceWindowSum2));
-    CL_CHECK_ERROR(referenceSumKernel.setArg(2, cl::Local(cfloatBytes*maxWorkGroupSize)));
-    CL_CHECK_ERROR(referenceSumKernel.setArg(3, windowWidth));
-    CL_CHECK_ERROR(referenceSumKernel.setArg(4, windowHeight));
-    CL_CHECK_ERROR(referenceSumKernel.setArg(5, windowWidthP2));
-    CL_CHECK_ERROR(referenceSumKernel.setArg(6, windowHeightP2));
-
-    cl::NDRange referenceSumKernel_globalSize(maxWorkGroupSize);
-    cl::NDRange referenceSumKernel_localSize(maxWorkGroupSize);
-
-    // kernel to compute sum (and sum sq) area table for the secondary window
-    cl::Kernel secondarySatKernel;
-    CL_CHECK_ERROR(secondarySatKernel=cl::Kernel(program, "matrix_sat_sat2"));
-    CL_CHECK_ERROR(secondarySatKernel.setArg(0, secondaryWindow));
-    CL_CHECK_ERROR(secondarySatKernel.setArg(1, secondaryWindowSAT2));
-    CL_CHECK_ERROR(secondarySatKernel.setArg(2, secondaryWindowWidth));
-    CL_CHECK_ERROR(secondarySatKernel.setArg(3, secondaryWindowHeight));
-    CL_CHECK_ERROR(secondarySatKernel.setArg(4, windowWidthP2));
-    CL_CHECK_ERROR(secondarySatKernel.setArg(5, windowHeightP2));
-    CL_CHECK_ERROR(secondarySatKernel.getWorkGroupInfo(device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
-    maxWorkGroupSize = std::min(static_cast<size_type>(std::max(secondaryWindowWidth, secondaryWindowHeight)),
-        maxWorkGroupSize);
-    cl::NDRange secondarySatKernel_globalSize(maxWorkGroupSize);
-    cl::NDRange secondarySatKernel_localSize(maxWorkGroupSize);
+    CL_CHECK_ERROR(referenceGatherKernel = cl::Kernel(program, "window_gather_amplitude_sum2"));
+    CL_CHECK_ERROR(referenceGatherKernel.getWorkGroupInfo(device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
+    maxWorkGroupSize = std::min(maxWorkGroupSize, static_cast<size_type>(256));
+    if (rawDataOversamplingFactor > 1) {
+        // from the oversampled windows
+        CL_CHECK_ERROR(referenceGatherKernel.setArg(0, referenceWindowOS));
+        CL_CHECK_ERROR(referenceGatherKernel.setArg(1, rawDataOversamplingFactor*referenceWindowRawWidth));
+        CL_CHECK_ERROR(referenceGatherKernel.setArg(2, batch*rawDataOversamplingFactor*referenceWindowRawHeight));
+        CL_CHECK_ERROR(referenceGatherKernel.setArg(3, referenceWindowOSOrigins));
+    }
+    else {
+        CL_CHECK_ERROR(referenceGatherKernel.setArg(0, referenceStrip));
+        CL_CHECK_ERROR(referenceGatherKernel.setArg(1, referenceImageWidth));
+        CL_CHECK_ERROR(referenceGatherKernel.setArg(2, referenceStripHeight));
+        CL_CHECK_ERROR(referenceGatherKernel.setArg(3, referenceWindowOrigins));
+    }
+    CL_CHECK_ERROR(referenceGatherKernel.setArg(4, referenceWindow));
+    CL_CHECK_ERROR(referenceGatherKernel.setArg(5, referenceWindowSum2));
+    CL_CHECK_ERROR(referenceGatherKernel.setArg(6, cl::Local(maxWorkGroupSize*cfloatBytes)));
+    CL_CHECK_ERROR(referenceGatherKernel.setArg(7, windowWidth));
+    CL_CHECK_ERROR(referenceGatherKernel.setArg(8, windowHeight));
+    CL_CHECK_ERROR(referenceGatherKernel.setArg(9, windowWidthP2));
+    CL_CHECK_ERROR(referenceGatherKernel.setArg(10, windowHeightP2));
+    CL_CHECK_ERROR(referenceGatherKernel.setArg(11, 1)); // no decimation
+    CL_CHECK_ERROR(referenceGatherKernel.setArg(12, coherent));
+    cl::NDRange referenceGatherKernel_globalSize(maxWorkGroupSize, batch);
+    cl::NDRange referenceGatherKernel_localSize(maxWorkGroupSize, 1);
+
+    // kernel to gather the secondary windows from the strip, take amplitudes, pad zeros,
+    //  and compute the prefix sums along rows of the sum (and sum sq) area table
+    cl::Kernel secondaryGatherKernel;
+    CL_CHECK_ERROR(secondaryGatherKernel = cl::Kernel(program, "window_gather_amplitude_sat2"));
+    CL_CHECK_ERROR(secondaryGatherKernel.getWorkGroupInfo(device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
+    // the in-group scan runs over 2*localSize elements, in power of 2
+    maxWorkGroupSize = std::min(std::max(next_power_of_2(secondaryWindowWidth)>>1, static_cast<size_type>(1)),
+        prev_power_of_2(maxWorkGroupSize));
+    if (rawDataOversamplingFactor > 1) {
+        // from the oversampled windows
+        CL_CHECK_ERROR(secondaryGatherKernel.setArg(0, secondaryWindowOS));
+        CL_CHECK_ERROR(secondaryGatherKernel.setArg(1, rawDataOversamplingFactor*secondaryWindowRawWidth));
+        CL_CHECK_ERROR(secondaryGatherKernel.setArg(2, batch*rawDataOversamplingFactor*secondaryWindowRawHeight));
+        CL_CHECK_ERROR(secondaryGatherKernel.setArg(3, secondaryWindowOSOrigins));
+    }
+    else {
+        CL_CHECK_ERROR(secondaryGatherKernel.setArg(0, secondaryStrip));
+        CL_CHECK_ERROR(secondaryGatherKernel.setArg(1, secondaryImageWidth));
+        CL_CHECK_ERROR(secondaryGatherKernel.setArg(2, secondaryStripHeight));
+        CL_CHECK_ERROR(secondaryGatherKernel.setArg(3, secondaryWindowOrigins));
+    }
+    CL_CHECK_ERROR(secondaryGatherKernel.setArg(4, secondaryWindow));
+    CL_CHECK_ERROR(secondaryGatherKernel.setArg(5, secondaryWindowSAT2));
+    CL_CHECK_ERROR(secondaryGatherKernel.setArg(6, cl::Local(2*maxWorkGroupSize*cfloatBytes)));
+    CL_CHECK_ERROR(secondaryGatherKernel.setArg(7, secondaryWindowWidth));
+    CL_CHECK_ERROR(secondaryGatherKernel.setArg(8, secondaryWindowHeight));
+    CL_CHECK_ERROR(secondaryGatherKernel.setArg(9, windowWidthP2));
+    CL_CHECK_ERROR(secondaryGatherKernel.setArg(10, windowHeightP2));
+    CL_CHECK_ERROR(secondaryGatherKernel.setArg(11, 1)); // no decimation
+    CL_CHECK_ERROR(secondaryGatherKernel.setArg(12, coherent));
+    cl::NDRange secondaryGatherKernel_globalSize(maxWorkGroupSize, batch);
+    cl::NDRange secondaryGatherKernel_localSize(maxWorkGroupSize, 1);
+
+    // kernel to complete the sum area tables with the prefix sums along columns
+    cl::Kernel secondarySATKernel;
+    CL_CHECK_ERROR(secondarySATKernel = cl::Kernel(program, "window_sat2_scan_columns"));
+    CL_CHECK_ERROR(secondarySATKernel.getWorkGroupInfo(device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
+    maxWorkGroupSize = std::min(std::max(next_power_of_2(secondaryWindowHeight)>>1, static_cast<size_type>(1)),
+        prev_power_of_2(maxWorkGroupSize));
+    CL_CHECK_ERROR(secondarySATKernel.setArg(0, secondaryWindowSAT2));
+    CL_CHECK_ERROR(secondarySATKernel.setArg(1, cl::Local(2*maxWorkGroupSize*cfloatBytes)));
+    CL_CHECK_ERROR(secondarySATKernel.setArg(2, secondaryWindowWidth));
+    CL_CHECK_ERROR(secondarySATKernel.setArg(3, secondaryWindowHeight));
+    cl::NDRange secondarySATKernel_globalSize(maxWorkGroupSize, secondaryWindowWidth, batch);
+    cl::NDRange secondarySATKernel_localSize(maxWorkGroupSize, 1, 1);
+
+    // kernel to flag the windows with data, from the statistics of the raw windows
+    cl::Kernel windowValidKernel;
+    CL_CHECK_ERROR(windowValidKernel = cl::Kernel(program, "window_valid"));
+    CL_CHECK_ERROR(windowValidKernel.getWorkGroupInfo(device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
+    maxWorkGroupSize = std::min(maxWorkGroupSize, static_cast<size_type>(256));
+    CL_CHECK_ERROR(windowValidKernel.setArg(0, referenceStrip));
+    CL_CHECK_ERROR(windowValidKernel.setArg(1, referenceImageWidth));
+    CL_CHECK_ERROR(windowValidKernel.setArg(2, referenceStripHeight));
+    CL_CHECK_ERROR(windowValidKernel.setArg(3, groupReferenceWindowOrigins));
+    CL_CHECK_ERROR(windowValidKernel.setArg(4, secondaryStrip));
+    CL_CHECK_ERROR(windowValidKernel.setArg(5, secondaryImageWidth));
+    CL_CHECK_ERROR(windowValidKernel.setArg(6, secondaryStripHeight));
+    CL_CHECK_ERROR(windowValidKernel.setArg(7, groupSecondaryWindowOrigins));
+    CL_CHECK_ERROR(windowValidKernel.setArg(8, groupWindowValid));
+    CL_CHECK_ERROR(windowValidKernel.setArg(9, cl::Local(maxWorkGroupSize*cfloatBytes)));
+    CL_CHECK_ERROR(windowValidKernel.setArg(10, windowWidthRaw));
+    CL_CHECK_ERROR(windowValidKernel.setArg(11, windowHeightRaw));
+    CL_CHECK_ERROR(windowValidKernel.setArg(12, secondaryWindowWidthRaw));
+    CL_CHECK_ERROR(windowValidKernel.setArg(13, secondaryWindowHeightRaw));
+    CL_CHECK_ERROR(windowValidKernel.setArg(14, maxZeroFraction));
+    // globalSize = {localSize, windows in a group}
+    cl::NDRange windowValidKernel_localSize(maxWorkGroupSize, 1);
+
+    // kernels to gather the complex windows and oversamplers, for raw data oversampling
+    cl::Kernel referenceGatherComplexKernel, secondaryGatherComplexKernel;
+    std::unique_ptr<cl::Ampcor::Oversampler> referenceOversampler, secondaryOversampler;
+    std::unique_ptr<cl::Ampcor::ZoomOversampler> referenceZoomOversampler, secondaryZoomOversampler;
+    cl::NDRange referenceGatherComplexKernel_globalSize(referenceWindowRawWidth, referenceWindowRawHeight, batch);
+    cl::NDRange secondaryGatherComplexKernel_globalSize(secondaryWindowRawWidth, secondaryWindowRawHeight, batch);
+    if (rawDataOversamplingFactor > 1) {
+        CL_CHECK_ERROR(referenceGatherComplexKernel = cl::Kernel(program, "window_gather_complex"));
+        CL_CHECK_ERROR(referenceGatherComplexKernel.setArg(0, referenceStrip));
+        CL_CHECK_ERROR(referenceGatherComplexKernel.setArg(1, referenceImageWidth));
+        CL_CHECK_ERROR(referenceGatherComplexKernel.setArg(2, referenceStripHeight));
+        CL_CHECK_ERROR(referenceGatherComplexKernel.setArg(3, referenceWindowOrigins));
+        CL_CHECK_ERROR(referenceGatherComplexKernel.setArg(4, referenceWindowRaw));
+        CL_CHECK_ERROR(referenceGatherComplexKernel.setArg(5, windowWidthRaw));
+        CL_CHECK_ERROR(referenceGatherComplexKernel.setArg(6, windowHeightRaw));
+
+        CL_CHECK_ERROR(secondaryGatherComplexKernel = cl::Kernel(program, "window_gather_complex"));
+        CL_CHECK_ERROR(secondaryGatherComplexKernel.setArg(0, secondaryStrip));
+        CL_CHECK_ERROR(secondaryGatherComplexKernel.setArg(1, secondaryImageWidth));
+        CL_CHECK_ERROR(secondaryGatherComplexKernel.setArg(2, secondaryStripHeight));
+        CL_CHECK_ERROR(secondaryGatherComplexKernel.setArg(3, secondaryWindowOrigins));
+        CL_CHECK_ERROR(secondaryGatherComplexKernel.setArg(4, secondaryWindowRaw));
+        CL_CHECK_ERROR(secondaryGatherComplexKernel.setArg(5, secondaryWindowWidth/rawDataOversamplingFactor));
+        CL_CHECK_ERROR(secondaryGatherComplexKernel.setArg(6, secondaryWindowHeight/rawDataOversamplingFactor));
+
+        auto isPowerOf2 = [](const int_type n) { return next_power_of_2(n) == static_cast<size_type>(n); };
+        if (isPowerOf2(referenceWindowRawWidth) && isPowerOf2(referenceWindowRawHeight))
+            referenceOversampler.reset(new cl::Ampcor::Oversampler(handle,
+                referenceWindowRawWidth, referenceWindowRawHeight,
+                rawDataOversamplingFactor*referenceWindowRawWidth, rawDataOversamplingFactor*referenceWindowRawHeight,
+                referenceWindowRaw, referenceWindowOS, batch));
+        else
+            referenceZoomOversampler.reset(new cl::Ampcor::ZoomOversampler(handle,
+                referenceWindowRawWidth, referenceWindowRawHeight,
+                rawDataOversamplingFactor*referenceWindowRawWidth, rawDataOversamplingFactor*referenceWindowRawHeight,
+                rawDataOversamplingFactor, referenceWindowRaw, referenceWindowOS, batch, false));
+        if (isPowerOf2(secondaryWindowRawWidth) && isPowerOf2(secondaryWindowRawHeight))
+            secondaryOversampler.reset(new cl::Ampcor::Oversampler(handle,
+                secondaryWindowRawWidth, secondaryWindowRawHeight,
+                rawDataOversamplingFactor*secondaryWindowRawWidth, rawDataOversamplingFactor*secondaryWindowRawHeight,
+                secondaryWindowRaw, secondaryWindowOS, batch));
+        else
+            secondaryZoomOversampler.reset(new cl::Ampcor::ZoomOversampler(handle,
+                secondaryWindowRawWidth, secondaryWindowRawHeight,
+                rawDataOversamplingFactor*secondaryWindowRawWidth, rawDataOversamplingFactor*secondaryWindowRawHeight,
+                rawDataOversamplingFactor, secondaryWindowRaw, secondaryWindowOS, batch, false));
+    }
+
+    // coarse search, to shift the search windows
+    std::unique_ptr<cl::Ampcor::CoarseSearch> coarseSearch;
+    if (pyramidFactor > 1) {
+        coarseSearch.reset(new cl::Ampcor::CoarseSearch(handle,
+            referenceStrip, referenceImageWidth, referenceStripHeight, referenceWindowOrigins,
+            secondaryStrip, secondaryImageWidth, secondaryStripHeight, secondaryWindowOriginsFull,
+            windowWidthRaw, windowHeightRaw,
+            halfSearchRangeAcrossRaw, halfSearchRangeDownRaw,
+            halfSearchRangeAcrossFine, halfSearchRangeDownFine,
+            pyramidFactor,
+            secondaryWindowOrigins, secondaryWindowShifts, batch));
+    }
 
     // cross-correlation (un-normalized) processor
     cl::Ampcor::Correlator correlator(handle,
         windowWidthP2, windowHeightP2,
+        windowWidth, windowHeight,
+        correlationSurfaceWidth, correlationSurfaceHeight,
         referenceWindow,
         secondaryWindow,
-        correlationSurface);
-
-    // kernel for normalization
-    cl::Kernel corrNormalizeKernel;
-    CL_CHECK_ERROR(corrNormalizeKernel=cl::Kernel(program, "correlation_normalize"));
-    CL_CHECK_ERROR(corrNormalizeKernel.setArg(0, correlationSurface));
-    CL_CHECK_ERROR(corrNormalizeKernel.setArg(1, referenceWindowSum2));
-    CL_CHECK_ERROR(corrNormalizeKernel.setArg(2, secondaryWindowSAT2));
-    CL_CHECK_ERROR(corrNormalizeKernel.setArg(3, correlationSurfaceWidth));
-    CL_CHECK_ERROR(corrNormalizeKernel.setArg(4, correlationSurfaceHeight));
-    CL_CHECK_ERROR(corrNormalizeKernel.setArg(5, windowWidthP2));
-    CL_CHECK_ERROR(corrNormalizeKernel.setArg(6, windowHeightP2));
-    CL_CHECK_ERROR(corrNormalizeKernel.setArg(7, windowWidth));
-    CL_CHECK_ERROR(corrNormalizeKernel.setArg(8, windowHeight));
-    CL_CHECK_ERROR(corrNormalizeKernel.setArg(9, secondaryWindowWidth));
-    CL_CHECK_ERROR(corrNormalizeKernel.setArg(10, secondaryWindowHeight));
-    cl::NDRange corrNormalizeKernel_globalSize(correlationSurfaceWidth, correlationSurfaceHeight);
-
-    // kernel for finding the max location in correlation surface
-    cl::Kernel findMaxLocationKernel(program, "matrix_max_location");
-    CL_CHECK_ERROR(findMaxLocationKernel.getWorkGroupInfo(handle.device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
-    maxWorkGroupSize = std::min(next_power_of_2(correlationSurfaceWidth*correlationSurfaceHeight),
-        maxWorkGroupSize);
-    CL_CHECK_ERROR(findMaxLocationKernel.setArg(0, correlationSurface));
-    CL_CHECK_ERROR(findMaxLocationKernel.setArg(1, corrSurfaceMaxLoc));
-    CL_CHECK_ERROR(findMaxLocationKernel.setArg(2, cl::Local(maxWorkGroupSize*sizeof(float))));
-    CL_CHECK_ERROR(findMaxLocationKernel.setArg(3, cl::Local(maxWorkGroupSize*sizeof(int))));
-    CL_CHECK_ERROR(findMaxLocationKernel.setArg(4, correlationSurfaceWidth));
-    CL_CHECK_ERROR(findMaxLocationKernel.setArg(5, correlationSurfaceHeight));
-    CL_CHECK_ERROR(findMaxLocationKernel.setArg(6, windowHeightP2));
-    cl::NDRange findMaxLocationKernel_globalSize(maxWorkGroupSize);
-    cl::NDRange findMaxLocationKernel_localSize(maxWorkGroupSize);
-
-    // kernel for extracting a small window around the peak position for oversampling
-    cl::Kernel extractRealKernel(program, "matrix_extract_real");
-    CL_CHECK_ERROR(extractRealKernel.setArg(0, correlationSurface)); // input
-    CL_CHECK_ERROR(extractRealKernel.setArg(1, correlationSurfaceZoom)); //output
-    CL_CHECK_ERROR(extractRealKernel.setArg(2, correlationSurfaceWidth));  // input actual width
-    CL_CHECK_ERROR(extractRealKernel.setArg(3, correlationSurfaceHeight)); // input actual height
-    CL_CHECK_ERROR(extractRealKernel.setArg(4, windowWidthP2));  // input storage width / stride
-    CL_CHECK_ERROR(extractRealKernel.setArg(5, corrSurfaceMaxLoc)); // extract center
-    CL_CHECK_ERROR(extractRealKernel.setArg(6, -halfZoomWindowSizeRaw)); // offset
-    CL_CHECK_ERROR(extractRealKernel.setArg(7, -halfZoomWindowSizeRaw)); // offset
-    // extract location needs to be updated during the run
-    cl::NDRange extractRealKernel_globalSize(zoomWindowSize, zoomWindowSize);
+        correlationSurface,
+        CL_CORRELATOR_FFT, batch);
+    // select the direct or fft method
+    if (coherent) {
+        // the direct method only correlates real values
+        correlator.setMethod(CL_CORRELATOR_FFT);
+    }
+    else if (correlationMethod == "fft") {
+        correlator.setMethod(CL_CORRELATOR_FFT);
+    }
+    else if (correlationMethod == "direct") {
+        correlator.setMethod(CL_CORRELATOR_DIRECT);
+    }
+    else if (correlationMethod == "benchmark") {
+        // time both methods on zero-filled windows
+        CL_CHECK_ERROR(queue.enqueueFillBuffer(referenceWindow, make_float2(0.0f, 0.0f),
+            0, batch*windowWidthP2*windowHeightP2*cfloatBytes));
+        CL_CHECK_ERROR(queue.enqueueFillBuffer(secondaryWindow, make_float2(0.0f, 0.0f),
+            0, batch*windowWidthP2*windowHeightP2*cfloatBytes));
+        correlator.benchmark(queue);
+    }
+    else {
+        correlator.setMethod(cl::Ampcor::Correlator::costModel(
+            windowWidthP2, windowHeightP2, windowWidth, windowHeight,
+            correlationSurfaceWidth, correlationSurfaceHeight));
+    }
+    std::cout << "Cross-correlation method: "
+        << (correlator.method() == CL_CORRELATOR_DIRECT ? "direct" : "fft")
+        << (coherent ? ", complex" : ", amplitude") << "\n";
+
+    // persistent caches of the window spectra (fft method), keyed by the image (path, size and time),
+    //  the window geometry, the padding and the window positions
+    // the search windows depend on the coarse search and are not cached in a pyramid search
+    std::unique_ptr<cl::Ampcor::SpectrumCache> referenceCache;
+    std::vector<std::unique_ptr<cl::Ampcor::SpectrumCache>> secondaryCaches(numberSecondaries);
+    if (!spectrumCacheDirectory.empty() && correlator.method() == CL_CORRELATOR_FFT) {
+        ::mkdir(spectrumCacheDirectory.c_str(), 0755);
+        auto cacheKey = [&](const std::string& role, const std::string& image,
+            const int_type width, const int_type height) {
+            struct stat info;
+            std::ostringstream key;
+            key << role << " " << image;
+            if (::stat(image.c_str(), &info) == 0)
+                key << " " << info.st_size << " " << info.st_mtime;
+            key << " " << width << "x" << height
+                << " window " << windowWidthRaw << "x" << windowHeightRaw
+                << " search " << halfSearchRangeAcrossFine << "x" << halfSearchRangeDownFine
+                << " padding " << windowWidthP2 << "x" << windowHeightP2
+                << " oversampling " << rawDataOversamplingFactor
+                << " mode " << correlationMode
+                << " positions " << std::hex << positionHash;
+            return key.str();
+        };
+        referenceCache.reset(new cl::Ampcor::SpectrumCache(spectrumCacheDirectory,
+            cacheKey("reference", referenceImageName, referenceImageWidth, referenceImageHeight),
+            numberWindows, windowWidthP2*windowHeightP2, 1));
+        for(int_type iSecondary=0; iSecondary<numberSecondaries && !coarseSearch; iSecondary++) {
+            std::ostringstream gross;
+            gross << " gross " << std::hex << grossOffsetHash;
+            secondaryCaches[iSecondary].reset(new cl::Ampcor::SpectrumCache(spectrumCacheDirectory,
+                cacheKey("secondary", secondaryImageNames[iSecondary], secondaryImageWidth, secondaryImageHeight)
+                    + gross.str(),
+                numberWindows, windowWidthP2*windowHeightP2, secondaryWindowWidth*secondaryWindowHeight));
+        }
+    }
+    // the windows of a batch, in the output order
+    std::vector<int_type> batchIndices(batch);
+
+    // kernel to normalize the correlation surface, find its max location
+    //  and extract a small window around the peak position for oversampling
+    cl::Kernel corrPeakZoomKernel;
+    CL_CHECK_ERROR(corrPeakZoomKernel=cl::Kernel(program, "correlation_normalize_peak_zoom"));
+    CL_CHECK_ERROR(corrPeakZoomKernel.getWorkGroupInfo(device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
+    maxWorkGroupSize = std::min(maxWorkGroupSize,
+        next_power_of_2(correlationSurfaceWidth*correlationSurfaceHeight));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(0, correlationSurface));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(1, referenceWindowSum2));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(2, secondaryWindowSAT2));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(3, corrSurfaceMaxLoc));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(4, correlationSurfaceZoom));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(5, corrSurfaceSubpixel));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(6, cl::Local(maxWorkGroupSize*sizeof(cl_float))));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(7, cl::Local(maxWorkGroupSize*sizeof(cl_int))));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(8, cl::Local(zoomWindowSize*zoomWindowSize*sizeof(cl_float))));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(9, cl::Local(maxWorkGroupSize*cfloatBytes)));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(10, corrSurfaceSNR));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(11, corrSurfaceCov));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(12, correlationSurfaceWidth));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(13, correlationSurfaceHeight));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(14, windowWidthP2));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(15, windowHeightP2));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(16, windowWidth));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(17, windowHeight));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(18, secondaryWindowWidth));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(19, secondaryWindowHeight));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(20, zoomWindowSize));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(21, zoomWindowSize));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(22, -zoomWindowSize/2)); // offset
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(23, -zoomWindowSize/2)); // offset
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(24, subpixelEstimator));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(25, oversamplingFactor)); // for sinc interpolation
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(26, coherent));
+    // the peak neighbourhood excluded from the snr noise, limited to about half of the surface
+    //  (e.g., small search ranges or the fine search of the pyramid) to leave samples for the noise
+    const int_type statHalf = std::min(correlationSurfaceStatSize/2*rawDataOversamplingFactor,
+        (std::min(correlationSurfaceWidth, correlationSurfaceHeight)-1)/4);
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(27, statHalf));
+    CL_CHECK_ERROR(corrPeakZoomKernel.setArg(28, static_cast<cl_float>(rawDataOversamplingFactor)));
+    // one work-group per window
+    cl::NDRange corrPeakZoomKernel_globalSize(maxWorkGroupSize, batch);
+    cl::NDRange corrPeakZoomKernel_localSize(maxWorkGroupSize, 1);
 
     // oversampler for the correlation surface
-    cl::Ampcor::Oversampler correlationOversampler(
-        handle, zoomWindowSize, zoomWindowSize,
-        correlationSurfaceSizeOversampled, correlationSurfaceSizeOversampled,
-        correlationSurfaceZoom, correlationSurfaceOS);
-
-    // kernel for finding the max location in the oversampled correlation surface
-    cl::Kernel findMaxLocationOSKernel(program, "matrix_max_location");
-    CL_CHECK_ERROR(findMaxLocationOSKernel.getWorkGroupInfo(device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
-    maxWorkGroupSize = std::min(next_power_of_2(correlationSurfaceSizeOversampled*correlationSurfaceSizeOversampled),
-        maxWorkGroupSize);
-    CL_CHECK_ERROR(findMaxLocationOSKernel.setArg(0, correlationSurfaceOS));
-    CL_CHECK_ERROR(findMaxLocationOSKernel.setArg(1, corrSurfaceMaxLoc));
-    CL_CHECK_ERROR(findMaxLocationOSKernel.setArg(2, cl::Local(maxWorkGroupSize*sizeof(float))));
-    CL_CHECK_ERROR(findMaxLocationOSKernel.setArg(3, cl::Local(maxWorkGroupSize*sizeof(int))));
-    CL_CHECK_ERROR(findMaxLocationOSKernel.setArg(4, correlationSurfaceSizeOversampled));
-    CL_CHECK_ERROR(findMaxLocationOSKernel.setArg(5, correlationSurfaceSizeOversampled));
-    CL_CHECK_ERROR(findMaxLocationOSKernel.setArg(6, correlationSurfaceSizeOversampled));
-    cl::NDRange findMaxLocationOSKernel_globalSize(maxWorkGroupSize);
-    cl::NDRange findMaxLocationOSKernel_localSize(maxWorkGroupSize);
+    std::unique_ptr<cl::Ampcor::Oversampler> correlationOversampler;
+    std::unique_ptr<cl::Ampcor::ZoomOversampler> correlationZoomOversampler;
+    // processor for finding the max location in the oversampled correlation surface
+    std::unique_ptr<cl::Ampcor::MaxLocationReduction> findMaxLocationOS;
+    if (subpixelEstimator != 0) {
+        // estimated in the peak search
+    }
+    else if (oversamplingMethod == "fft") {
+        correlationOversampler.reset(new cl::Ampcor::Oversampler(
+            handle, zoomWindowSize, zoomWindowSize,
+            correlationSurfaceSizeOversampled, correlationSurfaceSizeOversampled,
+            correlationSurfaceZoom, correlationSurfaceOS, batch));
+    }
+    else {
+        correlationZoomOversampler.reset(new cl::Ampcor::ZoomOversampler(
+            handle, zoomWindowSize, zoomWindowSize,
+            correlationSurfaceSizeOversampled, correlationSurfaceSizeOversampled,
+            oversamplingFactor, correlationSurfaceZoom, correlationSurfaceOS, batch));
+    }
+    if (subpixelEstimator == 0) {
+        findMaxLocationOS.reset(new cl::Ampcor::MaxLocationReduction(handle,
+            correlationSurfaceSizeOversampled, correlationSurfaceSizeOversampled,
+            correlationSurfaceSizeOversampled,
+            correlationSurfaceSizeOversampled*correlationSurfaceSizeOversampled,
+            correlationSurfaceOS, corrSurfaceMaxLocOS, batch));
+    }
 
 
     // ************* Processing ************
     // message interval
-    int_type message_interval = std::max(numberWindowDown/10, 1);
-    // iterative over windows along height
-    for(int_type iWindowDown=0; iWindowDown<numberWindowDown; iWindowDown++)
+    int_type message_interval = std::max(numberGroups/10, 1);
+    // iterative over groups of windows (rows on a grid)
+    for(int_type iGroup=firstGroup; iGroup<numberGroups; iGroup++)
     {
+        const int_type numberGroupWindows = loadGroup(iGroup);
+        const int_type* windows = groupIndices.data();
+        if (pixelMasked)
+            applyPixelMask(numberGroupWindows);
+        numberWindowsMasked += std::count(groupMask.begin(), groupMask.begin()+numberGroupWindows, 0);
+
+        // skip the groups without any window to process
+        int_type minReferenceDown = INT_MAX, minDown = INT_MAX;
+        for(int_type k=0; k<numberGroupWindows; k++) {
+            if (!groupMask[k])
+                continue;
+            minReferenceDown = std::min(minReferenceDown, groupPositions[k].y);
+            minDown = std::min(minDown, groupPositions[k].y + groupGrossOffsets[k].y);
+        }
+        if (minDown == INT_MAX) {
+            for(int_type iSecondary=0; iSecondary<numberSecondaries; iSecondary++)
+                for(int_type k=0; k<numberGroupWindows; k++)
+                    skipWindow(iSecondary, k);
+            writeGroup(iGroup, windows, numberGroupWindows);
+            continue;
+        }
+
         // **** read image to buffers
-        // determine the starting line(s)
-        size_type secondaryLineStart = secondaryStartPixelDown - secondaryWindowHeightRaw/2
-            + iWindowDown*skipSampleDown;
-        size_type referenceLineStart = secondaryLineStart + halfSearchRangeDownRaw;
-        // load the reference buffer
-        std::streampos offset;
-        offset = referenceLineStart*referenceImageWidth*cfloatBytes ;
-        referenceFile.seekg(offset);
-        referenceFile.read(referenceBufferHost, referenceBufferSize);
-        // load the secondary buffer
-        offset = secondaryLineStart*secondaryImageWidth*cfloatBytes;
-        secondaryFile.seekg(offset);
-        secondaryFile.read(secondaryBufferHost, secondaryBufferSize);
-
-        if(iWindowDown%message_interval == 0)
-            std::cout << "Processing windows (" << iWindowDown <<", x) - ("
-                << std::min(numberWindowDown, iWindowDown+message_interval)
-                << ", x) out of " << numberWindowDown << std::endl;
-
-        // iterate over windows along width
-        for(int_type iWindowAcross = 0; iWindowAcross<numberWindowAcross; iWindowAcross++)
+        // the reference strip starts at the first window to process,
+        //  the secondary strip starts at the lowest (shifted) search window in the group
+        const int_type referenceLineStart = minReferenceDown;
+        const int_type secondaryLineStart = minDown - halfSearchRangeDownRaw;
         {
-
-            // determine the starting column (along width)
-            size_type secondaryColStart = secondaryStartPixelAcross - secondaryWindowWidthRaw/2
-                + iWindowAcross*skipSampleAcross;
-            size_type referenceColStart = secondaryColStart + halfSearchRangeAcrossRaw;
-
-            // std::cout << "referenceStart " << referenceColStart << " " << referenceLineStart << "\n";
-            // std::cout << "secondaryStart " << secondaryColStart << " " << secondaryLineStart << "\n";
-
-            cl::size_t<3> s_origin;
-            s_origin[0] = referenceColStart*cfloatBytes;
-            s_origin[1] = 0;
-            s_origin[2] = 0;
-
-            cl::size_t<3> d_origin;
-            d_origin[0] = 0;
-            d_origin[1] = 0;
-            d_origin[2] = 0;
-
-            cl::size_t<3> region;
-            region[0] = windowWidth*cfloatBytes;
-            region[1] = windowHeight;
-            region[2] = 1;
-
-
-            // copy a window from reference host to device buffer
-            CL_CHECK_ERROR(queue.enqueueWriteBufferRect(
-                referenceWindow, // buffer
-                CL_TRUE, // blocking
-                d_origin, // buffer origin
-                s_origin, // host origin
-                region,   // rect region
-                windowWidthP2*cfloatBytes,       // dst buffer_row_pitch
-                0,    // buffer_slice_pitch, n/a for 1d/2d
-                referenceImageWidth*cfloatBytes,       // host_row_pitch
-                0,    // host_slice_pitch
-                referenceBufferHost // host posize_typeer
-                ));
-
-            // take amplitude
-            CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
-                referenceAmplitudeKernel,
-                cl::NullRange,
-                referenceAmplitudeKernel_globalSize
-                ));
-
-#ifdef CL_AMPCOR_STEP_DEBUG
-            buffer_debug<cl_float2>(queue, referenceWindow,
-                windowWidthP2, windowHeightP2, "reference amplitude");
-#endif
-            // compute the sum and sum square of reference window - for normalization
-            CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
-                referenceSumKernel,
-                cl::NullRange,
-                referenceSumKernel_globalSize, // globalSize
-                referenceSumKernel_globalSize
-                ));  // local/Workgroup Size
-
-#ifdef CL_AMPCOR_STEP_DEBUG
-            buffer_debug<cl_float2>(queue, referenceWindowSum2,
-                1, 1, "reference sum");
-#endif
-
-            // copy a window from secondary buffer
-            s_origin[0] = secondaryColStart*cfloatBytes;
-            region[0] = secondaryWindowWidth*cfloatBytes;
-            region[1] = secondaryWindowHeight;
-            CL_CHECK_ERROR(queue.enqueueWriteBufferRect(
-                secondaryWindow, // buffer
-                CL_TRUE, // blocking
-                d_origin, // buffer origin
-                s_origin, // host origin
-                region,   // rect region
-                windowWidthP2*cfloatBytes,       // dst buffer_row_pitch
-                0,    // buffer_slice_pitch, n/a for 1d/2d
-                secondaryImageWidth*cfloatBytes,       // host_row_pitch
-                0,    // host_slice_pitch
-                secondaryBufferHost // host posize_typeer
-                ));
-
-
-            // take the amplitude
-            CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
-                secondaryAmplitudeKernel,
-                cl::NullRange,
-                secondaryAmplitudeKernel_globalSize //globalSize
-                ));
+            cl::Ampcor::HostTimer timer(profiler.get(), "read_strips");
+            // load the reference buffer, up to the last line of the image
+            std::streampos offset;
+            offset = static_cast<size_type>(referenceLineStart)*referenceImageWidth*cfloatBytes;
+            referenceFile.seekg(offset);
+            referenceFile.read(referenceBufferHost, std::min(referenceBufferSize,
+                static_cast<size_type>(referenceImageHeight-referenceLineStart)*referenceImageWidth*cfloatBytes));
+            bytesRead += referenceFile.gcount();
+            // load the secondary buffers
+            offset = static_cast<size_type>(secondaryLineStart)*secondaryImageWidth*cfloatBytes;
+            for(int_type iSecondary=0; iSecondary<numberSecondaries; iSecondary++) {
+                secondaryFiles[iSecondary].seekg(offset);
+                secondaryFiles[iSecondary].read(secondaryBuffersHost[iSecondary].data(), std::min(secondaryBufferSize,
+                    static_cast<size_type>(secondaryImageHeight-secondaryLineStart)*secondaryImageWidth*cfloatBytes));
+                bytesRead += secondaryFiles[iSecondary].gcount();
+            }
+        }
+
+        // copy the strips to device
+        // non-blocking, the host buffers are kept until the max locations are read back
+        CL_CHECK_ERROR(queue.enqueueWriteBuffer(referenceStrip, CL_FALSE, 0,
+            referenceBufferSize, referenceBufferHost, nullptr, profile(profiler.get(), "write_reference_strip")));
+        for(int_type iSecondary=0; iSecondary<numberSecondaries; iSecondary++)
+            CL_CHECK_ERROR(queue.enqueueWriteBuffer(secondaryStrips[iSecondary], CL_FALSE, 0,
+                secondaryBufferSize, secondaryBuffersHost[iSecondary].data(), nullptr,
+                profile(profiler.get(), "write_secondary_strip")));
+
+        if(iGroup%message_interval == 0)
+            std::cout << "Processing window groups " << iGroup << " - "
+                << std::min(numberGroups, iGroup+message_interval)
+                << " out of " << numberGroups << std::endl;
+
+        for(int_type k=0; k<numberGroupWindows; k++)
+        {
+            // (col, row) of the windows in the strips
+            const cl_int2& position = groupPositions[k];
+            const cl_int2& gross = groupGrossOffsets[k];
+            groupReferenceOrigins[k] = make_int2(position.x, position.y - referenceLineStart);
+            // search windows shifted by the gross offsets
+            groupSecondaryOrigins[k] = make_int2(position.x - halfSearchRangeAcrossRaw + gross.x,
+                position.y - halfSearchRangeDownRaw + gross.y - secondaryLineStart);
+        }
+
+        // skip the masked windows and the windows without data,
+        //  only the windows to process are batched
+        // in a stack, a window is processed if it has data in any secondary image,
+        //  with nan offsets for the secondary images without data
+        std::fill(groupValid.begin(), groupValid.end(), 1);
+        if (skipNoData) {
+            CL_CHECK_ERROR(queue.enqueueWriteBuffer(groupReferenceWindowOrigins, CL_FALSE, 0,
+                numberGroupWindows*sizeof(cl_int2), groupReferenceOrigins.data(), nullptr,
+                profile(profiler.get(), "write_origins")));
+            CL_CHECK_ERROR(queue.enqueueWriteBuffer(groupSecondaryWindowOrigins, CL_FALSE, 0,
+                numberGroupWindows*sizeof(cl_int2), groupSecondaryOrigins.data(), nullptr,
+                profile(profiler.get(), "write_origins")));
+            for(int_type iSecondary=0; iSecondary<numberSecondaries; iSecondary++) {
+                CL_CHECK_ERROR(windowValidKernel.setArg(4, secondaryStrips[iSecondary]));
+                CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+                    windowValidKernel,
+                    cl::NullRange,
+                    cl::NDRange(windowValidKernel_localSize[0], numberGroupWindows),
+                    windowValidKernel_localSize,
+                    nullptr, profile(profiler.get(), "window_valid")
+                    ));
+                CL_CHECK_ERROR(queue.enqueueReadBuffer(groupWindowValid, CL_FALSE, 0,
+                    numberGroupWindows*sizeof(cl_int), groupValid.data()+iSecondary*maxGroupSize,
+                    nullptr, profile(profiler.get(), "read_window_valid")));
+            }
+            CL_CHECK_ERROR(queue.finish());
+        }
+        groupWindows.clear();
+        for(int_type k=0; k<numberGroupWindows; k++)
+        {
+            bool valid = false;
+            for(int_type iSecondary=0; iSecondary<numberSecondaries; iSecondary++)
+                valid = valid || groupValid[iSecondary*maxGroupSize+k];
+            if (groupMask[k] && valid)
+                groupWindows.push_back(k);
+            else
+                for(int_type iSecondary=0; iSecondary<numberSecondaries; iSecondary++)
+                    skipWindow(iSecondary, k);
+        }
+        const int_type numberBatchWindows = groupWindows.size();
+
+        // iterate over batches of windows in the group
+        for(int_type iWindowStart = 0; iWindowStart<numberBatchWindows; iWindowStart+=batch)
+        {
+            // windows in this batch (the last one may be partially filled)
+            const int_type nWindows = std::min(batch, numberBatchWindows-iWindowStart);
+
+            for(int_type iWindow=0; iWindow<nWindows; iWindow++)
+            {
+                referenceOrigins[iWindow] = groupReferenceOrigins[groupWindows[iWindowStart+iWindow]];
+                secondaryOrigins[iWindow] = groupSecondaryOrigins[groupWindows[iWindowStart+iWindow]];
+                batchIndices[iWindow] = windows[groupWindows[iWindowStart+iWindow]];
+            }
+            CL_CHECK_ERROR(queue.enqueueWriteBuffer(referenceWindowOrigins, CL_FALSE, 0,
+                nWindows*sizeof(cl_int2), referenceOrigins.data(), nullptr, profile(profiler.get(), "write_origins")));
+            // the coarse search sets the (shifted) search windows
+            CL_CHECK_ERROR(queue.enqueueWriteBuffer(coarseSearch ? secondaryWindowOriginsFull : secondaryWindowOrigins,
+                CL_FALSE, 0, nWindows*sizeof(cl_int2), secondaryOrigins.data(), nullptr, profile(profiler.get(), "write_origins")));
+
+            if (referenceCache && referenceCache->contains(batchIndices.data(), nWindows)) {
+                // the reference spectra and sums from the cache
+                referenceCache->load(queue, referenceWindow, referenceWindowSum2, batchIndices.data(), nWindows);
+            }
+            else {
+                if (rawDataOversamplingFactor > 1) {
+                    // gather the complex windows and oversample them
+                    CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+                        referenceGatherComplexKernel,
+                        cl::NullRange,
+                        referenceGatherComplexKernel_globalSize,
+                        cl::NullRange,
+                        nullptr, profile(profiler.get(), "gather_complex_reference")
+                        ));
+                    if (referenceOversampler)
+                        referenceOversampler->execute(queue);
+                    else
+                        referenceZoomOversampler->execute(queue);
+                }
+
+                // gather the reference windows, take amplitudes and compute the sum and sum square
+                CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+                    referenceGatherKernel,
+                    cl::NullRange,
+                    referenceGatherKernel_globalSize,
+                    referenceGatherKernel_localSize,
+                    nullptr, profile(profiler.get(), "gather_reference")
+                    ));
 
 #ifdef CL_AMPCOR_STEP_DEBUG
-            buffer_debug<cl_float2>(queue, secondaryWindow,
-                windowWidthP2, windowHeightP2, "secondaryWindow amplitude");
+                buffer_debug<cl_float2>(queue, referenceWindow,
+                    windowWidthP2, windowHeightP2, "reference amplitude");
+                buffer_debug<cl_float2>(queue, referenceWindowSum2,
+                    1, 1, "reference sum");
 #endif
-
-            // compute the sum area table
-            CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
-                secondarySatKernel,
-                cl::NullRange,
-                secondarySatKernel_globalSize,
-                secondarySatKernel_localSize
-                ));  // local/Workgroup Size
+                // fft the reference to freq space, only once for all secondary images
+                correlator.forwardReference(queue);
+                if (referenceCache)
+                    referenceCache->store(queue, referenceWindow, referenceWindowSum2, batchIndices.data(), nWindows);
+            }
+
+            // the reference windows (and their spectra) are shared by all secondary images
+            for(int_type iSecondary=0; iSecondary<numberSecondaries; iSecondary++)
+            {
+                if (numberSecondaries > 1) {
+                    // switch to the secondary strip
+                    if (rawDataOversamplingFactor > 1)
+                        CL_CHECK_ERROR(secondaryGatherComplexKernel.setArg(0, secondaryStrips[iSecondary]));
+                    else
+                        CL_CHECK_ERROR(secondaryGatherKernel.setArg(0, secondaryStrips[iSecondary]));
+                    if (coarseSearch)
+                        coarseSearch->setSecondaryStrip(secondaryStrips[iSecondary]);
+                }
+
+                if (coarseSearch) {
+                    if (iSecondary == 0)
+                        coarseSearch->execute(queue);
+                    else
+                        coarseSearch->executeSecondary(queue);
+                    CL_CHECK_ERROR(queue.enqueueReadBuffer(secondaryWindowShifts, CL_FALSE, 0,
+                        nWindows*sizeof(cl_int2), offsetShift.data(), nullptr, profile(profiler.get(), "read_coarse_shift")));
+                }
+
+                cl::Ampcor::SpectrumCache* secondaryCache = secondaryCaches[iSecondary].get();
+                if (secondaryCache && secondaryCache->contains(batchIndices.data(), nWindows)) {
+                    // the secondary spectra and sum area tables from the cache
+                    secondaryCache->load(queue, secondaryWindow, secondaryWindowSAT2, batchIndices.data(), nWindows);
+                }
+                else {
+                    if (rawDataOversamplingFactor > 1) {
+                        // gather the complex windows and oversample them
+                        CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+                            secondaryGatherComplexKernel,
+                            cl::NullRange,
+                            secondaryGatherComplexKernel_globalSize,
+                            cl::NullRange,
+                            nullptr, profile(profiler.get(), "gather_complex_secondary")
+                            ));
+                        if (secondaryOversampler)
+                            secondaryOversampler->execute(queue);
+                        else
+                            secondaryZoomOversampler->execute(queue);
+                    }
+
+                    // gather the secondary windows, take amplitudes and compute the sum area tables
+                    CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+                        secondaryGatherKernel,
+                        cl::NullRange,
+                        secondaryGatherKernel_globalSize,
+                        secondaryGatherKernel_localSize,
+                        nullptr, profile(profiler.get(), "gather_secondary")
+                        ));
+                    CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+                        secondarySATKernel,
+                        cl::NullRange,
+                        secondarySATKernel_globalSize,
+                        secondarySATKernel_localSize,
+                        nullptr, profile(profiler.get(), "sat_secondary")
+                        ));
 
 #ifdef CL_AMPCOR_STEP_DEBUG
-            buffer_debug<cl_float2>(queue, secondaryWindowSAT2,
-                secondaryWindowWidth, secondaryWindowHeight, "secondary SAT");
+                    buffer_debug<cl_float2>(queue, secondaryWindow,
+                        windowWidthP2, windowHeightP2, "secondaryWindow amplitude");
 #endif
-            // cross-correlation
-            correlator.execute(queue);
 
 #ifdef CL_AMPCOR_STEP_DEBUG
-            buffer_debug<cl_float2>(queue, correlationSurface,
-                windowWidthP2, windowHeightP2, "correlation large");
+                    buffer_debug<cl_float2>(queue, secondaryWindowSAT2,
+                        secondaryWindowWidth, secondaryWindowHeight, "secondary SAT");
 #endif
-
-            // normalize the correlation surface
-            CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
-                corrNormalizeKernel,
-                cl::NullRange,
-                corrNormalizeKernel_globalSize
-                ));
+                    // fft secondary to freq space
+                    correlator.forwardSecondary(queue);
+                    if (secondaryCache)
+                        secondaryCache->store(queue, secondaryWindow, secondaryWindowSAT2, batchIndices.data(), nWindows);
+                }
+                // cross-correlation, with the reference spectra of this batch
+                correlator.correlate(queue);
 
 #ifdef CL_AMPCOR_STEP_DEBUG
-            buffer_debug<cl_float2>(queue, correlationSurface,
-                windowWidthP2, windowHeightP2, "correlation normalized");
+                buffer_debug<cl_float2>(queue, correlationSurface,
+                    windowWidthP2, windowHeightP2, "correlation large");
 #endif
 
-            // find the max location in correlation surface
-            CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
-                findMaxLocationKernel,
-                cl::NullRange,
-                findMaxLocationKernel_globalSize, // globalSize
-                findMaxLocationKernel_localSize
-                ));
-
-            // copy max location
-            CL_CHECK_ERROR(queue.enqueueReadBuffer(
-                corrSurfaceMaxLoc,
-                CL_TRUE, // blocking
-                0, // offset
-                sizeof(cl_int2),
-                &offsetRaw
-                ));
-
-            offsetRaw.x -= halfZoomWindowSizeRaw;
-            offsetRaw.y -= halfZoomWindowSizeRaw;
-
-#ifdef CL_AMPCOR_STEP_DEBUG
-            std::cout << "max location first pass " << offsetRaw << "\n";
-#endif
-            // extract the real part and the top corners to get the correlation surface
-            CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
-                extractRealKernel,
-                cl::NullRange,
-                extractRealKernel_globalSize
-                ));
+                // normalize the correlation surface, find the max location
+                //  and extract the zoom window around it
+                CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+                    corrPeakZoomKernel,
+                    cl::NullRange,
+                    corrPeakZoomKernel_globalSize,
+                    corrPeakZoomKernel_localSize,
+                    nullptr, profile(profiler.get(), "correlation_peak_zoom")
+                    ));
 
 #ifdef CL_AMPCOR_STEP_DEBUG
-            buffer_debug<cl_float2>(queue, correlationSurfaceZoom,
-                zoomWindowSize, zoomWindowSize, "correlationSurfaceZoom");
+                buffer_debug<cl_float2>(queue, correlationSurfaceZoom,
+                    zoomWindowSize, zoomWindowSize, "correlationSurfaceZoom");
 #endif
 
-            /// use fft to oversample the correlation surface
-            correlationOversampler.execute(queue);
+                // copy max locations
+                CL_CHECK_ERROR(queue.enqueueReadBuffer(
+                    corrSurfaceMaxLoc,
+                    CL_FALSE, // non-blocking
+                    0, // offset
+                    nWindows*sizeof(cl_int2),
+                    offsetRaw.data(),
+                    nullptr, profile(profiler.get(), "read_max_location")
+                    ));
+                // copy snr and covariance
+                CL_CHECK_ERROR(queue.enqueueReadBuffer(corrSurfaceSNR, CL_FALSE, 0,
+                    nWindows*sizeof(cl_float), snrBatch.data(), nullptr, profile(profiler.get(), "read_snr")));
+                CL_CHECK_ERROR(queue.enqueueReadBuffer(corrSurfaceCov, CL_FALSE, 0,
+                    3*nWindows*sizeof(cl_float), covBatch.data(), nullptr, profile(profiler.get(), "read_covariance")));
+
+                if (subpixelEstimator == 0) {
+                    /// oversample the correlation surface
+                    if (correlationOversampler)
+                        correlationOversampler->execute(queue);
+                    else
+                        correlationZoomOversampler->execute(queue);
 
 #ifdef CL_AMPCOR_STEP_DEBUG
-            buffer_debug<cl_float2>(queue, correlationSurfaceOS,
-                correlationSurfaceSizeOversampled, correlationSurfaceSizeOversampled,
-                "correlationSurface OverSampled");
+                    buffer_debug<cl_float2>(queue, correlationSurfaceOS,
+                        correlationSurfaceSizeOversampled, correlationSurfaceSizeOversampled,
+                        "correlationSurface OverSampled");
 #endif
-            // find the max location in correlation surface
-            CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
-                findMaxLocationOSKernel,
-                cl::NullRange,
-                findMaxLocationOSKernel_globalSize, // globalSize
-                findMaxLocationOSKernel_localSize
-                ));  // local/Workgroup Size
-
-            // copy max location
-            CL_CHECK_ERROR(queue.enqueueReadBuffer(
-                corrSurfaceMaxLoc,
-                CL_TRUE, // blocking
-                0, // offset
-                sizeof(cl_int2),
-                &offsetFrac));
-
+                    // find the max location in correlation surface
+                    findMaxLocationOS->execute(queue);
+
+                    CL_CHECK_ERROR(queue.enqueueReadBuffer(
+                        corrSurfaceMaxLocOS,
+                        CL_TRUE, // blocking
+                        0, // offset
+                        nWindows*sizeof(cl_int2),
+                        offsetFrac.data(),
+                        nullptr, profile(profiler.get(), "read_max_location_oversampled")));
+                    for(int_type iWindow=0; iWindow<nWindows; iWindow++)
+                        offsetSubpixel[iWindow] = make_float2(
+                            (float)(offsetFrac[iWindow].x-correlationSurfacePeakOversampled)/(float)oversamplingFactor,
+                            (float)(offsetFrac[iWindow].y-correlationSurfacePeakOversampled)/(float)oversamplingFactor);
+                }
+                else {
+                    // estimated in the peak search
+                    CL_CHECK_ERROR(queue.enqueueReadBuffer(
+                        corrSurfaceSubpixel,
+                        CL_TRUE, // blocking
+                        0, // offset
+                        nWindows*cfloatBytes,
+                        offsetSubpixel.data(),
+                        nullptr, profile(profiler.get(), "read_subpixel")));
+                }
+
+                // the queue is synchronized by the blocking read, the stored spectra are complete
+                if (referenceCache)
+                    referenceCache->flush();
+                if (secondaryCache)
+                    secondaryCache->flush();
+                if (profiler)
+                    profiler->collect();
+
+                for(int_type iWindow=0; iWindow<nWindows; iWindow++)
+                {
 #ifdef CL_AMPCOR_STEP_DEBUG
-            std::cout << "max location second pass " << offsetFrac << "\n";
-            std::cout << "half secondary " << make_int2(halfSearchRangeAcrossRaw, halfSearchRangeDownRaw) << "\n";
+                    std::cout << "max location first pass " << offsetRaw[iWindow] << "\n";
+                    std::cout << "max location second pass " << offsetSubpixel[iWindow] << "\n";
+                    std::cout << "half secondary " << make_int2(halfSearchRangeAcrossRaw, halfSearchRangeDownRaw) << "\n";
 #endif
 
-            const int offset_index = iWindowDown*numberWindowAcross+iWindowAcross;
-            offset_image[offset_index].x = offsetRaw.x  - halfSearchRangeAcrossRaw
-              + (float)offsetFrac.x/(float)oversamplingFactor;
-            offset_image[offset_index].y = offsetRaw.y  - halfSearchRangeDownRaw
-              + (float)offsetFrac.y/(float)oversamplingFactor;
+                    // the window in the group and in the output
+                    const int_type k = groupWindows[iWindowStart+iWindow];
+                    // no data in this secondary image
+                    if (!groupValid[iSecondary*maxGroupSize+k]) {
+                        skipWindow(iSecondary, k);
+                        continue;
+                    }
+                    cl_float2& offset_value = groupOffsets[iSecondary][k];
+                    groupSnr[iSecondary][k] = snrBatch[iWindow];
+                    std::copy(covBatch.begin()+3*iWindow, covBatch.begin()+3*iWindow+3,
+                        groupCov[iSecondary].begin()+3*k);
+                    // the correlation surface is oversampled by rawDataOversamplingFactor
+                    offset_value.x = groupGrossOffsets[k].x + offsetShift[iWindow].x
+                      + (offsetRaw[iWindow].x + offsetSubpixel[iWindow].x)/rawDataOversamplingFactor
+                      - halfSearchRangeAcrossFine;
+                    offset_value.y = groupGrossOffsets[k].y + offsetShift[iWindow].y
+                      + (offsetRaw[iWindow].y + offsetSubpixel[iWindow].y)/rawDataOversamplingFactor
+                      - halfSearchRangeDownFine;
+                    // flag noisy windows
+                    if (snrBatch[iWindow] < thresholdSNR)
+                        offset_value = make_float2(NAN, NAN);
 
 #ifdef CL_AMPCOR_STEP_DEBUG
-            std::cout << "offset " << offset_image[offset_index] << "\n";
+                    std::cout << "offset " << offset_value << "\n";
 #endif
-        } // end of Across Windows Loop
-    } // end of Down Windows Loop
-
-    // write the offset to file
-    std::ofstream offsetFile(offsetImageName, std::ios::binary);
-    if (!offsetFile) {
-        std::cerr << "Failed to open the file for writing." << std::endl;
-        exit(EXIT_FAILURE);
+                }
+            } // end of secondary loop
+        } // end of batch loop
+        writeGroup(iGroup, windows, numberGroupWindows);
+    } // end of group loop
+
+    if (!maskImageName.empty())
+        std::cout << numberWindowsMasked
+            << " windows are masked out by " << maskImageName << " or outside the images \n";
+    if (numberWindowsSkipped > 0)
+        std::cout << numberWindowsSkipped << " windows masked or without data are skipped (nan offsets) \n";
+
+    for(int_type iSecondary=0; iSecondary<numberSecondaries; iSecondary++)
+    {
+        // close all files
+        offsetWriters[iSecondary].reset();
+        secondaryFiles[iSecondary].close();
+
+        std::cout << "The offset image of size " << make_int2(numberWindowAcross, numberWindowDown)
+            << " (" << secondaryImageNames[iSecondary] << ")"
+            << " is saved in " << stackFileName(offsetImageName, iSecondary)
+            << " in BIP - CFLOAT Format (offset_range, offset_azimuth)"
+            << (pointList.empty() ? "" : ", in the order of the point list") << " \n";
+        std::cout << "The snr image is saved in " << stackFileName(snrImageName, iSecondary) << " in FLOAT Format, "
+            << "and the offset covariance in " << stackFileName(covImageName, iSecondary)
+            << " in BIP - FLOAT Format (cov_range, cov_azimuth, cov_cross) \n";
     }
-    offsetFile.write(reinterpret_cast<const char *>(offset_image),
-        cfloatBytes*numberWindowAcross*numberWindowDown);
-
-    std::cout << "The offset image of size " << make_int2(numberWindowAcross, numberWindowDown)
-        << " is saved in " << offsetImageName
-        << " in BIP - CFLOAT Format (offset_range, offset_azimuth) \n";
-
-    // close all files
-    offsetFile.close();
+    if (thresholdSNR > 0.0f)
+        std::cout << "windows with snr below " << thresholdSNR << " have nan offsets \n";
     referenceFile.close();
-    secondaryFile.close();
+    // a completed run is not resumed
+    if (!checkpointName.empty())
+        std::remove(checkpointName.c_str());
+
+    if (profiler) {
+        CL_CHECK_ERROR(queue.finish());
+        profiler->summary(std::cout);
+        profiler->writeTrace(profilingTraceName);
+        std::cout << "The profiling timeline is saved in " << profilingTraceName
+            << " in Chrome trace format \n";
+    }
 
     // clean cl::Buffer
     // all done
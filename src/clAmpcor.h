@@ -8,6 +8,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include "clHelper.h"
 
 
@@ -32,12 +33,17 @@ struct Ampcor {
 
     //secondary image
     std::string secondaryImageName;     ///< secondary SLC image name
+    std::vector<std::string> secondaryImageNames; ///< secondary SLC image names, more than one in stack mode
     int_type imageDataType2;                 ///< secondary image data type
     int_type secondaryImageHeight;           ///< secondary image height
     int_type secondaryImageWidth;            ///< secondary image width
 
     std::string offsetImageName;       ///< Offset fields output filename
+    std::string grossOffsetImageName;  ///< Per-window gross offsets input filename (optional, same format as output)
     std::string snrImageName;          ///< Output SNR filename
+    std::string maskImageName;         ///< Validity mask input filename (optional, uint8, nonzero = valid)
+    std::string maskType;              ///< Validity mask per window (offset size) or per pixel (reference size)
+    float maskMinValidFraction;        ///< Min fraction of valid pixels in a reference window (per pixel mask)
     std::string covImageName;          ///< Output variance filename
 
     // chip or window size for raw data
@@ -50,11 +56,16 @@ struct Ampcor {
     int_type halfSearchRangeAcrossRaw;    ///< (secondaryWindowWidthRaw-windowWidthRaw)/2
     // secondary range is (-halfSearchRangeRaw, halfSearchRangeRaw)
 
+    // coarse-to-fine (pyramid) search
+    int_type pyramidFactor;            ///< decimation factor of the coarse search, 1 = no coarse search
+    int_type halfSearchRangeDownFine;  ///< half search range of the full-resolution search (down)
+    int_type halfSearchRangeAcrossFine;   ///< half search range of the full-resolution search (across)
+
     int_type secondaryWindowHeightRawZoomIn; ///< secondary window height used for zoom in
     int_type secondaryWindowWidthRawZoomIn;  ///< secondary window width used for zoom in
 
     // chip or window size after oversampling
-    const int_type rawDataOversamplingFactor=1;  ///< Raw data overampling factor (from original size to oversampled size)
+    int_type rawDataOversamplingFactor;  ///< Raw data overampling factor (from original size to oversampled size)
     int_type windowHeight;           ///< Template window length (oversampled size)
     int_type windowWidth;            ///< Template window width (original size)
     int_type secondaryWindowHeight;     ///< Search window height (oversampled size)
@@ -73,24 +84,52 @@ struct Ampcor {
     int_type zoomWindowSize;      ///< Zoom-in window size in correlation surface (same for down and across directions)
     int_type halfZoomWindowSizeRaw; ///<  half of zoomWindowSize/rawDataOversamplingFactor
     int_type correlationSurfaceSizeOversampled; /// width and height for oversampled correlation surface
+    int_type correlationSurfacePeakOversampled; ///< location of the coarse peak in the oversampled correlation surface
 
     int_type oversamplingFactor;  ///< Oversampling factor for int_typeerpolating correlation surface
+    std::string oversamplingMethod; ///< Oversampling method for correlation surface, dft (zoom) or fft
+    float oversamplingHalfRange;    ///< Half range (in pixels) around the coarse peak evaluated by the zoom dft
+    int_type subpixelEstimator;     ///< Sub-pixel estimator in the peak search, 0 = oversampling (dft/fft),
+                                    ///<  1 = parabolic, 2 = gaussian, 3 = sinc interpolation
 
     float thresholdSNR;      ///< Threshold of Signal noise ratio to remove noisy data
+    bool skipNoData;         ///< Skip windows without data (zero variance or mostly zeros)
+    float maxZeroFraction;   ///< Max fraction of zero pixels in a window with data
+
+    std::string correlationMethod; ///< cross-correlation method, fft, direct, auto (cost model) or benchmark
+    std::string correlationMode;   ///< cross-correlation of amplitudes or complex (coherent) values
+    std::string spectrumCacheDirectory; ///< directory of the window spectrum caches, empty = no cache
+    std::string programCacheDirectory;  ///< directory of the compiled program binaries, empty = no cache
+    bool specializeKernels;             ///< build the kernels with the correlation sizes as constants
+    bool profilingEnabled;              ///< time the device commands and host stages
+    std::string profilingTraceName;     ///< Chrome trace output filename of the profiling timeline
+    cl_device_type deviceType;          ///< OpenCL device type, gpu (default), cpu or all
+    std::string checkpointName;         ///< checkpoint of the completed window groups, empty = no checkpoint
+    float checkpointInterval;           ///< seconds between the checkpoints
+    cl_ulong settingsHash;              ///< hash of the settings, to match a checkpoint with its run
 
     // total number of chips/windows
     int_type numberWindowDown;           ///< number of total windows (down)
     int_type numberWindowAcross;         ///< number of total windows (across)
     int_type numberWindows; 				///< numberWindowDown*numberWindowAcross
+    int_type numberWindowAcrossInBatch;  ///< number of windows (across) processed in one batch
+
+    // sparse (point list) mode
+    std::string pointListName;           ///< Point list input filename (optional, text, across down per line)
+    std::vector<cl_int2> pointList;      ///< centers (across, down) of the windows, replacing the grid
+    int_type pointLineSpan;              ///< windows starting within these lines share the image strips
 
     int_type secondaryStartPixelDown;    ///< first starting pixel(used as center) in reference image (down)
     int_type secondaryStartPixelAcross;  ///< first starting pixel(used as center) in reference image (across)
     int_type secondaryEndPixelDown;    ///< first starting pixel in reference image (down)
     int_type secondaryEndPixelAcross;  ///< first starting pixel in reference image (across)
 
+    // statistics of the last run
+    size_type bytesRead;               ///< bytes read from the image files
+
     // methods
     void read_parameters_from_json(const std::string& filename);
-    void run();
+    void run(const std::string& filename = "ampcor.json");
 
 };
 
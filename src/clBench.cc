@@ -0,0 +1,300 @@
+// end-to-end benchmark on a synthetic SLC pair
+//
+// usage: clBench [bench.json]
+//
+// A deterministic pair of SLC images is generated: complex speckle (white gaussian noise
+//  smoothed by a gaussian kernel, evaluated exactly at any sub-pixel position), and the
+//  secondary image sampled at positions shifted by a known, spatially varying offset field.
+// The full pipeline is run over a matrix of window sizes, search ranges, oversampling factors
+//  and batch sizes, and a JSON report gives the windows/second, the GB/s read from the images
+//  and the RMS error of the offsets versus the ground truth, for each configuration.
+// The images depend only on the seed and the size (a 64-bit Mersenne twister with a Box-Muller
+//  transform, no implementation-defined distributions), and are reused if already generated.
+//
+// bench.json (all optional):
+// {
+//   "directory": "bench",            work directory of the images, configs and outputs
+//   "width": 2048, "height": 2048,   image size
+//   "seed": 1,
+//   "device": "gpu",                 gpu, cpu (e.g., PoCL) or all
+//   "skip": 64,                      skip between windows
+//   "report": "bench_report.json",
+//   "matrix": {
+//     "window": [32, 64, 128],
+//     "half_search_range": [8, 16],
+//     "oversampling_factor": [16, 32],
+//     "batch": [8, 32]
+//   }
+// }
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <cstdlib>
+
+#include <sys/stat.h>
+
+#include "clHelper.h"
+#include "clAmpcor.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+// the speckle: white complex noise on the integer grid, smoothed by a gaussian kernel,
+//  s(x, y) = sum_ij noise(i, j) g(x-i) g(y-j)
+struct Speckle {
+    static constexpr int radius = 4;     // kernel support, in pixels
+    static constexpr double sigma = 0.8; // kernel width, in pixels
+    int width, height, pad;              // the noise covers the image with a margin of pad pixels
+    std::vector<cl_float2> noise;
+
+    Speckle(const int width_, const int height_, const int pad_, const unsigned long long seed);
+    cl_float2 operator()(const double x, const double y) const;
+};
+
+// the offset field (across, down), from the reference to the secondary image
+cl_float2 shiftField(const double x, const double y, const int width, const int height);
+// generates the images, unless they exist with the same size and seed
+void generatePair(const std::string& directory, const int width, const int height,
+    const unsigned long long seed);
+// the (across, down) offset of the reference pixel (x, y), secondary(x + dx, y + dy) = reference(x, y)
+cl_float2 trueOffset(const double x, const double y, const int width, const int height);
+
+int main(int argc, char* argv[]) {
+
+    json bench = json::object();
+    if (argc > 1) {
+        std::ifstream benchFile(argv[1]);
+        if (benchFile.fail()) {
+            std::cerr << "The benchmark config file " << argv[1] << " does not exist. \n";
+            exit(EXIT_FAILURE);
+        }
+        try {
+            bench = json::parse(benchFile);
+        }
+        catch (const json::parse_error& e) {
+            std::cerr << "JSON parse error: " << e.what() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    const std::string directory = bench.value("directory", "bench");
+    const int width = bench.value("width", 2048);
+    const int height = bench.value("height", 2048);
+    const unsigned long long seed = bench.value("seed", 1ULL);
+    const std::string device = bench.value("device", "gpu");
+    const int skip = bench.value("skip", 64);
+    const std::string reportName = bench.value("report", "bench_report.json");
+    const json matrix = bench.value("matrix", json::object());
+    const std::vector<int> windows = matrix.value("window", std::vector<int>{32, 64, 128});
+    const std::vector<int> ranges = matrix.value("half_search_range", std::vector<int>{8, 16});
+    const std::vector<int> factors = matrix.value("oversampling_factor", std::vector<int>{16, 32});
+    const std::vector<int> batches = matrix.value("batch", std::vector<int>{8, 32});
+
+    ::mkdir(directory.c_str(), 0755);
+    generatePair(directory, width, height, seed);
+
+    // the device, for the report
+    clHandle handle(device == "cpu" ? CL_DEVICE_TYPE_CPU
+        : device == "all" ? CL_DEVICE_TYPE_ALL : CL_DEVICE_TYPE_GPU);
+
+    json results = json::array();
+    int run = 0;
+    for (const int window : windows)
+    for (const int range : ranges)
+    for (const int factor : factors)
+    for (const int batch : batches) {
+        // the config of this run
+        json config = {
+            {"reference", {{"slc", directory + "/reference.slc"}, {"width", width}, {"height", height}}},
+            {"secondary", {{"slc", directory + "/secondary.slc"}, {"width", width}, {"height", height}}},
+            {"offset", {{"slc", directory + "/offset.slc"}, {"width", 0}, {"height", 0}}},
+            {"snr", {{"slc", directory + "/snr.slc"}}},
+            {"covariance", {{"slc", directory + "/cov.slc"}}},
+            {"window", {{"width", window}, {"height", window}}},
+            {"half_search_range", {{"across", range}, {"down", range}}},
+            {"skip_between_windows", {{"across", skip}, {"down", skip}}},
+            {"start_pixel_secondary", json::object()},
+            {"end_pixel_secondary", json::object()},
+            {"correlation_surface_zoom_in", {{"oversampling_factor", factor}}},
+            {"batch", {{"across", batch}}},
+            {"device", {{"type", device}}},
+            {"checkpoint", {{"enabled", false}}}
+        };
+        const std::string configName = directory + "/ampcor_" + std::to_string(run++) + ".json";
+        std::ofstream(configName) << config.dump(2) << "\n";
+
+        cl::Ampcor::Ampcor ampcor;
+        const auto start = std::chrono::steady_clock::now();
+        ampcor.run(configName);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // compare the offsets with the ground truth, at the centers of the reference windows
+        std::vector<cl_float2> offsets(ampcor.numberWindows);
+        std::ifstream offsetFile(ampcor.offsetImageName, std::ios::binary);
+        offsetFile.read(reinterpret_cast<char *>(offsets.data()), offsets.size()*sizeof(cl_float2));
+        if (!offsetFile) {
+            std::cerr << "Failed to read the offsets " << ampcor.offsetImageName << "\n";
+            exit(EXIT_FAILURE);
+        }
+        double sum2Across = 0.0, sum2Down = 0.0, maxError = 0.0;
+        int valid = 0;
+        for (int index = 0; index < ampcor.numberWindows; index++) {
+            const cl_float2& offset = offsets[index];
+            if (std::isnan(offset.x) || std::isnan(offset.y))
+                continue;
+            // the center of the search window, the reference window spans [center - w/2, center + w/2)
+            const double x = ampcor.secondaryStartPixelAcross + (index%ampcor.numberWindowAcross)*ampcor.skipSampleAcross - 0.5;
+            const double y = ampcor.secondaryStartPixelDown + (index/ampcor.numberWindowAcross)*ampcor.skipSampleDown - 0.5;
+            const cl_float2 truth = trueOffset(x, y, width, height);
+            const double errorAcross = offset.x - truth.x;
+            const double errorDown = offset.y - truth.y;
+            sum2Across += errorAcross*errorAcross;
+            sum2Down += errorDown*errorDown;
+            maxError = std::max(maxError, std::sqrt(errorAcross*errorAcross + errorDown*errorDown));
+            valid++;
+        }
+        const double rmsAcross = valid ? std::sqrt(sum2Across/valid) : NAN;
+        const double rmsDown = valid ? std::sqrt(sum2Down/valid) : NAN;
+
+        results.push_back({
+            {"window", window},
+            {"half_search_range", range},
+            {"oversampling_factor", factor},
+            {"batch", batch},
+            {"windows", ampcor.numberWindows},
+            {"valid_windows", valid},
+            {"seconds", seconds},
+            {"windows_per_second", ampcor.numberWindows/seconds},
+            {"bytes_read", ampcor.bytesRead},
+            {"read_gbps", ampcor.bytesRead/seconds*1.0e-9},
+            {"rms_error_across", rmsAcross},
+            {"rms_error_down", rmsDown},
+            {"rms_error", std::sqrt(rmsAcross*rmsAcross + rmsDown*rmsDown)},
+            {"max_error", maxError}
+        });
+        std::cout << "window " << window << " half search range " << range
+            << " oversampling " << factor << " batch " << batch << ": "
+            << ampcor.numberWindows/seconds << " windows/s, rms error "
+            << std::sqrt(rmsAcross*rmsAcross + rmsDown*rmsDown) << " pixels \n";
+    }
+
+    const json report = {
+        {"device", handle.device.getInfo<CL_DEVICE_NAME>()},
+        {"vendor", handle.device.getInfo<CL_DEVICE_VENDOR>()},
+        {"driver", handle.device.getInfo<CL_DRIVER_VERSION>()},
+        {"image", {{"width", width}, {"height", height}, {"seed", seed}}},
+        {"skip", skip},
+        {"results", results}
+    };
+    std::ofstream reportFile(reportName);
+    if (!reportFile) {
+        std::cerr << "Failed to open the file for writing." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    reportFile << report.dump(2) << "\n";
+    std::cout << "The benchmark report is saved in " << reportName << "\n";
+    // all done
+    return 0;
+}
+
+Speckle::Speckle(const int width_, const int height_, const int pad_, const unsigned long long seed) :
+    width(width_), height(height_), pad(pad_),
+    noise(static_cast<size_t>(width_+2*pad_)*(height_+2*pad_))
+{
+    // Box-Muller on the raw 64-bit outputs, the same sequence on all platforms
+    std::mt19937_64 generator(seed);
+    const double scale = 1.0/18446744073709551616.0; // 2^-64
+    for (auto& value : noise) {
+        const double u1 = (generator() + 0.5)*scale;
+        const double u2 = (generator() + 0.5)*scale;
+        const double r = std::sqrt(-2.0*std::log(u1));
+        value = make_float2(r*std::cos(2.0*M_PI*u2), r*std::sin(2.0*M_PI*u2));
+    }
+}
+
+cl_float2 Speckle::operator()(const double x, const double y) const
+{
+    const int x0 = static_cast<int>(std::floor(x));
+    const int y0 = static_cast<int>(std::floor(y));
+    double wx[2*radius], wy[2*radius];
+    for (int k = 0; k < 2*radius; k++) {
+        const double dx = x - (x0 - radius + 1 + k);
+        const double dy = y - (y0 - radius + 1 + k);
+        wx[k] = std::exp(-dx*dx/(2.0*sigma*sigma));
+        wy[k] = std::exp(-dy*dy/(2.0*sigma*sigma));
+    }
+    double re = 0.0, im = 0.0;
+    for (int j = 0; j < 2*radius; j++) {
+        const cl_float2* row = noise.data()
+            + static_cast<size_t>(y0 - radius + 1 + j + pad)*(width+2*pad) + (x0 - radius + 1 + pad);
+        double rowRe = 0.0, rowIm = 0.0;
+        for (int i = 0; i < 2*radius; i++) {
+            rowRe += wx[i]*row[i].x;
+            rowIm += wx[i]*row[i].y;
+        }
+        re += wy[j]*rowRe;
+        im += wy[j]*rowIm;
+    }
+    return make_float2(re, im);
+}
+
+cl_float2 shiftField(const double x, const double y, const int width, const int height)
+{
+    // a constant part, with a fraction of a pixel, and a smooth variation over the image
+    return make_float2(
+        1.3 + 0.6*std::sin(2.0*M_PI*x/width)*std::cos(2.0*M_PI*y/height),
+        -0.7 + 0.5*std::sin(2.0*M_PI*(x/width + y/height)));
+}
+
+cl_float2 trueOffset(const double x, const double y, const int width, const int height)
+{
+    // the secondary pixel p = (x, y) + d(p), by fixed-point iterations (d varies slowly)
+    cl_float2 d = shiftField(x, y, width, height);
+    for (int iteration = 0; iteration < 8; iteration++)
+        d = shiftField(x + d.x, y + d.y, width, height);
+    return d;
+}
+
+void generatePair(const std::string& directory, const int width, const int height,
+    const unsigned long long seed)
+{
+    // skip if generated with the same parameters
+    const json key = {{"width", width}, {"height", height}, {"seed", seed}};
+    const std::string keyName = directory + "/synthetic.json";
+    {
+        std::ifstream keyFile(keyName);
+        json existing;
+        if (keyFile && (keyFile >> existing, existing == key)) {
+            std::cout << "Using the synthetic images in " << directory << "\n";
+            return;
+        }
+    }
+
+    std::cout << "Generating a synthetic pair of " << make_int2(width, height) << " in " << directory << "\n";
+    // the margin covers the kernel support and the largest shift
+    const Speckle speckle(width, height, Speckle::radius + 4, seed);
+    std::ofstream referenceFile(directory + "/reference.slc", std::ios::binary);
+    std::ofstream secondaryFile(directory + "/secondary.slc", std::ios::binary);
+    if (!referenceFile || !secondaryFile) {
+        std::cerr << "Failed to open the file for writing." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::vector<cl_float2> referenceLine(width), secondaryLine(width);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            referenceLine[x] = speckle(x, y);
+            // secondary(p) = reference(p - d) with p = reference + d
+            const cl_float2 d = shiftField(x, y, width, height);
+            secondaryLine[x] = speckle(x - d.x, y - d.y);
+        }
+        referenceFile.write(reinterpret_cast<const char *>(referenceLine.data()), width*sizeof(cl_float2));
+        secondaryFile.write(reinterpret_cast<const char *>(secondaryLine.data()), width*sizeof(cl_float2));
+    }
+    std::ofstream(keyName) << key.dump() << "\n";
+}
+
+// end of file
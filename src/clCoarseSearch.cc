@@ -0,0 +1,250 @@
+// -*- C++ -*-
+// -*- coding: utf-8 -*-
+//
+// (c) 2023 california institute of technology
+// all rights reserved
+
+/// @file clCoarseSearch.cc
+/// @brief openCL coarse (decimated) search for a coarse-to-fine (pyramid) offset estimation
+
+// my definition
+#include "clCoarseSearch.h"
+#include "clProfiler.h"
+
+/// constructor, to set all buffers, kernels and their args
+/// @param reference_origins, secondary_origins (col, row) of the windows in the strips,
+///   the secondary windows cover the full search range (half_range_across, half_range_down)
+/// @param window_width, window_height reference window size (full resolution)
+/// @param fine_half_range_across, fine_half_range_down search range of the fine search
+/// @param fine_origins (col, row) of the fine search windows in the secondary strip
+/// @param shifts the coarse offsets of the fine search windows (full resolution)
+cl::Ampcor::CoarseSearch::CoarseSearch(clHandle& handle,
+    cl::Buffer& reference_strip, const int reference_strip_width, const int reference_strip_height,
+    cl::Buffer& reference_origins,
+    cl::Buffer& secondary_strip, const int secondary_strip_width, const int secondary_strip_height,
+    cl::Buffer& secondary_origins,
+    const int window_width, const int window_height,
+    const int half_range_across, const int half_range_down,
+    const int fine_half_range_across, const int fine_half_range_down,
+    const int decimation,
+    cl::Buffer& fine_origins, cl::Buffer& shifts,
+    const int batch)
+{
+    _profiler = handle.profiler;
+    // decimated sizes
+    const int width = window_width/decimation;
+    const int height = window_height/decimation;
+    const int search_width = (window_width + 2*half_range_across)/decimation;
+    const int search_height = (window_height + 2*half_range_down)/decimation;
+    const int regionx = search_width - width + 1;
+    const int regiony = search_height - height + 1;
+    const int p_width = next_power_of_2(search_width);
+    const int p_height = next_power_of_2(search_height);
+
+    _reference = cl::Buffer(handle.context, CL_MEM_READ_WRITE, batch*p_width*p_height*sizeof(complex_type));
+    _secondary = cl::Buffer(handle.context, CL_MEM_READ_WRITE, batch*p_width*p_height*sizeof(complex_type));
+    _reference_sum2 = cl::Buffer(handle.context, CL_MEM_READ_WRITE, batch*sizeof(complex_type));
+    _secondary_sat2 = cl::Buffer(handle.context, CL_MEM_READ_WRITE,
+        batch*search_width*search_height*sizeof(complex_type));
+    _correlation = cl::Buffer(handle.context, CL_MEM_READ_WRITE, batch*p_width*p_height*sizeof(complex_type));
+    _max_loc = cl::Buffer(handle.context, CL_MEM_READ_WRITE, batch*sizeof(cl_int2));
+    _zoom = cl::Buffer(handle.context, CL_MEM_READ_WRITE, batch*sizeof(complex_type));
+    _subpixel = cl::Buffer(handle.context, CL_MEM_READ_WRITE, batch*sizeof(complex_type));
+    _snr = cl::Buffer(handle.context, CL_MEM_READ_WRITE, batch*sizeof(float_type));
+    _cov = cl::Buffer(handle.context, CL_MEM_READ_WRITE, 3*batch*sizeof(float_type));
+
+    size_type maxWorkGroupSize;
+    int argIndex;
+
+    // gather the decimated reference windows, with sum and sum square
+    CL_CHECK_ERROR(_reference_gather = cl::Kernel(handle.program, "window_gather_amplitude_sum2"));
+    CL_CHECK_ERROR(_reference_gather.getWorkGroupInfo(handle.device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
+    maxWorkGroupSize = std::min(maxWorkGroupSize, static_cast<size_type>(256));
+    argIndex = 0;
+    CL_CHECK_ERROR(_reference_gather.setArg(argIndex++, reference_strip));
+    CL_CHECK_ERROR(_reference_gather.setArg(argIndex++, reference_strip_width));
+    CL_CHECK_ERROR(_reference_gather.setArg(argIndex++, reference_strip_height));
+    CL_CHECK_ERROR(_reference_gather.setArg(argIndex++, reference_origins));
+    CL_CHECK_ERROR(_reference_gather.setArg(argIndex++, _reference));
+    CL_CHECK_ERROR(_reference_gather.setArg(argIndex++, _reference_sum2));
+    CL_CHECK_ERROR(_reference_gather.setArg(argIndex++, cl::Local(maxWorkGroupSize*sizeof(complex_type))));
+    CL_CHECK_ERROR(_reference_gather.setArg(argIndex++, width));
+    CL_CHECK_ERROR(_reference_gather.setArg(argIndex++, height));
+    CL_CHECK_ERROR(_reference_gather.setArg(argIndex++, p_width));
+    CL_CHECK_ERROR(_reference_gather.setArg(argIndex++, p_height));
+    CL_CHECK_ERROR(_reference_gather.setArg(argIndex++, decimation));
+    CL_CHECK_ERROR(_reference_gather.setArg(argIndex++, 0)); // amplitudes
+    _reference_gather_global = cl::NDRange(maxWorkGroupSize, batch);
+    _reference_gather_local = cl::NDRange(maxWorkGroupSize, 1);
+
+    // gather the decimated search windows, with the prefix sums along rows of the sum area table
+    CL_CHECK_ERROR(_secondary_gather = cl::Kernel(handle.program, "window_gather_amplitude_sat2"));
+    CL_CHECK_ERROR(_secondary_gather.getWorkGroupInfo(handle.device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
+    // the in-group scan runs over 2*localSize elements, in power of 2
+    maxWorkGroupSize = std::min(std::max(next_power_of_2(search_width)>>1, static_cast<size_type>(1)),
+        prev_power_of_2(maxWorkGroupSize));
+    argIndex = 0;
+    CL_CHECK_ERROR(_secondary_gather.setArg(argIndex++, secondary_strip));
+    CL_CHECK_ERROR(_secondary_gather.setArg(argIndex++, secondary_strip_width));
+    CL_CHECK_ERROR(_secondary_gather.setArg(argIndex++, secondary_strip_height));
+    CL_CHECK_ERROR(_secondary_gather.setArg(argIndex++, secondary_origins));
+    CL_CHECK_ERROR(_secondary_gather.setArg(argIndex++, _secondary));
+    CL_CHECK_ERROR(_secondary_gather.setArg(argIndex++, _secondary_sat2));
+    CL_CHECK_ERROR(_secondary_gather.setArg(argIndex++, cl::Local(2*maxWorkGroupSize*sizeof(complex_type))));
+    CL_CHECK_ERROR(_secondary_gather.setArg(argIndex++, search_width));
+    CL_CHECK_ERROR(_secondary_gather.setArg(argIndex++, search_height));
+    CL_CHECK_ERROR(_secondary_gather.setArg(argIndex++, p_width));
+    CL_CHECK_ERROR(_secondary_gather.setArg(argIndex++, p_height));
+    CL_CHECK_ERROR(_secondary_gather.setArg(argIndex++, decimation));
+    CL_CHECK_ERROR(_secondary_gather.setArg(argIndex++, 0)); // amplitudes
+    _secondary_gather_global = cl::NDRange(maxWorkGroupSize, batch);
+    _secondary_gather_local = cl::NDRange(maxWorkGroupSize, 1);
+
+    // complete the sum area table with the prefix sums along columns
+    CL_CHECK_ERROR(_secondary_sat = cl::Kernel(handle.program, "window_sat2_scan_columns"));
+    CL_CHECK_ERROR(_secondary_sat.getWorkGroupInfo(handle.device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
+    maxWorkGroupSize = std::min(std::max(next_power_of_2(search_height)>>1, static_cast<size_type>(1)),
+        prev_power_of_2(maxWorkGroupSize));
+    argIndex = 0;
+    CL_CHECK_ERROR(_secondary_sat.setArg(argIndex++, _secondary_sat2));
+    CL_CHECK_ERROR(_secondary_sat.setArg(argIndex++, cl::Local(2*maxWorkGroupSize*sizeof(complex_type))));
+    CL_CHECK_ERROR(_secondary_sat.setArg(argIndex++, search_width));
+    CL_CHECK_ERROR(_secondary_sat.setArg(argIndex++, search_height));
+    _secondary_sat_global = cl::NDRange(maxWorkGroupSize, search_width, batch);
+    _secondary_sat_local = cl::NDRange(maxWorkGroupSize, 1, 1);
+
+    // correlator over the full (decimated) search range, with the cheaper method
+    _correlator = Correlator(handle, p_width, p_height, width, height, regionx, regiony,
+        _reference, _secondary, _correlation,
+        Correlator::costModel(p_width, p_height, width, height, regionx, regiony), batch);
+
+    // normalize and find the peak, no sub-pixel estimation
+    CL_CHECK_ERROR(_peak = cl::Kernel(handle.program, "correlation_normalize_peak_zoom"));
+    CL_CHECK_ERROR(_peak.getWorkGroupInfo(handle.device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
+    maxWorkGroupSize = std::min(maxWorkGroupSize, next_power_of_2(regionx*regiony));
+    argIndex = 0;
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, _correlation));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, _reference_sum2));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, _secondary_sat2));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, _max_loc));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, _zoom));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, _subpixel));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, cl::Local(maxWorkGroupSize*sizeof(float_type))));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, cl::Local(maxWorkGroupSize*sizeof(int_type))));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, cl::Local(sizeof(float_type))));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, cl::Local(maxWorkGroupSize*sizeof(complex_type))));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, _snr));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, _cov));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, regionx));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, regiony));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, p_width));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, p_height));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, width));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, height));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, search_width));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, search_height));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, 1)); // zoom window 1x1 at the peak
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, 1));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, 0));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, 0));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, 0)); // no estimator
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, 1));
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, 0)); // amplitudes
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, 0)); // snr/cov are not used
+    CL_CHECK_ERROR(_peak.setArg(argIndex++, 1.0f));
+    _peak_global = cl::NDRange(maxWorkGroupSize, batch);
+    _peak_local = cl::NDRange(maxWorkGroupSize, 1);
+
+    // shift the search windows for the fine search
+    CL_CHECK_ERROR(_shift = cl::Kernel(handle.program, "window_origins_shift"));
+    argIndex = 0;
+    CL_CHECK_ERROR(_shift.setArg(argIndex++, secondary_origins));
+    CL_CHECK_ERROR(_shift.setArg(argIndex++, _max_loc));
+    CL_CHECK_ERROR(_shift.setArg(argIndex++, fine_origins));
+    CL_CHECK_ERROR(_shift.setArg(argIndex++, shifts));
+    CL_CHECK_ERROR(_shift.setArg(argIndex++, decimation));
+    CL_CHECK_ERROR(_shift.setArg(argIndex++, make_int2(half_range_across, half_range_down)));
+    CL_CHECK_ERROR(_shift.setArg(argIndex++, make_int2(half_range_across-fine_half_range_across,
+        half_range_down-fine_half_range_down)));
+    _shift_global = cl::NDRange(batch);
+    // all done
+}
+
+void cl::Ampcor::CoarseSearch::execute(cl::CommandQueue& queue,
+    const std::vector<cl::Event>* /*waitlist*/,
+    cl::Event* /*marker*/)
+{
+    CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+        _reference_gather,
+        cl::NullRange,
+        _reference_gather_global,
+        _reference_gather_local,
+        nullptr, profile(_profiler, "coarse_gather_reference")
+        ));
+    CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+        _secondary_gather,
+        cl::NullRange,
+        _secondary_gather_global,
+        _secondary_gather_local,
+        nullptr, profile(_profiler, "coarse_gather_secondary")
+        ));
+    CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+        _secondary_sat,
+        cl::NullRange,
+        _secondary_sat_global,
+        _secondary_sat_local,
+        nullptr, profile(_profiler, "coarse_sat_secondary")
+        ));
+    _correlator.execute(queue);
+    search(queue);
+    // all done
+}
+
+void cl::Ampcor::CoarseSearch::executeSecondary(cl::CommandQueue& queue)
+{
+    // the reference windows (or their spectra) are kept
+    CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+        _secondary_gather,
+        cl::NullRange,
+        _secondary_gather_global,
+        _secondary_gather_local,
+        nullptr, profile(_profiler, "coarse_gather_secondary")
+        ));
+    CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+        _secondary_sat,
+        cl::NullRange,
+        _secondary_sat_global,
+        _secondary_sat_local,
+        nullptr, profile(_profiler, "coarse_sat_secondary")
+        ));
+    _correlator.executeSecondary(queue);
+    search(queue);
+    // all done
+}
+
+void cl::Ampcor::CoarseSearch::setSecondaryStrip(cl::Buffer& secondary_strip)
+{
+    CL_CHECK_ERROR(_secondary_gather.setArg(0, secondary_strip));
+}
+
+// find the peaks and shift the search windows
+void cl::Ampcor::CoarseSearch::search(cl::CommandQueue& queue)
+{
+    CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+        _peak,
+        cl::NullRange,
+        _peak_global,
+        _peak_local,
+        nullptr, profile(_profiler, "coarse_peak")
+        ));
+    CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+        _shift,
+        cl::NullRange,
+        _shift_global,
+        cl::NullRange,
+        nullptr, profile(_profiler, "coarse_shift")
+        ));
+    // all done
+}
+
+// end of file
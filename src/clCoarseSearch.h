@@ -0,0 +1,92 @@
+// -*- C++ -*-
+// -*- coding: utf-8 -*-
+//
+// (c) 2023 california institute of technology
+// all rights reserved
+
+/// @file clCoarseSearch.h
+/// @brief openCL coarse (decimated) search for a coarse-to-fine (pyramid) offset estimation
+///
+/// The steps are 1) gather the reference and search windows from the image strips,
+///    decimated by averaging the amplitudes of decimation x decimation pixels;
+/// 2) correlate the decimated windows over the full search range and find the peak;
+/// 3) shift the origins of the search windows by the coarse offsets,
+///    so that the full-resolution search covers only a small range around the coarse estimate
+
+// guard
+#pragma once
+// dependencies
+#include "clHelper.h"
+#include "clCorrelator.h"
+
+namespace cl { namespace Ampcor {
+
+class CoarseSearch {
+
+public:
+    using size_type = cl::size_type;
+    using complex_type = cl_float2;
+    using float_type = cl_float;
+    using int_type = cl_int;
+    using kernel_type = cl::Kernel;
+
+    // methods
+    CoarseSearch(clHandle& handle,
+        cl::Buffer& reference_strip, const int reference_strip_width, const int reference_strip_height,
+        cl::Buffer& reference_origins,
+        cl::Buffer& secondary_strip, const int secondary_strip_width, const int secondary_strip_height,
+        cl::Buffer& secondary_origins,
+        const int window_width, const int window_height,
+        const int half_range_across, const int half_range_down,
+        const int fine_half_range_across, const int fine_half_range_down,
+        const int decimation,
+        cl::Buffer& fine_origins, cl::Buffer& shifts,
+        const int batch=1);
+    ~CoarseSearch() = default;
+    void execute(cl::CommandQueue& queue,
+        const std::vector<cl::Event>* waitlist = nullptr,
+        cl::Event* marker=nullptr);
+    // search new secondary windows against the reference windows of the last execute()
+    void executeSecondary(cl::CommandQueue& queue);
+    // search in another secondary strip (of the same size), e.g., in a stack
+    void setSecondaryStrip(cl::Buffer& secondary_strip);
+
+private:
+    void search(cl::CommandQueue& queue);
+
+    // decimated windows and their statistics
+    cl::Buffer _reference;
+    cl::Buffer _secondary;
+    cl::Buffer _reference_sum2;
+    cl::Buffer _secondary_sat2;
+    // coarse correlation surface, its peak and (unused) zoom window and sub-pixel offset
+    cl::Buffer _correlation;
+    cl::Buffer _max_loc;
+    cl::Buffer _zoom;
+    cl::Buffer _subpixel;
+    cl::Buffer _snr;
+    cl::Buffer _cov;
+
+    kernel_type _reference_gather;
+    kernel_type _secondary_gather;
+    kernel_type _secondary_sat;
+    Correlator _correlator;
+    kernel_type _peak;
+    kernel_type _shift;
+
+    cl::NDRange _reference_gather_global;
+    cl::NDRange _reference_gather_local;
+    cl::NDRange _secondary_gather_global;
+    cl::NDRange _secondary_gather_local;
+    cl::NDRange _secondary_sat_global;
+    cl::NDRange _secondary_sat_local;
+    cl::NDRange _peak_global;
+    cl::NDRange _peak_local;
+    cl::NDRange _shift_global;
+    // timing
+    Profiler* _profiler = nullptr;
+};
+
+}} // end of namespace
+
+// end of file
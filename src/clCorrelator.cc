@@ -7,26 +7,47 @@
 /// File: clCorrelator.h
 /// Desc: openCL Cross-Correlation processor, using FFT method
 ///  C(x, y) = \sum_{X,Y} R(X, Y) S(X+x, Y+y) = IFFT[(FFT[R])^* dotprod FFT[S]]
+///  or, for small search ranges, computing the sum directly in the spatial domain
 
 // my definition
 #include "clCorrelator.h"
+#include "clProfiler.h"
+
+#include <cmath>
+#include <chrono>
 
 // constructor, to set all kernels and their args
 cl::Ampcor::Correlator::Correlator(clHandle& handle,
     const int width, const int height,
-    cl::Buffer& reference, cl::Buffer& secondary, cl::Buffer& correlation)
+    cl::Buffer& reference, cl::Buffer& secondary, cl::Buffer& correlation,
+    const int batch)
+{
+    setKernelArgs(handle, width, height, reference, secondary, correlation, batch);
+}
+
+// constructor, with both FFT and direct methods available
+cl::Ampcor::Correlator::Correlator(clHandle& handle,
+    const int width, const int height,
+    const int window_width, const int window_height,
+    const int region_width, const int region_height,
+    cl::Buffer& reference, cl::Buffer& secondary, cl::Buffer& correlation,
+    clCorrelatorMethod method, const int batch) : _method(method)
 {
-    setKernelArgs(handle, width, height, reference, secondary, correlation);
+    setKernelArgs(handle, width, height, reference, secondary, correlation, batch);
+    setDirectKernelArgs(handle, width, height, window_width, window_height,
+        region_width, region_height, reference, secondary, correlation, batch);
 }
 
 void cl::Ampcor::Correlator::setKernelArgs(clHandle& handle,
     const int width, const int height,
-    cl::Buffer& reference, cl::Buffer& secondary, cl::Buffer& correlation)
+    cl::Buffer& reference, cl::Buffer& secondary, cl::Buffer& correlation,
+    const int batch)
 
 {
-   _reference_fft = fft_plan_type(handle, width, height, reference, CL_FFT_FORWARD);
-   _secondary_fft = fft_plan_type(handle, width, height, secondary, CL_FFT_FORWARD);
-   _correlation_fft = fft_plan_type(handle, width, height, correlation, CL_FFT_INVERSE);
+   _profiler = handle.profiler;
+   _reference_fft = fft_plan_type(handle, width, height, reference, CL_FFT_FORWARD, batch);
+   _secondary_fft = fft_plan_type(handle, width, height, secondary, CL_FFT_FORWARD, batch);
+   _correlation_fft = fft_plan_type(handle, width, height, correlation, CL_FFT_INVERSE, batch);
 
    CL_CHECK_ERROR(_matrix_mul_conj = cl::Kernel(handle.program, "matrix_element_multiply_conj"));
     // Set kernel arguments
@@ -37,26 +58,149 @@ void cl::Ampcor::Correlator::setKernelArgs(clHandle& handle,
     CL_CHECK_ERROR(_matrix_mul_conj.setArg(argIndex++, width));
     CL_CHECK_ERROR(_matrix_mul_conj.setArg(argIndex++, height));
 
-    _matrix_mul_conj_global = cl::NDRange(width, height);
+    // element-wise, a batch is processed as more rows
+    _matrix_mul_conj_global = cl::NDRange(width, height*batch);
+    // all done
+}
+
+void cl::Ampcor::Correlator::setDirectKernelArgs(clHandle& handle,
+    const int width, const int height,
+    const int window_width, const int window_height,
+    const int region_width, const int region_height,
+    cl::Buffer& reference, cl::Buffer& secondary, cl::Buffer& correlation,
+    const int batch)
+{
+    CL_CHECK_ERROR(_correlation_direct = cl::Kernel(handle.program, "correlation_direct"));
+
+    // work group of (up to) 8x8 lags
+    size_type maxWorkGroupSize;
+    CL_CHECK_ERROR(_correlation_direct.getWorkGroupInfo(handle.device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
+    size_type localx = std::min(next_power_of_2(region_width), static_cast<size_type>(8));
+    size_type localy = std::min(next_power_of_2(region_height), std::max(maxWorkGroupSize/localx, static_cast<size_type>(1)));
+    localy = std::min(localy, static_cast<size_type>(8));
+
+    // template rows staged in local memory, limit the tile to 8KB
+    int tile_height = std::max(1, std::min(window_height, 2048/window_width));
+
+    int argIndex = 0;
+    CL_CHECK_ERROR(_correlation_direct.setArg(argIndex++, reference));
+    CL_CHECK_ERROR(_correlation_direct.setArg(argIndex++, secondary));
+    CL_CHECK_ERROR(_correlation_direct.setArg(argIndex++, correlation));
+    CL_CHECK_ERROR(_correlation_direct.setArg(argIndex++, cl::Local(tile_height*window_width*sizeof(float_type))));
+    CL_CHECK_ERROR(_correlation_direct.setArg(argIndex++, window_width));
+    CL_CHECK_ERROR(_correlation_direct.setArg(argIndex++, window_height));
+    CL_CHECK_ERROR(_correlation_direct.setArg(argIndex++, region_width));
+    CL_CHECK_ERROR(_correlation_direct.setArg(argIndex++, region_height));
+    CL_CHECK_ERROR(_correlation_direct.setArg(argIndex++, width)); // stride
+    CL_CHECK_ERROR(_correlation_direct.setArg(argIndex++, width*height)); // batch stride
+    CL_CHECK_ERROR(_correlation_direct.setArg(argIndex++, tile_height));
+    // the inverse fft is not normalized, scale the direct sum to match
+    CL_CHECK_ERROR(_correlation_direct.setArg(argIndex++, static_cast<float_type>(width*height)));
+
+    _correlation_direct_local = cl::NDRange(localx, localy, 1);
+    _correlation_direct_global = cl::NDRange(
+        (region_width+localx-1)/localx*localx,
+        (region_height+localy-1)/localy*localy,
+        batch);
     // all done
 }
 
 void cl::Ampcor::Correlator::execute(cl::CommandQueue& queue,
-    const std::vector<cl::Event>* waitlist,
-    cl::Event* marker)
+    const std::vector<cl::Event>* /*waitlist*/,
+    cl::Event* /*marker*/)
+{
+    // fft reference and secondary to freq space
+    forwardReference(queue);
+    forwardSecondary(queue);
+    // correlate
+    correlate(queue);
+    // all done
+}
+
+void cl::Ampcor::Correlator::executeSecondary(cl::CommandQueue& queue)
 {
-    // fft reference to freq space
+    // the reference is already in freq space (transformed in place)
+    forwardSecondary(queue);
+    correlate(queue);
+    // all done
+}
+
+void cl::Ampcor::Correlator::forwardReference(cl::CommandQueue& queue)
+{
+    // the direct method works on the windows in real space
+    if (_method == CL_CORRELATOR_DIRECT) return;
     _reference_fft.execute(queue);
-    // fft secondary to freq space
+}
+
+void cl::Ampcor::Correlator::forwardSecondary(cl::CommandQueue& queue)
+{
+    if (_method == CL_CORRELATOR_DIRECT) return;
     _secondary_fft.execute(queue);
+}
+
+void cl::Ampcor::Correlator::correlate(cl::CommandQueue& queue)
+{
+    if (_method == CL_CORRELATOR_DIRECT) {
+        // correlate in the spatial domain
+        CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+            _correlation_direct,
+            cl::NullRange,
+            _correlation_direct_global,
+            _correlation_direct_local,
+            nullptr, profile(_profiler, "correlation_direct")
+            ));
+        return;
+    }
     // conjugate multiply to get correlation
     CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
         _matrix_mul_conj,
         cl::NullRange,
-        _matrix_mul_conj_global
+        _matrix_mul_conj_global,
+        cl::NullRange,
+        nullptr, profile(_profiler, "correlation_multiply_conj")
         ));
     // fft correlation surface back to real space
     _correlation_fft.execute(queue);
     // all done
 }
 
+/// Estimate the cheaper method by counting the floating point operations
+/// FFT: three 2d FFTs (5 N log2 N each) and one element-wise multiplication
+/// Direct: one multiply-add per template pixel per lag
+clCorrelatorMethod cl::Ampcor::Correlator::costModel(
+    const int width, const int height,
+    const int window_width, const int window_height,
+    const int region_width, const int region_height)
+{
+    const double n = static_cast<double>(width)*height;
+    const double fftCost = 3.0*5.0*n*std::log2(n) + 6.0*n;
+    const double directCost = 2.0*window_width*window_height
+        *static_cast<double>(region_width)*region_height;
+    return (directCost < fftCost) ? CL_CORRELATOR_DIRECT : CL_CORRELATOR_FFT;
+}
+
+/// Time both methods with the current buffers and select the faster one
+/// @note the buffers are overwritten
+clCorrelatorMethod cl::Ampcor::Correlator::benchmark(cl::CommandQueue& queue,
+    const int iterations)
+{
+    const clCorrelatorMethod methods[2] = {CL_CORRELATOR_FFT, CL_CORRELATOR_DIRECT};
+    double elapsed[2];
+
+    for (int m=0; m<2; m++) {
+        setMethod(methods[m]);
+        // warm up
+        execute(queue);
+        CL_CHECK_ERROR(queue.finish());
+        auto start = std::chrono::steady_clock::now();
+        for (int i=0; i<iterations; i++)
+            execute(queue);
+        CL_CHECK_ERROR(queue.finish());
+        auto end = std::chrono::steady_clock::now();
+        elapsed[m] = std::chrono::duration<double>(end-start).count();
+    }
+
+    setMethod(elapsed[1] < elapsed[0] ? CL_CORRELATOR_DIRECT : CL_CORRELATOR_FFT);
+    return _method;
+}
+
@@ -7,6 +7,7 @@
 /// File: clCorrelator.h
 /// Desc: openCL Cross-Correlation processor, using FFT method
 ///  C(x, y) = \sum_{X,Y} R(X, Y) S(X+x, Y+y) = IFFT[(FFT[R])^* dotprod FFT[S]]
+///  or, for small search ranges, computing the sum directly in the spatial domain
 
 // guard
 #pragma once
@@ -15,6 +16,11 @@
 #include "clHelper.h"
 #include "clFFT2d.h"
 
+enum clCorrelatorMethod {
+    CL_CORRELATOR_FFT = 0,
+    CL_CORRELATOR_DIRECT = 1
+};
+
 namespace cl { namespace Ampcor {
 
 class Correlator {
@@ -33,18 +39,57 @@ public:
         const int width, const int height,
         cl::Buffer& reference,
         cl::Buffer& secondary,
-        cl::Buffer& correlation);
+        cl::Buffer& correlation,
+        const int batch=1);
+    Correlator(clHandle& handle,
+        const int width, const int height,
+        const int window_width, const int window_height,
+        const int region_width, const int region_height,
+        cl::Buffer& reference,
+        cl::Buffer& secondary,
+        cl::Buffer& correlation,
+        clCorrelatorMethod method,
+        const int batch=1);
     ~Correlator() = default;
     void setKernelArgs(clHandle& handle,
         const int width, const int height,
         cl::Buffer& reference,
         cl::Buffer& secondary,
-        cl::Buffer& correlation);
+        cl::Buffer& correlation,
+        const int batch);
+    void setDirectKernelArgs(clHandle& handle,
+        const int width, const int height,
+        const int window_width, const int window_height,
+        const int region_width, const int region_height,
+        cl::Buffer& reference,
+        cl::Buffer& secondary,
+        cl::Buffer& correlation,
+        const int batch);
     void execute(cl::CommandQueue& queue,
         const std::vector<cl::Event>* waitlist = nullptr,
         cl::Event* marker=nullptr);
+    // correlate new secondary windows against the reference windows of the last execute(),
+    //  the reference spectra (fft method) are kept in the reference buffer
+    void executeSecondary(cl::CommandQueue& queue);
+    // the stages of execute(), so that cached window spectra may replace the forward ffts
+    void forwardReference(cl::CommandQueue& queue);
+    void forwardSecondary(cl::CommandQueue& queue);
+    void correlate(cl::CommandQueue& queue);
+
+    // select the method
+    void setMethod(clCorrelatorMethod method) { _method = method; }
+    clCorrelatorMethod method() const { return _method; }
+    // estimate the cheaper method from the operation counts
+    static clCorrelatorMethod costModel(
+        const int width, const int height,
+        const int window_width, const int window_height,
+        const int region_width, const int region_height);
+    // time both methods on the device and keep the faster one
+    clCorrelatorMethod benchmark(cl::CommandQueue& queue, const int iterations=10);
 
 private:
+    clCorrelatorMethod _method = CL_CORRELATOR_FFT;
+
     fft_plan_type _reference_fft;
     fft_plan_type _secondary_fft;
     fft_plan_type _correlation_fft;
@@ -52,6 +97,11 @@ private:
 
     cl::NDRange _matrix_mul_conj_global;
 
+    kernel_type _correlation_direct;
+    cl::NDRange _correlation_direct_global;
+    cl::NDRange _correlation_direct_local;
+    // timing
+    Profiler* _profiler = nullptr;
 };
 
 }} // end of namespace
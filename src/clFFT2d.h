@@ -31,12 +31,14 @@ public:
     FFT2DPlan(clHandle& handle,
         const int width, const int height,
         cl::Buffer& buffer,
-        clFFTDirection direction=CL_FFT_FORWARD);
+        clFFTDirection direction=CL_FFT_FORWARD,
+        const int batch=1);
     ~FFT2DPlan() = default;
     void setKernelArgs(clHandle& handle,
         const int width, const int height,
         cl::Buffer& buffer,
-        clFFTDirection direction);
+        clFFTDirection direction,
+        const int batch=1);
     void execute(cl::CommandQueue& queue,
         const std::vector<cl::Event>* waitlist = nullptr,
         cl::Event* marker=nullptr);
@@ -50,6 +52,10 @@ private:
     cl::NDRange _fft2d_row_local;
     cl::NDRange _fft2d_col_global;
     cl::NDRange _fft2d_col_local;
+    // timing
+    cl::Ampcor::Profiler* _profiler = nullptr;
+    std::string _stage_row;
+    std::string _stage_col;
 
 };
 
@@ -0,0 +1,119 @@
+// -*- C++ -*-
+// -*- coding: utf-8 -*-
+//
+// (c) 2023 california institute of technology
+// all rights reserved
+
+/// @file clFFTCodelet.cc
+/// @brief generator of straight-line openCL FFT codelets for small power-of-2 lengths
+
+// my definition
+#include "clFFTCodelet.h"
+
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+
+namespace {
+    int log2_int(int n)
+    {
+        int bits = 0;
+        while (n >>= 1)
+            bits++;
+        return bits;
+    }
+
+    int bit_reverse(int num, const int bits)
+    {
+        int reversed = 0;
+        for (int i = 0; i < bits; i++) {
+            reversed = (reversed << 1) | (num & 1);
+            num >>= 1;
+        }
+        return reversed;
+    }
+}
+
+bool cl::FFT::hasCodelet(const int length)
+{
+    return length >= CODELET_MIN_LENGTH && length <= CODELET_MAX_LENGTH && is_power_of_2(length);
+}
+
+std::string cl::FFT::codeletName(const int length, const clFFTDirection direction)
+{
+    return "fft_codelet_" + std::to_string(length)
+        + (direction == CL_FFT_FORWARD ? "_forward" : "_inverse");
+}
+
+/// The codelet follows the FFT2D kernel conventions: in place, un-normalized,
+///   the forward transform with exp(-i 2 pi jk/N), along rows (stride = 1)
+///   or along columns (stride = width) of a batch of matrices stored contiguously
+/// this kernel is called with globalSize = {lines}, lines = height*batch (rows) or width*batch (columns)
+std::string cl::FFT::codeletSource(const int length, const clFFTDirection direction)
+{
+    const int bits = log2_int(length);
+    const double sign = (direction == CL_FFT_FORWARD) ? -1.0 : 1.0;
+    std::ostringstream code;
+    code << std::setprecision(9);
+
+    code << "\n    __kernel void " << codeletName(length, direction) << "(\n"
+         << "        const int stride, // 1 along row, width along column\n"
+         << "        const int lines, // number of rows or columns in the batch\n"
+         << "        __global float2* matrix)\n"
+         << "    {\n"
+         << "        const int line = get_global_id(0);\n"
+         << "        if (line >= lines) return;\n"
+         << "        matrix += mad24(line / stride, stride*" << length << ", line % stride);\n";
+
+    // load in bit-reversed order
+    for (int i = 0; i < length; i++)
+        code << "        float2 v" << i << " = matrix[" << bit_reverse(i, bits) << "*stride];\n";
+
+    // radix-2 stages, butterflies of size m
+    for (int m = 2; m <= length; m <<= 1) {
+        const int half = m >> 1;
+        code << "        // stage " << log2_int(m) << "\n";
+        for (int j = 0; j < half; j++) {
+            const double angle = sign*2.0*M_PI*j/m;
+            const double wr = std::cos(angle);
+            const double wi = std::sin(angle);
+            for (int k = 0; k < length; k += m) {
+                const int a = k + j;
+                const int b = a + half;
+                code << "        { ";
+                // t = v_b * w
+                if (j == 0)
+                    code << "const float2 t = v" << b << "; ";
+                else if (2*j == half)
+                    // w = -i (forward) or i (inverse)
+                    code << "const float2 t = (float2)("
+                         << (sign < 0 ? "" : "-") << "v" << b << ".y, "
+                         << (sign < 0 ? "-" : "") << "v" << b << ".x); ";
+                else
+                    code << "const float2 t = (float2)("
+                         << "v" << b << ".x*" << std::showpoint << wr << "f - v" << b << ".y*(" << wi << "f), "
+                         << "v" << b << ".x*(" << wi << "f) + v" << b << ".y*" << wr << "f); "
+                         << std::noshowpoint;
+                code << "v" << b << " = v" << a << " - t; v" << a << " += t; }\n";
+            }
+        }
+    }
+
+    // store in natural order
+    for (int i = 0; i < length; i++)
+        code << "        matrix[" << i << "*stride] = v" << i << ";\n";
+    code << "    }\n";
+    return code.str();
+}
+
+std::string cl::FFT::codeletsSource()
+{
+    std::string code;
+    for (int length = CODELET_MIN_LENGTH; length <= CODELET_MAX_LENGTH; length <<= 1) {
+        code += codeletSource(length, CL_FFT_FORWARD);
+        code += codeletSource(length, CL_FFT_INVERSE);
+    }
+    return code;
+}
+
+// end of file
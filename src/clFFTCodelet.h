@@ -0,0 +1,39 @@
+// -*- C++ -*-
+// -*- coding: utf-8 -*-
+//
+// (c) 2023 california institute of technology
+// all rights reserved
+
+/// @file clFFTCodelet.h
+/// @brief generator of straight-line openCL FFT codelets for small power-of-2 lengths
+///
+/// A codelet transforms one row (or column) per work-item, fully unrolled:
+///   the input is loaded in bit-reversed order into registers (v0, v1, ...),
+///   followed by the radix-2 butterflies of all stages, with the twiddle factors as literals
+///   (the trivial ones, 1 and -i, are folded), and stored in natural order.
+/// There are no loops, local memory or barriers; the codelets suit short transforms,
+///   longer ones (more registers than a work-item has) use the FFT2D kernel
+
+// guard
+#pragma once
+
+#include "clHelper.h"
+#include "clFFT2d.h"
+
+namespace cl { namespace FFT {
+
+// the lengths with codelets, powers of 2
+const int CODELET_MIN_LENGTH = 2;
+const int CODELET_MAX_LENGTH = 64;
+
+// whether a codelet exists for the length
+bool hasCodelet(const int length);
+// the kernel name of a codelet, e.g., fft_codelet_16_forward
+std::string codeletName(const int length, const clFFTDirection direction);
+// the openCL source of a codelet
+std::string codeletSource(const int length, const clFFTDirection direction);
+// the openCL source of all codelets, for both directions
+std::string codeletsSource();
+
+} } // end of namespace cl::FFT
+// end of file
@@ -1,6 +1,13 @@
 
 #include "clHelper.h"
 
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/stat.h>
+
 std::ostream& operator<<(std::ostream& os, const cl_int2& vec) {
     os << "(" << vec.x << ", " << vec.y << ")";
     return os;
@@ -19,6 +26,14 @@ cl_int2 make_int2(const int&a, const int& b)
     return c;
 }
 
+cl_float2 make_float2(const float&a, const float& b)
+{
+    cl_float2 c;
+    c.x = a;
+    c.y = b;
+    return c;
+}
+
 template <typename T>
 void buffer_debug(cl::CommandQueue& queue, cl::Buffer& buffer,
     const int width, const int height, std::string str)
@@ -94,18 +109,43 @@ bool is_power_of_2(const ::size_t n)
 cl::size_type next_power_of_2(const int n)
 {
     cl::size_type r = 1;
-    while (r<n)
+    while (r<static_cast<cl::size_type>(n))
         r<<=1;
     return r;
 }
 
-cl::Program buildCLProgramFromString(cl::Context& context, std::string& source)
+// the largest power of 2 not above n (1 for n=0)
+cl::size_type prev_power_of_2(const cl::size_type n)
+{
+    cl::size_type r = 1;
+    while ((r<<1)<=n)
+        r<<=1;
+    return r;
+}
+
+cl_ulong hash_fnv1a(const void* data, const ::size_t size, cl_ulong seed)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (::size_t i=0; i<size; i++) {
+        seed ^= bytes[i];
+        seed *= 0x100000001b3ULL;
+    }
+    return seed;
+}
+
+cl_ulong hash_fnv1a(const std::string& data, cl_ulong seed)
+{
+    return hash_fnv1a(data.data(), data.size(), seed);
+}
+
+cl::Program buildCLProgramFromString(cl::Context& context, std::string& source,
+    const std::string& options)
 {
     // initiate the program
     cl::Program program(context, source);
     // build cl kernels and check errors (at runtime)
     try {
-        program.build(CL_AMPCOR_BUILD_OPTIONS);
+        program.build(options.c_str());
     } catch (const cl::Error& e) {
         if (e.err() == CL_BUILD_PROGRAM_FAILURE) {
             // Print the build log if there was an error
@@ -119,6 +159,77 @@ cl::Program buildCLProgramFromString(cl::Context& context, std::string& source)
     return program;
 }
 
+/// The cache file <hash>.bin holds, for each device of the context, the size and the binary.
+/// A binary rejected by the driver (e.g., after an update not reflected in the version)
+///   falls back to the source build, which then replaces the cached binaries
+cl::Program buildCLProgramWithCache(cl::Context& context, std::string& source,
+    const std::string& options, const std::string& cache_directory)
+{
+    if (cache_directory.empty())
+        return buildCLProgramFromString(context, source, options);
+
+    // the key: source, options, and the devices with their drivers
+    std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+    cl_ulong key = hash_fnv1a(source);
+    key = hash_fnv1a(options, key);
+    for (const auto& device : devices) {
+        key = hash_fnv1a(device.getInfo<CL_DEVICE_NAME>(), key);
+        key = hash_fnv1a(device.getInfo<CL_DEVICE_VERSION>(), key);
+        key = hash_fnv1a(device.getInfo<CL_DRIVER_VERSION>(), key);
+    }
+    std::ostringstream filename;
+    filename << cache_directory << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+
+    // load the cached binaries
+    cl::Program::Binaries binaries;
+    std::ifstream cacheFile(filename.str(), std::ios::binary);
+    for (size_t i=0; cacheFile && i<devices.size(); i++) {
+        cl_ulong size = 0;
+        cacheFile.read(reinterpret_cast<char *>(&size), sizeof(size));
+        if (!cacheFile || size == 0)
+            break;
+        std::vector<unsigned char> binary(size);
+        cacheFile.read(reinterpret_cast<char *>(binary.data()), size);
+        if (cacheFile)
+            binaries.push_back(std::move(binary));
+    }
+    if (binaries.size() == devices.size()) {
+        try {
+            std::vector<cl_int> status;
+            cl::Program program(context, devices, binaries, &status);
+            program.build(options.c_str());
+            return program;
+        } catch (const cl::Error& e) {
+            std::cerr << "The cached program binary " << filename.str()
+                << " is invalid (" << getCLErrorString(e.err()) << "), rebuilding from source \n";
+        }
+    }
+
+    // build from source and save the binaries
+    cl::Program program = buildCLProgramFromString(context, source, options);
+    binaries = program.getInfo<CL_PROGRAM_BINARIES>();
+    // create the directory and its parents
+    for (size_t pos = cache_directory.find('/', 1); ; pos = cache_directory.find('/', pos+1)) {
+        ::mkdir(cache_directory.substr(0, pos).c_str(), 0755);
+        if (pos == std::string::npos)
+            break;
+    }
+    // write to a temporary file and rename, for jobs started at the same time
+    const std::string tmpname = filename.str() + "." + std::to_string(::getpid());
+    std::ofstream outFile(tmpname, std::ios::binary);
+    for (const auto& binary : binaries) {
+        const cl_ulong size = binary.size();
+        outFile.write(reinterpret_cast<const char *>(&size), sizeof(size));
+        outFile.write(reinterpret_cast<const char *>(binary.data()), size);
+    }
+    outFile.close();
+    if (!outFile || std::rename(tmpname.c_str(), filename.str().c_str()) != 0) {
+        std::cerr << "Failed to save the program binary to " << filename.str() << "\n";
+        std::remove(tmpname.c_str());
+    }
+    return program;
+}
+
 clHandle::clHandle() {
     initialize();
 }
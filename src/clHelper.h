@@ -59,6 +59,7 @@ char *getCLErrorString(cl_int err);
 std::ostream& operator<<(std::ostream& os, const cl_int2& vec);
 std::ostream& operator<<(std::ostream& os, const cl_float2& vec);
 cl_int2 make_int2(const int&a, const int& b);
+cl_float2 make_float2(const float&a, const float& b);
 
 // debugging buffers
 template <typename T>
@@ -71,10 +72,23 @@ void buffer_print(cl::CommandQueue& queue, cl::Buffer& buffer,
 // power of 2
 bool is_power_of_2(const ::size_t n);
 cl::size_type next_power_of_2(const int n);
+cl::size_type prev_power_of_2(const cl::size_type n);
+
+// 64-bit FNV-1a hash, for cache keys (chained through seed)
+cl_ulong hash_fnv1a(const void* data, const ::size_t size, cl_ulong seed=0xcbf29ce484222325ULL);
+cl_ulong hash_fnv1a(const std::string& data, cl_ulong seed=0xcbf29ce484222325ULL);
 
 // program build tool
-cl::Program buildCLProgramFromString(cl::Context& context, std::string& code);
+cl::Program buildCLProgramFromString(cl::Context& context, std::string& code,
+    const std::string& options=CL_AMPCOR_BUILD_OPTIONS);
 cl::Program buildCLProgramFromFile(cl::Context& contex, std::string& cl_file);
+// build with a cache of the program binaries in cache_directory (empty = no cache),
+//  keyed by the source, options, devices and drivers
+cl::Program buildCLProgramWithCache(cl::Context& context, std::string& code,
+    const std::string& options, const std::string& cache_directory);
+
+// timing of the commands (optional)
+namespace cl { namespace Ampcor { class Profiler; } }
 
 // define a structure to hold cl handles
 struct clHandle {
@@ -84,6 +98,7 @@ struct clHandle {
     cl::Context context;
     cl::Device device; // active device
     cl::Program program; //
+    cl::Ampcor::Profiler* profiler = nullptr; // used by the processors created with the handle
     // methods
     clHandle(); // constructor
     clHandle(cl_device_type deviceType_); // constructor
@@ -0,0 +1,96 @@
+// -*- C++ -*-
+// -*- coding: utf-8 -*-
+//
+// (c) 2023 california institute of technology
+// all rights reserved
+
+/// @file clOffsetWriter.cc
+/// @brief streaming writer of the offset, snr and covariance images
+
+// my definition
+#include "clOffsetWriter.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/// constructor, to create (or reopen) the output files
+/// @param offsetName, snrName, covName the output filenames
+/// @param windows the number of windows in the images
+/// @param resume keep the existing files with the right sizes, e.g., to resume a run
+cl::Ampcor::OffsetWriter::OffsetWriter(const std::string& offsetName, const std::string& snrName,
+    const std::string& covName, const size_type windows, const bool resume)
+{
+    _offsetFd = open(offsetName, windows*sizeof(cl_float2), resume);
+    _snrFd = open(snrName, windows*sizeof(cl_float), resume);
+    _covFd = open(covName, 3*windows*sizeof(cl_float), resume);
+}
+
+cl::Ampcor::OffsetWriter::~OffsetWriter()
+{
+    for (const int fd : {_offsetFd, _snrFd, _covFd})
+        if (fd >= 0)
+            ::close(fd);
+}
+
+int cl::Ampcor::OffsetWriter::open(const std::string& name, const size_type bytes, const bool resume)
+{
+    const int fd = ::open(name.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat info;
+    if (fd < 0 || ::fstat(fd, &info) != 0) {
+        std::cerr << "Failed to open the file " << name << " for writing." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const bool keep = resume && static_cast<size_type>(info.st_size) == bytes;
+    if (!keep) {
+        // extend the empty file, without writing the zeros
+        if (::ftruncate(fd, 0) != 0 || ::ftruncate(fd, bytes) != 0) {
+            std::cerr << "Failed to create the file " << name << " for writing." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        _resumed = false;
+    }
+    return fd;
+}
+
+void cl::Ampcor::OffsetWriter::write(const int fd, const void* data, const size_type bytes, const size_type offset)
+{
+    const char* buffer = static_cast<const char*>(data);
+    for (size_type written = 0; written < bytes; ) {
+        const ssize_t n = ::pwrite(fd, buffer + written, bytes - written, offset + written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            std::cerr << "Failed to write the offsets." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        written += n;
+    }
+}
+
+/// the windows with consecutive indices (a row of windows on a grid) are written together
+void cl::Ampcor::OffsetWriter::write(const int_type* indices, const int_type n,
+    const cl_float2* offsets, const cl_float* snr, const cl_float* cov)
+{
+    for (int_type start = 0, end = 0; start < n; start = end) {
+        // the run of consecutive indices
+        for (end = start + 1; end < n && indices[end] == indices[end-1] + 1; end++);
+        const size_type index = indices[start];
+        const size_type count = end - start;
+        write(_offsetFd, offsets + start, count*sizeof(cl_float2), index*sizeof(cl_float2));
+        write(_snrFd, snr + start, count*sizeof(cl_float), index*sizeof(cl_float));
+        write(_covFd, cov + 3*start, 3*count*sizeof(cl_float), 3*index*sizeof(cl_float));
+    }
+}
+
+void cl::Ampcor::OffsetWriter::flush()
+{
+    for (const int fd : {_offsetFd, _snrFd, _covFd})
+        if (::fsync(fd) != 0) {
+            std::cerr << "Failed to sync the offsets to the disk." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+}
+
+// end of file
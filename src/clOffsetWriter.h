@@ -0,0 +1,60 @@
+// -*- C++ -*-
+// -*- coding: utf-8 -*-
+//
+// (c) 2023 california institute of technology
+// all rights reserved
+
+/// @file clOffsetWriter.h
+/// @brief streaming writer of the offset, snr and covariance images
+///
+/// The output files are created at their full sizes (sparse, zero-filled) and the results
+///   of each group of windows (a row of windows on a grid) are written at the positions
+///   of their windows as soon as the group is done, so the host memory is bounded by
+///   the size of a group instead of the number of windows.
+/// The layouts are the same as the whole images: offset (cfloat), snr (float)
+///   and covariance (3 floats per window)
+/// The results are written in place (pwrite), also to files pre-sized or memory-mapped by others,
+///   and flush() syncs them to the disk, before a checkpoint records the completed groups
+
+// guard
+#pragma once
+// dependencies
+#include "clHelper.h"
+
+namespace cl { namespace Ampcor {
+
+class OffsetWriter {
+
+public:
+    using size_type = cl::size_type;
+    using int_type = cl_int;
+
+    // methods
+    // with resume, the existing files (of the right sizes) are kept
+    OffsetWriter(const std::string& offsetName, const std::string& snrName, const std::string& covName,
+        const size_type windows, const bool resume = false);
+    ~OffsetWriter();
+    OffsetWriter(const OffsetWriter&) = delete;
+    OffsetWriter& operator=(const OffsetWriter&) = delete;
+
+    // write the results of n windows, at the output positions indices[k]
+    void write(const int_type* indices, const int_type n,
+        const cl_float2* offsets, const cl_float* snr, const cl_float* cov);
+    // sync the written results to the disk
+    void flush();
+    // whether all existing files are kept (to resume a run)
+    bool resumed() const { return _resumed; }
+
+private:
+    int open(const std::string& name, const size_type bytes, const bool resume);
+    void write(const int fd, const void* data, const size_type bytes, const size_type offset);
+
+    int _offsetFd = -1;
+    int _snrFd = -1;
+    int _covFd = -1;
+    bool _resumed = true;
+};
+
+}} // end of namespace
+
+// end of file
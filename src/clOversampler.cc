@@ -11,27 +11,33 @@
 /// 2) enlarge the frequency image to a larger size,
 ///    moving originals to four corners (freq shift), and padding 0
 /// 3) FFT the enlarged image back to real space
+///
+/// or, for a small grid around the center, with a matrix (zoom) DFT
 
 // my definition
 #include "clOversampler.h"
+#include "clProfiler.h"
+
+#include <cmath>
 
 // constructor, to set all kernels and their args
 cl::Ampcor::Oversampler::Oversampler(clHandle& handle,
     const int in_width, const int in_height, const int out_width, const int out_height,
-    cl::Buffer& input, cl::Buffer& output)
+    cl::Buffer& input, cl::Buffer& output, const int batch)
     : _input(input), _output(output), _in_width(in_width), _in_height(in_height),
     _out_width(out_width), _out_height(out_height)
 {
-    setKernelArgs(handle, in_width, in_height, out_width, out_height, input, output);
+    setKernelArgs(handle, in_width, in_height, out_width, out_height, input, output, batch);
 }
 
 void cl::Ampcor::Oversampler::setKernelArgs(clHandle& handle,
     const int in_width, const int in_height, const int out_width, const int out_height,
-    cl::Buffer& input, cl::Buffer& output)
+    cl::Buffer& input, cl::Buffer& output, const int batch)
 
 {
-    _forward_fft = fft_plan_type(handle, in_width, in_height, input, CL_FFT_FORWARD);
-    _inverse_fft = fft_plan_type(handle, out_width, out_height, output, CL_FFT_INVERSE);
+    _profiler = handle.profiler;
+    _forward_fft = fft_plan_type(handle, in_width, in_height, input, CL_FFT_FORWARD, batch);
+    _inverse_fft = fft_plan_type(handle, out_width, out_height, output, CL_FFT_INVERSE, batch);
 
     // grab the padding kernel
     CL_CHECK_ERROR(_matrix_fft_padding = cl::Kernel(handle.program, "matrix_fft_padding"));
@@ -44,13 +50,13 @@ void cl::Ampcor::Oversampler::setKernelArgs(clHandle& handle,
     CL_CHECK_ERROR(_matrix_fft_padding.setArg(argIndex++, out_width));
     CL_CHECK_ERROR(_matrix_fft_padding.setArg(argIndex++, out_height));
     // set global size
-    _matrix_fft_padding_global = cl::NDRange(out_width >> 1, out_height >> 1);
+    _matrix_fft_padding_global = cl::NDRange(out_width >> 1, out_height >> 1, batch);
     // all done
 }
 
 void cl::Ampcor::Oversampler::execute(cl::CommandQueue& queue,
-    const std::vector<cl::Event>* waitlist,
-    cl::Event* marker)
+    const std::vector<cl::Event>* /*waitlist*/,
+    cl::Event* /*marker*/)
 {
 
 #ifdef CL_AMPCOR_STEP_DEBUG
@@ -70,7 +76,9 @@ void cl::Ampcor::Oversampler::execute(cl::CommandQueue& queue,
     CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
         _matrix_fft_padding,
         cl::NullRange,
-        _matrix_fft_padding_global
+        _matrix_fft_padding_global,
+        cl::NullRange,
+        nullptr, profile(_profiler, "oversampler_padding")
         ));
 
 #ifdef CL_AMPCOR_STEP_DEBUG
@@ -83,3 +91,105 @@ void cl::Ampcor::Oversampler::execute(cl::CommandQueue& queue,
     // all done
 }
 
+
+// constructor, to set the interpolation matrices, kernels and their args
+cl::Ampcor::ZoomOversampler::ZoomOversampler(clHandle& handle,
+    const int in_width, const int in_height, const int out_width, const int out_height,
+    const int factor, cl::Buffer& input, cl::Buffer& output, const int batch, const bool centered)
+{
+    // interpolation matrices, computed once
+    std::vector<complex_type> ax = interpolationMatrix(in_width, out_width, factor, centered);
+    std::vector<complex_type> ay = interpolationMatrix(in_height, out_height, factor, centered);
+    _ax = cl::Buffer(handle.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        ax.size()*sizeof(complex_type), ax.data());
+    _ay = cl::Buffer(handle.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        ay.size()*sizeof(complex_type), ay.data());
+    // intermediate Ay * input, (out_height, in_width) per image
+    _temp = cl::Buffer(handle.context, CL_MEM_READ_WRITE,
+        batch*out_height*in_width*sizeof(complex_type));
+
+    CL_CHECK_ERROR(_rows = cl::Kernel(handle.program, "matrix_complex_multiply_strided"));
+    CL_CHECK_ERROR(_cols = cl::Kernel(handle.program, "matrix_complex_multiply_strided"));
+    setKernelArgs(handle, in_width, in_height, out_width, out_height, input, output, batch);
+}
+
+void cl::Ampcor::ZoomOversampler::setKernelArgs(clHandle& handle,
+    const int in_width, const int in_height, const int out_width, const int out_height,
+    cl::Buffer& input, cl::Buffer& output, const int batch)
+{
+    _profiler = handle.profiler;
+    // temp = Ay * input, shared Ay (out_height, in_height)
+    int argIndex = 0;
+    CL_CHECK_ERROR(_rows.setArg(argIndex++, _ay));
+    CL_CHECK_ERROR(_rows.setArg(argIndex++, in_height)); // row stride
+    CL_CHECK_ERROR(_rows.setArg(argIndex++, 1)); // col stride
+    CL_CHECK_ERROR(_rows.setArg(argIndex++, 0)); // batch stride
+    CL_CHECK_ERROR(_rows.setArg(argIndex++, input));
+    CL_CHECK_ERROR(_rows.setArg(argIndex++, in_width));
+    CL_CHECK_ERROR(_rows.setArg(argIndex++, 1));
+    CL_CHECK_ERROR(_rows.setArg(argIndex++, in_width*in_height));
+    CL_CHECK_ERROR(_rows.setArg(argIndex++, _temp));
+    CL_CHECK_ERROR(_rows.setArg(argIndex++, in_height));
+    _rows_global = cl::NDRange(in_width, out_height, batch);
+
+    // output = temp * Ax^T, Ax (out_width, in_width) is read transposed
+    argIndex = 0;
+    CL_CHECK_ERROR(_cols.setArg(argIndex++, _temp));
+    CL_CHECK_ERROR(_cols.setArg(argIndex++, in_width));
+    CL_CHECK_ERROR(_cols.setArg(argIndex++, 1));
+    CL_CHECK_ERROR(_cols.setArg(argIndex++, out_height*in_width));
+    CL_CHECK_ERROR(_cols.setArg(argIndex++, _ax));
+    CL_CHECK_ERROR(_cols.setArg(argIndex++, 1)); // row stride
+    CL_CHECK_ERROR(_cols.setArg(argIndex++, in_width)); // col stride
+    CL_CHECK_ERROR(_cols.setArg(argIndex++, 0)); // batch stride
+    CL_CHECK_ERROR(_cols.setArg(argIndex++, output));
+    CL_CHECK_ERROR(_cols.setArg(argIndex++, in_width));
+    _cols_global = cl::NDRange(out_width, out_height, batch);
+    // all done
+}
+
+void cl::Ampcor::ZoomOversampler::execute(cl::CommandQueue& queue,
+    const std::vector<cl::Event>* /*waitlist*/,
+    cl::Event* /*marker*/)
+{
+    CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+        _rows,
+        cl::NullRange,
+        _rows_global,
+        cl::NullRange,
+        nullptr, profile(_profiler, "zoom_oversampler_rows")
+        ));
+    CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+        _cols,
+        cl::NullRange,
+        _cols_global,
+        cl::NullRange,
+        nullptr, profile(_profiler, "zoom_oversampler_cols")
+        ));
+    // all done
+}
+
+/// A[m, n] = \sum_k exp(2 pi i k (t_m - n)/in_size), t_m = in_size/2 + (m - out_size/2)/factor
+/// (t_m = m/factor if not centered)
+/// with frequencies k in [-in_size/2, in_size/2), the same band kept by matrix_fft_padding
+/// (the 1/in_size normalization is omitted, as in the inverse FFT)
+std::vector<cl_float2> cl::Ampcor::ZoomOversampler::interpolationMatrix(const int in_size,
+    const int out_size, const int factor, const bool centered)
+{
+    std::vector<complex_type> a(static_cast<size_type>(out_size)*in_size);
+    const double twoPi = 2.0*M_PI;
+    for (int m = 0; m < out_size; m++) {
+        const double t = centered ? in_size/2 + static_cast<double>(m - out_size/2)/factor
+            : static_cast<double>(m)/factor;
+        for (int n = 0; n < in_size; n++) {
+            double re = 0.0, im = 0.0;
+            for (int k = -in_size/2; k < in_size - in_size/2; k++) {
+                const double phase = twoPi*k*(t - n)/in_size;
+                re += std::cos(phase);
+                im += std::sin(phase);
+            }
+            a[m*in_size+n] = make_float2(static_cast<float>(re), static_cast<float>(im));
+        }
+    }
+    return a;
+}
@@ -11,6 +11,8 @@
 /// 2) enlarge the frequency image to a larger size,
 ///    moving originals to four corners (freq shift), and padding 0
 /// 3) FFT the enlarged image back to real space
+///
+/// or, for a small grid around the center, with a matrix (zoom) DFT
 
 // guard
 #pragma once
@@ -18,6 +20,8 @@
 #include "clHelper.h"
 #include "clFFT2d.h"
 
+#include <vector>
+
 namespace cl { namespace Ampcor {
 
 class Oversampler {
@@ -35,12 +39,14 @@ public:
     Oversampler(clHandle& handle,
         const int in_width, const int in_height,
         const int out_width, const int out_height,
-        cl::Buffer& input, cl::Buffer& output);
+        cl::Buffer& input, cl::Buffer& output,
+        const int batch=1);
     ~Oversampler() = default;
     void setKernelArgs(clHandle& handle,
         const int in_width, const int in_height,
         const int out_width, const int out_height,
-        cl::Buffer& input, cl::Buffer& output);
+        cl::Buffer& input, cl::Buffer& output,
+        const int batch);
     void execute(cl::CommandQueue& queue,
         const std::vector<cl::Event>* waitlist = nullptr,
         cl::Event* marker=nullptr);
@@ -56,7 +62,60 @@ private:
     int _out_height;
     kernel_type _matrix_fft_padding;
     cl::NDRange _matrix_fft_padding_global;
+    // timing
+    Profiler* _profiler = nullptr;
+
+};
+
+/// Oversampling a small real image on a fine grid around its center, with a matrix (zoom) DFT
+///
+/// The oversampled image is the band-limited (trigonometric) interpolation of the input,
+///  the same as the FFT oversampler above, but evaluated only on out_width x out_height points
+///  at 1/factor spacing, centered at (in_width/2, in_height/2), i.e., the output point (m, l) is at
+///  (in_width/2 + (l-out_width/2)/factor, in_height/2 + (m-out_height/2)/factor),
+///  or, not centered, at (l/factor, m/factor) to oversample whole images of any size (without padding).
+/// For each image, output = Ay * input * Ax^T, as two small complex matrix multiplications,
+///  where Ax (out_width, in_width) and Ay (out_height, in_height) are the interpolation matrices.
+class ZoomOversampler {
+
+public:
+    using size_type = cl::size_type;
+    using complex_type = cl_float2;
+    using float_type = cl_float;
+    using int_type = cl_int;
+    using kernel_type = cl::Kernel;
 
+    // methods
+    ZoomOversampler(clHandle& handle,
+        const int in_width, const int in_height,
+        const int out_width, const int out_height,
+        const int factor,
+        cl::Buffer& input, cl::Buffer& output,
+        const int batch=1, const bool centered=true);
+    ~ZoomOversampler() = default;
+    void setKernelArgs(clHandle& handle,
+        const int in_width, const int in_height,
+        const int out_width, const int out_height,
+        cl::Buffer& input, cl::Buffer& output,
+        const int batch);
+    void execute(cl::CommandQueue& queue,
+        const std::vector<cl::Event>* waitlist = nullptr,
+        cl::Event* marker=nullptr);
+
+    // interpolation matrix (out_size, in_size) from in_size samples to out_size points at 1/factor spacing
+    static std::vector<complex_type> interpolationMatrix(const int in_size, const int out_size,
+        const int factor, const bool centered=true);
+
+private:
+    cl::Buffer _ax;
+    cl::Buffer _ay;
+    cl::Buffer _temp;
+    kernel_type _rows;
+    kernel_type _cols;
+    cl::NDRange _rows_global;
+    cl::NDRange _cols_global;
+    // timing
+    Profiler* _profiler = nullptr;
 };
 
 }} // end of namespace
@@ -0,0 +1,124 @@
+// -*- C++ -*-
+// -*- coding: utf-8 -*-
+//
+// (c) 2023 california institute of technology
+// all rights reserved
+
+/// @file clProfiler.cc
+/// @brief timing of the device commands and host stages
+
+// my definition
+#include "clProfiler.h"
+
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <algorithm>
+#include <cmath>
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+/// constructor, to align the device clock with the host clock
+cl::Ampcor::Profiler::Profiler(cl::CommandQueue& queue)
+{
+    cl::Event marker;
+    CL_CHECK_ERROR(queue.enqueueMarkerWithWaitList(nullptr, &marker));
+    CL_CHECK_ERROR(queue.finish());
+    _origin = clock::now();
+    CL_CHECK_ERROR(_device_origin = marker.getProfilingInfo<CL_PROFILING_COMMAND_END>());
+}
+
+cl::Event* cl::Ampcor::Profiler::event(const std::string& stage)
+{
+    // the references of a deque are kept when adding elements
+    _pending.emplace_back(stage, cl::Event());
+    return &_pending.back().second;
+}
+
+void cl::Ampcor::Profiler::host(const std::string& stage,
+    const clock::time_point& start, const clock::time_point& end)
+{
+    using us = std::chrono::duration<double, std::micro>;
+    _intervals.push_back({stage, false, us(start - _origin).count(), us(end - start).count()});
+}
+
+void cl::Ampcor::Profiler::collect()
+{
+    for (auto& pending : _pending) {
+        try {
+            const cl_ulong start = pending.second.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+            const cl_ulong end = pending.second.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+            _intervals.push_back({pending.first, true,
+                (static_cast<double>(start) - static_cast<double>(_device_origin))*1.0e-3,
+                (end - start)*1.0e-3});
+        } catch (const cl::Error& e) {
+            // not enqueued (e.g., an unused event) or not available
+        }
+    }
+    _pending.clear();
+}
+
+void cl::Ampcor::Profiler::summary(std::ostream& os)
+{
+    collect();
+    // stage -> durations, in the order of their first appearance
+    std::vector<std::string> stages;
+    std::map<std::string, std::vector<double>> durations;
+    std::map<std::string, bool> device;
+    for (const auto& interval : _intervals) {
+        auto& d = durations[interval.stage];
+        if (d.empty()) {
+            stages.push_back(interval.stage);
+            device[interval.stage] = interval.device;
+        }
+        d.push_back(interval.duration*1.0e-3);
+    }
+
+    os << "Profiling summary (ms) \n"
+       << std::left << std::setw(36) << "stage" << std::right
+       << std::setw(8) << "where" << std::setw(10) << "count" << std::setw(14) << "total"
+       << std::setw(12) << "mean" << std::setw(12) << "p50" << std::setw(12) << "p99" << "\n";
+    for (const auto& stage : stages) {
+        auto& d = durations[stage];
+        std::sort(d.begin(), d.end());
+        double total = 0.0;
+        for (const double t : d)
+            total += t;
+        // nearest rank
+        auto percentile = [&d](const double p) {
+            const ::size_t rank = static_cast<::size_t>(std::ceil(p*d.size()));
+            return d[std::min(std::max(rank, static_cast<::size_t>(1)), d.size()) - 1];
+        };
+        os << std::left << std::setw(36) << stage << std::right
+           << std::setw(8) << (device[stage] ? "device" : "host") << std::setw(10) << d.size()
+           << std::fixed << std::setprecision(3)
+           << std::setw(14) << total << std::setw(12) << total/d.size()
+           << std::setw(12) << percentile(0.5) << std::setw(12) << percentile(0.99) << "\n"
+           << std::defaultfloat;
+    }
+}
+
+void cl::Ampcor::Profiler::writeTrace(const std::string& filename)
+{
+    collect();
+    json events = json::array();
+    // name the device and host rows
+    events.push_back({{"name", "thread_name"}, {"ph", "M"}, {"pid", 1}, {"tid", 1},
+        {"args", {{"name", "device queue"}}}});
+    events.push_back({{"name", "thread_name"}, {"ph", "M"}, {"pid", 1}, {"tid", 2},
+        {"args", {{"name", "host"}}}});
+    for (const auto& interval : _intervals)
+        events.push_back({{"name", interval.stage}, {"cat", interval.device ? "device" : "host"},
+            {"ph", "X"}, {"ts", interval.start}, {"dur", interval.duration},
+            {"pid", 1}, {"tid", interval.device ? 1 : 2}});
+
+    std::ofstream traceFile(filename);
+    if (!traceFile) {
+        std::cerr << "Failed to open the trace file " << filename << std::endl;
+        return;
+    }
+    traceFile << json({{"traceEvents", events}, {"displayTimeUnit", "ms"}}).dump() << "\n";
+}
+
+// end of file
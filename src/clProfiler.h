@@ -0,0 +1,80 @@
+// -*- C++ -*-
+// -*- coding: utf-8 -*-
+//
+// (c) 2023 california institute of technology
+// all rights reserved
+
+/// @file clProfiler.h
+/// @brief timing of the device commands and host stages
+///
+/// The command queue is created with CL_QUEUE_PROFILING_ENABLE, and each enqueue
+///   gets an event from event(stage); the host stages are timed with HostTimer.
+/// The device times are mapped to the host clock with a marker at construction.
+/// The results are a per-stage summary (count, total, mean, p50, p99)
+///   and a timeline in the Chrome trace-event format (chrome://tracing or Perfetto)
+
+// guard
+#pragma once
+// dependencies
+#include "clHelper.h"
+#include <chrono>
+#include <deque>
+#include <vector>
+
+namespace cl { namespace Ampcor {
+
+class Profiler {
+
+public:
+    using clock = std::chrono::steady_clock;
+
+    // the queue is created with CL_QUEUE_PROFILING_ENABLE
+    Profiler(cl::CommandQueue& queue);
+    ~Profiler() = default;
+
+    // an event to attach to an enqueue, timed as the stage
+    cl::Event* event(const std::string& stage);
+    // a host stage
+    void host(const std::string& stage, const clock::time_point& start, const clock::time_point& end);
+    // read the times of the events, once the queue is synchronized
+    void collect();
+
+    // per-stage statistics, in ms
+    void summary(std::ostream& os);
+    // timeline of all commands and host stages
+    void writeTrace(const std::string& filename);
+
+private:
+    struct Interval {
+        std::string stage;
+        bool device;
+        double start; // us from the origin
+        double duration; // us
+    };
+    std::deque<std::pair<std::string, cl::Event>> _pending;
+    std::vector<Interval> _intervals;
+    clock::time_point _origin;
+    cl_ulong _device_origin = 0; // ns
+};
+
+// an event for the enqueue if profiling, otherwise none
+inline cl::Event* profile(Profiler* profiler, const char* stage)
+{
+    return profiler ? profiler->event(stage) : nullptr;
+}
+
+// times a host stage over its scope
+class HostTimer {
+public:
+    HostTimer(Profiler* profiler, const std::string& stage) :
+        _profiler(profiler), _stage(stage), _start(Profiler::clock::now()) {}
+    ~HostTimer() { if (_profiler) _profiler->host(_stage, _start, Profiler::clock::now()); }
+private:
+    Profiler* _profiler;
+    std::string _stage;
+    Profiler::clock::time_point _start;
+};
+
+}} // end of namespace
+
+// end of file
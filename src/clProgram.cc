@@ -10,25 +10,53 @@
 // dependency
 #include "clProgram.h"
 
+#include <cstdlib>
+
 // include all open cl files here, each with encloses kernels in a string
 // @note cl kernels can also be plain .cl files, but these files are not
 // compiled into the binary code, and will need to be provided.
 #include "kernels/Common.cc"  // common definitions, like a header file
 #include "kernels/Complex.cc"  // complex operations
+#include "kernels/Reduction.cc" // reductions (sum, max location)
+#include "kernels/Window.cc" // window gathering and preparation
 #include "kernels/Matrix.cc" // Matrix operations
 #include "kernels/FFT2d.cc"  // FFT2d kernels
+// generated straight-line FFT codelets
+#include "clFFTCodelet.h"
+
+// build options for the device
+// sub-group reductions require OpenCL C 2.0 and cl_khr_subgroups
+static std::string deviceBuildOptions(const cl::Device& device)
+{
+    std::string options = CL_AMPCOR_BUILD_OPTIONS;
 
+    // "OpenCL C <major>.<minor> <vendor specific>"
+    std::string version = device.getInfo<CL_DEVICE_OPENCL_C_VERSION>();
+    std::string::size_type pos = version.find("OpenCL C ");
+    int major = (pos == std::string::npos) ? 1 : std::atoi(version.c_str()+pos+9);
+    std::string extensions = device.getInfo<CL_DEVICE_EXTENSIONS>();
+    if (major >= 2 && extensions.find("cl_khr_subgroups") != std::string::npos) {
+        options.replace(options.find("-cl-std=CL1.2"), 13, "-cl-std=CL2.0");
+        options += " -DCL_AMPCOR_SUBGROUPS";
+    }
+    return options;
+}
 
-cl::Program cl::Ampcor::Program(cl::Context& context)
+cl::Program cl::Ampcor::Program(cl::Context& context, const std::string& cache_directory,
+    const std::string& options)
 {
     // concatenate all cl code together
     // use the sequence to ensure the functions are defined before being called
     // or use the common.cc to provide a definition at first
     std::string kernels = Common_CL_code
         + Complex_CL_code
+        + Reduction_CL_code
+        + Window_CL_code
         + Matrix_CL_code
-        + FFT2d_CL_code;
-    // build the program and return
-    return buildCLProgramFromString(context, kernels);
+        + FFT2d_CL_code
+        + cl::FFT::codeletsSource();
+    // build the program (or load the cached binaries) and return
+    return buildCLProgramWithCache(context, kernels,
+        deviceBuildOptions(context.getInfo<CL_CONTEXT_DEVICES>()[0]) + " " + options, cache_directory);
 }
 // end of file
\ No newline at end of file
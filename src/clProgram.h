@@ -15,8 +15,11 @@
 
 namespace cl {
     namespace Ampcor {
-        // return all compiled opencl kernels
-        cl::Program Program(cl::Context& context);
+        // return all compiled opencl kernels,
+        //  with the binaries cached in cache_directory (empty = no cache)
+        //  and extra build options, e.g., -D macros of the sizes to specialize the kernels for
+        cl::Program Program(cl::Context& context, const std::string& cache_directory="",
+            const std::string& options="");
     }
 }
 // end of file
\ No newline at end of file
@@ -0,0 +1,104 @@
+// -*- C++ -*-
+// -*- coding: utf-8 -*-
+//
+// (c) 2023 california institute of technology
+// all rights reserved
+
+/// @file clReduction.cc
+/// @brief openCL batched reductions over multiple work-groups
+
+// my definition
+#include "clReduction.h"
+#include "clProfiler.h"
+
+/// number of work-groups and their size to reduce n elements per image
+/// each work-item reduces (about) 8 elements in the first pass
+void cl::Ampcor::reductionGroupSize(const cl::size_type maxWorkGroupSize, const int n,
+    cl::size_type& localSize, int& groups)
+{
+    localSize = std::min(next_power_of_2(n), maxWorkGroupSize);
+    groups = static_cast<int>(n/(localSize*8));
+    groups = std::max(1, std::min(groups, 64));
+}
+
+/// constructor, to set all kernels and their args
+/// @param width, height the region to search
+/// @param stride, batch_stride the storage of each image
+/// @param maxloc (col, row) of the max value for each image
+cl::Ampcor::MaxLocationReduction::MaxLocationReduction(clHandle& handle,
+    const int width, const int height,
+    const int stride, const int batch_stride,
+    cl::Buffer& input, cl::Buffer& maxloc,
+    const int batch)
+{
+    CL_CHECK_ERROR(_partial_kernel = cl::Kernel(handle.program, "matrix_max_location_partial"));
+    CL_CHECK_ERROR(_finish_kernel = cl::Kernel(handle.program, "matrix_max_location_finish"));
+    setKernelArgs(handle, width, height, stride, batch_stride, input, maxloc, batch);
+}
+
+void cl::Ampcor::MaxLocationReduction::setKernelArgs(clHandle& handle,
+    const int width, const int height,
+    const int stride, const int batch_stride,
+    cl::Buffer& input, cl::Buffer& maxloc,
+    const int batch)
+{
+    _profiler = handle.profiler;
+    size_type maxWorkGroupSize, localSize;
+    int groups;
+
+    // first pass
+    CL_CHECK_ERROR(_partial_kernel.getWorkGroupInfo(handle.device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
+    reductionGroupSize(maxWorkGroupSize, width*height, localSize, groups);
+    _partial_max = cl::Buffer(handle.context, CL_MEM_READ_WRITE, groups*batch*sizeof(float_type));
+    _partial_loc = cl::Buffer(handle.context, CL_MEM_READ_WRITE, groups*batch*sizeof(int_type));
+    int argIndex = 0;
+    CL_CHECK_ERROR(_partial_kernel.setArg(argIndex++, input));
+    CL_CHECK_ERROR(_partial_kernel.setArg(argIndex++, _partial_max));
+    CL_CHECK_ERROR(_partial_kernel.setArg(argIndex++, _partial_loc));
+    CL_CHECK_ERROR(_partial_kernel.setArg(argIndex++, cl::Local(localSize*sizeof(float_type))));
+    CL_CHECK_ERROR(_partial_kernel.setArg(argIndex++, cl::Local(localSize*sizeof(int_type))));
+    CL_CHECK_ERROR(_partial_kernel.setArg(argIndex++, width));
+    CL_CHECK_ERROR(_partial_kernel.setArg(argIndex++, height));
+    CL_CHECK_ERROR(_partial_kernel.setArg(argIndex++, stride));
+    CL_CHECK_ERROR(_partial_kernel.setArg(argIndex++, batch_stride));
+    _partial_global = cl::NDRange(groups*localSize, batch);
+    _partial_local = cl::NDRange(localSize, 1);
+
+    // second pass
+    CL_CHECK_ERROR(_finish_kernel.getWorkGroupInfo(handle.device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
+    localSize = std::min(next_power_of_2(groups), maxWorkGroupSize);
+    argIndex = 0;
+    CL_CHECK_ERROR(_finish_kernel.setArg(argIndex++, _partial_max));
+    CL_CHECK_ERROR(_finish_kernel.setArg(argIndex++, _partial_loc));
+    CL_CHECK_ERROR(_finish_kernel.setArg(argIndex++, maxloc));
+    CL_CHECK_ERROR(_finish_kernel.setArg(argIndex++, cl::Local(localSize*sizeof(float_type))));
+    CL_CHECK_ERROR(_finish_kernel.setArg(argIndex++, cl::Local(localSize*sizeof(int_type))));
+    CL_CHECK_ERROR(_finish_kernel.setArg(argIndex++, groups));
+    CL_CHECK_ERROR(_finish_kernel.setArg(argIndex++, width));
+    _finish_global = cl::NDRange(localSize, batch);
+    _finish_local = cl::NDRange(localSize, 1);
+    // all done
+}
+
+void cl::Ampcor::MaxLocationReduction::execute(cl::CommandQueue& queue,
+    const std::vector<cl::Event>* /*waitlist*/,
+    cl::Event* /*marker*/)
+{
+    CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+        _partial_kernel,
+        cl::NullRange,
+        _partial_global,
+        _partial_local,
+        nullptr, profile(_profiler, "max_location_partial")
+        ));
+    CL_CHECK_ERROR(queue.enqueueNDRangeKernel(
+        _finish_kernel,
+        cl::NullRange,
+        _finish_global,
+        _finish_local,
+        nullptr, profile(_profiler, "max_location_finish")
+        ));
+    // all done
+}
+
+// end of file
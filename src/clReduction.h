@@ -0,0 +1,65 @@
+// -*- C++ -*-
+// -*- coding: utf-8 -*-
+//
+// (c) 2023 california institute of technology
+// all rights reserved
+
+/// @file clReduction.h
+/// @brief openCL batched reductions over multiple work-groups
+///
+/// MaxLocationReduction: (col, row) location of the max real part of each image in a batch
+/// It runs in two passes: 1) each work-group reduces a slice of an image to a partial result;
+///  2) one work-group per image reduces the partial results
+
+// guard
+#pragma once
+// dependencies
+#include "clHelper.h"
+
+namespace cl { namespace Ampcor {
+
+class MaxLocationReduction {
+
+public:
+    using size_type = cl::size_type;
+    using complex_type = cl_float2;
+    using float_type = cl_float;
+    using int_type = cl_int;
+    using kernel_type = cl::Kernel;
+
+    // methods
+    MaxLocationReduction() = default;
+    MaxLocationReduction(clHandle& handle,
+        const int width, const int height,
+        const int stride, const int batch_stride,
+        cl::Buffer& input, cl::Buffer& maxloc,
+        const int batch=1);
+    ~MaxLocationReduction() = default;
+    void setKernelArgs(clHandle& handle,
+        const int width, const int height,
+        const int stride, const int batch_stride,
+        cl::Buffer& input, cl::Buffer& maxloc,
+        const int batch);
+    void execute(cl::CommandQueue& queue,
+        const std::vector<cl::Event>* waitlist = nullptr,
+        cl::Event* marker=nullptr);
+
+private:
+    cl::Buffer _partial_max;
+    cl::Buffer _partial_loc;
+    kernel_type _partial_kernel;
+    kernel_type _finish_kernel;
+    cl::NDRange _partial_global;
+    cl::NDRange _partial_local;
+    cl::NDRange _finish_global;
+    cl::NDRange _finish_local;
+    // timing
+    Profiler* _profiler = nullptr;
+};
+
+// number of work-groups and their size to reduce n elements per image
+void reductionGroupSize(const cl::size_type maxWorkGroupSize, const int n,
+    cl::size_type& localSize, int& groups);
+
+}} // end of namespace
+
@@ -0,0 +1,169 @@
+// -*- C++ -*-
+// -*- coding: utf-8 -*-
+//
+// (c) 2023 california institute of technology
+// all rights reserved
+
+/// @file clSpectrumCache.cc
+/// @brief persistent (memory-mapped) cache of the window spectra and their statistics
+
+// my definition
+#include "clSpectrumCache.h"
+
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+namespace {
+    // header (with the key) and flags are aligned to pages
+    const ::size_t cache_page = 4096;
+    const char cache_magic[8] = {'A', 'M', 'P', 'C', 'O', 'R', 'S', 'C'};
+
+    struct CacheHeader {
+        char magic[8];
+        cl_ulong windows;
+        cl_ulong spectrum_size;
+        cl_ulong stat_size;
+        cl_ulong key_length;
+    };
+    const ::size_t cache_key_capacity = cache_page - sizeof(CacheHeader);
+
+    ::size_t page_align(const ::size_t n) { return (n + cache_page - 1)/cache_page*cache_page; }
+}
+
+/// constructor, to open (or create) and map the cache file
+/// @param directory the cache directory (created beforehand)
+/// @param key the description of the cached data, a file is reset if its key differs
+/// @param windows the number of windows
+/// @param spectrum_size, stat_size the number of complex values per window in the buffers
+cl::Ampcor::SpectrumCache::SpectrumCache(const std::string& directory, const std::string& key,
+    const size_type windows, const size_type spectrum_size, const size_type stat_size) :
+    _windows(windows), _spectrum_size(spectrum_size), _stat_size(stat_size)
+{
+    std::ostringstream filename;
+    filename << directory << "/" << std::hex << std::setw(16) << std::setfill('0')
+        << hash_fnv1a(key) << ".spec";
+    const std::string keyStored = key.substr(0, cache_key_capacity);
+    _file_size = cache_page + page_align(windows)
+        + windows*(spectrum_size+stat_size)*sizeof(complex_type);
+
+    _fd = ::open(filename.str().c_str(), O_RDWR | O_CREAT, 0644);
+    // one process per cache file, e.g., in a pair network run in parallel
+    if (_fd < 0 || ::flock(_fd, LOCK_EX | LOCK_NB) != 0) {
+        std::cerr << "The spectrum cache " << filename.str() << " is not available, "
+            << "the spectra are not cached \n";
+        if (_fd >= 0) ::close(_fd);
+        _fd = -1;
+        return;
+    }
+
+    // check the header, reset the file if it is for other data
+    CacheHeader header;
+    const bool matched = ::lseek(_fd, 0, SEEK_END) == static_cast<off_t>(_file_size)
+        && ::pread(_fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header))
+        && std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) == 0
+        && header.windows == windows && header.spectrum_size == spectrum_size
+        && header.stat_size == stat_size && header.key_length == keyStored.size();
+    std::string keyRead(keyStored.size(), '\0');
+    const bool reset = !matched
+        || ::pread(_fd, &keyRead[0], keyRead.size(), sizeof(header)) != static_cast<ssize_t>(keyRead.size())
+        || keyRead != keyStored;
+    if (reset) {
+        // truncate to clear all flags
+        if (::ftruncate(_fd, 0) != 0 || ::ftruncate(_fd, _file_size) != 0) {
+            std::cerr << "Failed to create the spectrum cache " << filename.str() << "\n";
+            ::close(_fd);
+            _fd = -1;
+            return;
+        }
+    }
+
+    void* data = ::mmap(nullptr, _file_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (data == MAP_FAILED) {
+        std::cerr << "Failed to map the spectrum cache " << filename.str() << "\n";
+        ::close(_fd);
+        _fd = -1;
+        return;
+    }
+    _data = static_cast<unsigned char*>(data);
+    _flags = _data + cache_page;
+    _records = _flags + page_align(windows);
+
+    if (reset) {
+        std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+        header.windows = windows;
+        header.spectrum_size = spectrum_size;
+        header.stat_size = stat_size;
+        header.key_length = keyStored.size();
+        std::memcpy(_data, &header, sizeof(header));
+        std::memcpy(_data + sizeof(header), keyStored.data(), keyStored.size());
+    }
+    // all done
+}
+
+cl::Ampcor::SpectrumCache::~SpectrumCache()
+{
+    if (_data)
+        ::munmap(_data, _file_size);
+    if (_fd >= 0)
+        ::close(_fd);
+}
+
+cl::Ampcor::SpectrumCache::complex_type* cl::Ampcor::SpectrumCache::record(const int_type index) const
+{
+    return reinterpret_cast<complex_type*>(_records)
+        + static_cast<size_type>(index)*(_spectrum_size+_stat_size);
+}
+
+bool cl::Ampcor::SpectrumCache::contains(const int_type* indices, const int_type n) const
+{
+    if (!valid())
+        return false;
+    for (int_type b=0; b<n; b++)
+        if (!_flags[indices[b]])
+            return false;
+    return true;
+}
+
+/// the records are copied to window b of the batch, for the windows indices[b]
+void cl::Ampcor::SpectrumCache::load(cl::CommandQueue& queue, cl::Buffer& spectra, cl::Buffer& stats,
+    const int_type* indices, const int_type n)
+{
+    for (int_type b=0; b<n; b++) {
+        const complex_type* source = record(indices[b]);
+        CL_CHECK_ERROR(queue.enqueueWriteBuffer(spectra, CL_FALSE,
+            b*_spectrum_size*sizeof(complex_type), _spectrum_size*sizeof(complex_type), source));
+        CL_CHECK_ERROR(queue.enqueueWriteBuffer(stats, CL_FALSE,
+            b*_stat_size*sizeof(complex_type), _stat_size*sizeof(complex_type), source+_spectrum_size));
+    }
+}
+
+void cl::Ampcor::SpectrumCache::store(cl::CommandQueue& queue, cl::Buffer& spectra, cl::Buffer& stats,
+    const int_type* indices, const int_type n)
+{
+    if (!valid())
+        return;
+    for (int_type b=0; b<n; b++) {
+        complex_type* target = record(indices[b]);
+        CL_CHECK_ERROR(queue.enqueueReadBuffer(spectra, CL_FALSE,
+            b*_spectrum_size*sizeof(complex_type), _spectrum_size*sizeof(complex_type), target));
+        CL_CHECK_ERROR(queue.enqueueReadBuffer(stats, CL_FALSE,
+            b*_stat_size*sizeof(complex_type), _stat_size*sizeof(complex_type), target+_spectrum_size));
+        _pending.push_back(indices[b]);
+    }
+}
+
+/// flag the stored windows, to be called once the reads of store() are completed
+void cl::Ampcor::SpectrumCache::flush()
+{
+    for (const int_type index : _pending)
+        _flags[index] = 1;
+    _pending.clear();
+}
+
+// end of file
@@ -0,0 +1,69 @@
+// -*- C++ -*-
+// -*- coding: utf-8 -*-
+//
+// (c) 2023 california institute of technology
+// all rights reserved
+
+/// @file clSpectrumCache.h
+/// @brief persistent (memory-mapped) cache of the window spectra and their statistics
+///
+/// In a pair network, an image is correlated with several others using the same windows,
+///   the forward ffts of its windows can be computed once and loaded in the following runs.
+/// The cache file, named by the hash of the key (image, window geometry, padding ...), holds
+///   1) a header with the key and the sizes; 2) a flag per window, set once its record is stored;
+///   3) a record per window, the spectrum followed by the statistics, in the same layout
+///   as the window buffers in a batch
+/// The file is sparse, only the stored records take disk space
+
+// guard
+#pragma once
+// dependencies
+#include "clHelper.h"
+#include <vector>
+
+namespace cl { namespace Ampcor {
+
+class SpectrumCache {
+
+public:
+    using size_type = cl::size_type;
+    using complex_type = cl_float2;
+    using int_type = cl_int;
+
+    // methods
+    SpectrumCache(const std::string& directory, const std::string& key,
+        const size_type windows, const size_type spectrum_size, const size_type stat_size);
+    ~SpectrumCache();
+    SpectrumCache(const SpectrumCache&) = delete;
+    SpectrumCache& operator=(const SpectrumCache&) = delete;
+
+    // whether the cache file is mapped
+    bool valid() const { return _data != nullptr; }
+    // whether the records of all windows are stored
+    bool contains(const int_type* indices, const int_type n) const;
+    // copy the records of the windows to the batch buffers (non-blocking)
+    void load(cl::CommandQueue& queue, cl::Buffer& spectra, cl::Buffer& stats,
+        const int_type* indices, const int_type n);
+    // copy the batch buffers to the records of the windows (non-blocking),
+    //  the windows are flagged by flush(), after the queue is synchronized
+    void store(cl::CommandQueue& queue, cl::Buffer& spectra, cl::Buffer& stats,
+        const int_type* indices, const int_type n);
+    void flush();
+
+private:
+    complex_type* record(const int_type index) const;
+
+    int _fd = -1;
+    unsigned char* _data = nullptr;
+    size_type _file_size = 0;
+    size_type _windows;
+    size_type _spectrum_size;
+    size_type _stat_size;
+    unsigned char* _flags = nullptr;
+    unsigned char* _records = nullptr;
+    std::vector<int_type> _pending;
+};
+
+}} // end of namespace
+
+// end of file
@@ -18,14 +18,14 @@ std::string FFT2d_CL_code = R"(
         return reversed_num;
     }
 
-    // Perform in-place FFT for a 2D complex matrix
-    // this kernel needs to called twice, one along row and one along column
-    // length(width or height) needs to be in power of 2
-    __kernel void FFT2D(
-        int direction, // 1 = forward, -1 = inverse
-        int length, // width or height
-        int log2_length, // log2(width) or log2(height)
-        int stride, // 1 along row, width along column
+    // radix-2 FFT along rows or columns, the body of the FFT2D kernel
+    //  inlined with constant sizes, the stages and index arithmetic can be unrolled and reduced
+    __attribute__((always_inline))
+    void fft2d_radix2(
+        const int direction,
+        const int length,
+        const int log2_length,
+        const int stride,
         __global float2* matrix,
         __local float4* smem)
     {
@@ -33,7 +33,11 @@ std::string FFT2d_CL_code = R"(
         int local_size = get_local_size(0);
         float fdirection = (float)direction;
 
-        int offset = (stride==1) ? get_group_id(1) << log2_length : get_group_id(1);
+        // along row: the group is the row index (over all rows in the batch)
+        // along column: the group is (matrix index)*width + column index
+        int group = get_group_id(1);
+        int offset = (stride==1) ? group << log2_length
+            : mad24(group / stride, stride << log2_length, group % stride);
         int half_size = 1;
         int log2_half_size = 0;
         int half_length = (length >> 1);
@@ -169,5 +173,34 @@ std::string FFT2d_CL_code = R"(
         // all done
     }
 
+    // Perform in-place FFT for a 2D complex matrix
+    // this kernel needs to called twice, one along row and one along column
+    // length(width or height) needs to be in power of 2
+    // a batch of matrices stored contiguously is transformed with
+    //   globalSize(1) = height*batch (along row) or width*batch (along column)
+    // with the size of the correlation windows defined at build time (CL_AMPCOR_FFT_WIDTH ...),
+    //   the transforms of that size use a specialized copy
+    __kernel void FFT2D(
+        int direction, // 1 = forward, -1 = inverse
+        int length, // width or height
+        int log2_length, // log2(width) or log2(height)
+        int stride, // 1 along row, width along column
+        __global float2* matrix,
+        __local float4* smem)
+    {
+#ifdef CL_AMPCOR_FFT_WIDTH
+        if (stride == 1 && length == CL_AMPCOR_FFT_WIDTH) {
+            fft2d_radix2(direction, CL_AMPCOR_FFT_WIDTH, CL_AMPCOR_FFT_LOG2_WIDTH, 1, matrix, smem);
+            return;
+        }
+        if (stride == CL_AMPCOR_FFT_WIDTH && length == CL_AMPCOR_FFT_HEIGHT) {
+            fft2d_radix2(direction, CL_AMPCOR_FFT_HEIGHT, CL_AMPCOR_FFT_LOG2_HEIGHT, CL_AMPCOR_FFT_WIDTH,
+                matrix, smem);
+            return;
+        }
+#endif
+        fft2d_radix2(direction, length, log2_length, stride, matrix, smem);
+    }
+
 )";
 // end of file
@@ -6,30 +6,6 @@
 // CL Kernels enclosed in a string variable
 std::string Matrix_CL_code = R"(
 
-    // take amplitudes in a rect region (width, length) of the complex image
-    //   with size (p_width, p_height);
-    // set zeros to the rest
-    __kernel void matrix_complex_amplitude(
-        __global float2* image,
-        const int width, const int height, // work region
-        const int p_width, const int p_height // whole image
-        )
-    {
-        int col = get_global_id(0);
-        int row = get_global_id(1);
-
-        int index =  mad24(row, p_width, col);
-        if(row < height && col < width)
-        {
-            float2 pixel = image[index];
-            float amplitude = length(pixel);
-            image[index] = (float2)(amplitude, 0.0f);
-        }
-        else {
-            image[index] = (float2)(0.0f, 0.0f);
-        }
-    }
-
     // fill the image with 0
     __kernel void matrix_fill_zero(
         __global float2* image)
@@ -63,34 +39,96 @@ std::string Matrix_CL_code = R"(
         result[index] = complex_mul_conj(matrixA[index], matrixB[index]);
     }
 
-    // extract real part from a matrix
-    // this kernel is called with globalSize = {out_width, out_height}
-     __kernel void matrix_extract_real(
-        __global const float2* input,
-        __global float2* output,
-        const int in_width, const int in_height,
-        const int in_stride,
-        __global const int2* max_loc,
-        const int offsetx, const int offsety)
+    // direct (spatial-domain) cross-correlation, for small search ranges
+    //   C(x, y) = \sum_{X,Y} R(X, Y) S(X+x, Y+y), over the region (regionx, regiony)
+    // reference/secondary/correlation share the same storage (stride, batch_stride)
+    // the reference template is staged in local memory, tile_height rows at a time
+    // scale is applied to match the (un-normalized) output of the FFT correlator
+    // this kernel is called with globalSize = {regionx, regiony, batch} rounded up to localSize
+    __kernel void correlation_direct(
+        __global const float2* reference, // only the real part
+        __global const float2* secondary, // only the real part
+        __global float2* correlation,
+        __local float* tile, // tile_height*window_width
+        const int window_width, const int window_height,
+        const int regionx, const int regiony,
+        const int stride, const int batch_stride,
+        const int tile_height,
+        const float scale)
     {
-        const int idx = get_global_id(0);
-        const int idy = get_global_id(1);
-        const int out_width = get_global_size(0);
-
-        const int in_idx = idx + max_loc[0].x + offsetx;
-        const int in_idy = idy + max_loc[0].y + offsety;
-
-        if(in_idx>=0 && in_idx<in_width && in_idy>=0 && in_idy<in_height)
+        const int x = get_global_id(0);
+        const int y = get_global_id(1);
+        const int batch = get_global_id(2);
+        const int localIndex = mad24((int)get_local_id(1), (int)get_local_size(0), (int)get_local_id(0));
+        const int localSize = get_local_size(0)*get_local_size(1);
+        const bool active = (x < regionx && y < regiony);
+
+        reference += batch*batch_stride;
+        secondary += batch*batch_stride;
+        correlation += batch*batch_stride;
+
+        float sum = 0.0f;
+        for (int row0 = 0; row0 < window_height; row0 += tile_height)
         {
-            output[mad24(idy, out_width, idx)] = (float2)(input[mad24(in_idy, in_stride, in_idx)].x, 0.0f);
-        }
-        else{
-            output[mad24(idy, out_width, idx)] = (float2)(0.0f, 0.0f);
+            const int rows = min(tile_height, window_height - row0);
+            // load a tile of the template into local memory
+            for (int i = localIndex; i < rows*window_width; i += localSize)
+            {
+                const int row = i / window_width;
+                const int col = i - row*window_width;
+                tile[i] = reference[mad24(row0+row, stride, col)].x;
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            // dot product of the template tile with the shifted search window
+            if (active)
+            {
+                for (int row = 0; row < rows; row++)
+                {
+                    __global const float2* search = secondary + mad24(y+row0+row, stride, x);
+                    __local const float* temp = tile + row*window_width;
+                    for (int col = 0; col < window_width; col++)
+                        sum = fma(temp[col], search[col].x, sum);
+                }
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
         }
+
+        if (active)
+            correlation[mad24(y, stride, x)] = (float2)(sum*scale, 0.0f);
+    } // end of correlation_direct
+
+    // batched complex matrix multiplication C = A B, A (m, k), B (k, n), C (m, n)
+    // element (i, j) of A is at A[batch*a_batch_stride + i*a_row_stride + j*a_col_stride], same for B
+    //  a transpose is taken by swapping the row/col strides,
+    //  and a matrix shared by all images in the batch has batch_stride = 0
+    // C is stored contiguously, (m, n) per image
+    // this kernel is called with globalSize = {n, m, batch}
+    __kernel void matrix_complex_multiply_strided(
+        __global const float2* A,
+        const int a_row_stride, const int a_col_stride, const int a_batch_stride,
+        __global const float2* B,
+        const int b_row_stride, const int b_col_stride, const int b_batch_stride,
+        __global float2* C,
+        const int k)
+    {
+        const int j = get_global_id(0);
+        const int i = get_global_id(1);
+        const int batch = get_global_id(2);
+        const int n = get_global_size(0);
+        const int m = get_global_size(1);
+
+        A += batch*a_batch_stride + i*a_row_stride;
+        B += batch*b_batch_stride + j*b_col_stride;
+
+        float2 sum = (float2)(0.0f, 0.0f);
+        for (int l = 0; l < k; l++)
+            sum += complex_mul(A[l*a_col_stride], B[l*b_row_stride]);
+        C[mad24(batch, m*n, mad24(i, n, j))] = sum;
     }
 
     // fft2d padding zeros in the middle
-    // this kernel is called with globalSize = {out_width/2, out_height/2}
+    // this kernel is called with globalSize = {out_width/2, out_height/2, batch}
     __kernel void matrix_fft_padding(
         __global const float2* input,
         __global float2* output,
@@ -99,6 +137,10 @@ std::string Matrix_CL_code = R"(
     {
         const int idx = get_global_id(0);
         const int idy = get_global_id(1);
+        const int batch = get_global_id(2);
+
+        input += batch*in_width*in_height;
+        output += batch*out_width*out_height;
 
         const int half_in_width = in_width >> 1;
         const int half_in_height = in_height >> 1;
@@ -126,117 +168,17 @@ std::string Matrix_CL_code = R"(
     }
 
 
-    // compute the sum and sum square of a complex image (real part only)
-    //  over the region(rx, ry) from the image size (width, height)
-    // this kernel is called with workgroupSize = globalSize = {regionx*regiony}
-    __kernel void matrix_sum_sum2(
-        __global const float2* input, // only sum the real part
-        __global float2* sum, // (sum, sum square)
-        __local float2* local_sum,
-        const int regionx, const int regiony,
-        const int width, const int height)
-	{
-		int globalIndex = get_global_id(0);
-		int localIndex = get_local_id(0); // should be the same
-
-		local_sum[localIndex] = (float2)(0.0f, 0.0f); // (x = sum, y=sum square)
-        barrier(CLK_LOCAL_MEM_FENCE);
-
-        int n = regionx*regiony;
-			// Compute partial sum in each work-item
-		for (int i = globalIndex; i < n; i+=get_global_size(0))
-		{
-            int row = i / regionx;
-            int col = i % regionx;
-		    float val = input[row*width+col].x;
-			local_sum[localIndex].x += val;
-			local_sum[localIndex].y += val*val;
-		}
-			// Synchronize all work-items in the work-group
-		barrier(CLK_LOCAL_MEM_FENCE);
-
-			// Perform reduction within the work-group
-		for (int stride = get_local_size(0) / 2; stride > 0; stride >>= 1)
-		{
-			if (localIndex < stride)
-				local_sum[localIndex] += local_sum[localIndex + stride];
-
-			// Synchronize all work-items in the work-group
-			barrier(CLK_LOCAL_MEM_FENCE);
-		}
-
-		if (get_local_id(0) == 0)
-				sum[0] = local_sum[0];
-	}
-
-
-    // compute the sum area table and sum square of a complex image (real part only)
-    __kernel void matrix_sat_sat2(
-        __global const float2* input, // only sum the real part
-        __global float2* sat2, // (sum, sum square)
-        const int width, const int height, // region and output
-        const int p_width, const int p_height) // storage dimension of input
-    {
-
-        int globalIndex = get_global_id(0);
-
-        // compute prefix-sum along row at first (each thread for each row)
-        // the number of rows may be bigger than the number of threads, iterate
-        for (int row = globalIndex; row < height; row += get_global_size(0)) {
-            // running sum for value and value^2
-            float2 sum2 = (float2)(0.0f, 0.0f);
-            int index = row * p_width;
-            int out_index = row * width;
-            // iterative over column
-            for (int i=0; i<width; i++) {
-                // get the real part
-                float val = input[index].x;
-                // add it to sum2
-                sum2 += (float2)(val, val*val);
-                // assign the current accumulated sum to output
-                sat2[out_index] = sum2;
-                index++;
-                out_index++;
-            }
-        }
-        // wait till all sat2
-        barrier(CLK_GLOBAL_MEM_FENCE);
-
-        // compute prefix-sum along the row (each thread for each column)
-        for (int col = globalIndex; col < width; col += get_global_size(0)) {
-            // start position of the current column
-            int index = col;
-            // assign sum with the first line value
-            float2 sum2 = sat2[index];
-            // iterative over rest lines
-            for (int j=1; j<height; j++) {
-                index += width;
-                sum2 += sat2[index];
-                sat2[index] = sum2;
-            }
-        }
-        //barrier(CLK_GLOBAL_MEM_FENCE);
-
-    } // end of matrix_sat_sat2
-
-    // normalize the correlation surface
-    __kernel void correlation_normalize(
-        __global float2* surface, // read-write only the real part matters
-        __global const float2* referenceSum, // (sum, sum square)
-        __global const float2* searchSat, //
-        const int regionx, const int regiony, // correlation surface region
-        const int storage_width, const int storage_height, // matrix size for storing the correlation surface
-        const int window_width, const int window_height, // reference window size
-        const int search_window_width, const int search_window_height // search window size
-        )
+    // normalized value of the (un-normalized) correlation at lag (x, y)
+    //  cor_norm = (cor_un-norm -<reference><search>)/sqrt( <reference^2> -<reference>^2)(...)
+    // searchSat is the sum area table of (search, search^2) of one window
+    __attribute__((always_inline))
+    float correlation_normalize_value(const float correlation,
+        const float2 reference_sum, __global const float2* searchSat,
+        const int x, const int y,
+        const int window_width, const int window_height,
+        const int search_window_width,
+        const float size_recip, const float size_recip2)
     {
-
-        int x = get_global_id(0);
-        int y = get_global_id(1);
-
-        // reference
-        float2 reference_sum = referenceSum[0];
-
         // search
         // get four corner at sum area table
         // left top
@@ -249,72 +191,295 @@ std::string Matrix_CL_code = R"(
         float2 rb = searchSat[(y+window_height-1)*search_window_width+x+window_width-1];
         // get search sum and sum square
         float2 search_sum = rb -lb -rt +lt;
-        // normalize cor_norm = (cor_un-norm -<reference><search>)/sqrt( <reference^2> -<reference>^2)(...)
-        float size_recip = native_recip((float)(window_width*window_height));
-        float size_recip2 = native_recip((float)(storage_width*storage_height)); //fft norm
-        // only normalize real part
-        const int index = mad24(y, storage_width, x);
-        float temp = surface[index].x*size_recip2 - reference_sum.x * search_sum.x*size_recip;
-        //printf("debug norm %d %g %g %g %g %g %g\n", index, search_sum.x, reference_sum.x, surface[index].x, temp,
-        //    reference_sum.y, search_sum.y);
+        float temp = correlation*size_recip2 - reference_sum.x * search_sum.x*size_recip;
         temp *= native_rsqrt(
             (reference_sum.y - reference_sum.x*reference_sum.x*size_recip)
                 *(search_sum.y-search_sum.x*search_sum.x*size_recip)+FLT_EPSILON);
-        surface[index].x = temp;
-    } // end of correlation_normalize
-
-    // find the max (real part) location on an image
-    //  over the region(rx, ry) from the image size (width, height)
-    // this kernel is called with workgroupSize = globalSize = {regionx*regiony}
-    __kernel void matrix_max_location(
-        __global const float2* input, // only sum the real part
-        __global int2* maxloc, // along (width, height)
-        __local float* local_max, // local memory to save max value and location
-        __local int* local_maxloc,
-        const int width, const int height,
-        const int stride)
-	{
-		int globalIndex = get_global_id(0);
-		int localIndex = get_local_id(0); // should be the same as globalIndex
-        int groupSize = get_local_size(0);
-
-		local_max[localIndex] = 0.0f; // (assume amplitudes are positive)
-        local_maxloc[localIndex] = 0;
-
-	    // Compute partial sum in each work-item
-		for (int id = globalIndex; id < width*height; id += groupSize)
-		{
-		    int col = id % width;
-            int row = id / width;
-		    float val = input[mad24(row, stride, col)].x;
-			if(local_max[localIndex] < val) {
-			    local_max[localIndex] = val;
-			    local_maxloc[localIndex] = id;
-			}
-		}
-		// Synchronize all work-items in the work-group
-		barrier(CLK_LOCAL_MEM_FENCE);
-
-			// Perform reduction within the work-group
-		for (int stride = groupSize / 2; stride > 0; stride >>= 1)
-		{
-			if (localIndex < stride)
-			{
-			    if(local_max[localIndex + stride] > local_max[localIndex])
-			    {
-			        local_max[localIndex] = local_max[localIndex + stride];
-			        local_maxloc[localIndex] = local_maxloc[localIndex + stride];
-			    }
-			}
-			// Synchronize all work-items in the work-group
-			barrier(CLK_LOCAL_MEM_FENCE);
-		}
-        // use the thread 0 to return the result
-		if (localIndex == 0) {
-		    maxloc[0].x = local_maxloc[0] % width;
-		    maxloc[0].y = local_maxloc[0] / width; // (col, row)
-		}
-	}
+        return temp;
+    }
+
+    // sub-pixel peak position from three samples (f(-1), f(0), f(1)) with a parabolic fit
+    __attribute__((always_inline))
+    float peak_parabolic(const float fm, const float f0, const float fp)
+    {
+        const float denom = fm - 2.0f*f0 + fp;
+        return (denom < 0.0f) ? clamp(0.5f*(fm - fp)/denom, -0.5f, 0.5f) : 0.0f;
+    }
+
+    // sub-pixel peak position from three samples with a gaussian fit (parabolic fit of the logarithms)
+    //  falls back to the parabolic fit for non-positive samples
+    __attribute__((always_inline))
+    float peak_gaussian(const float fm, const float f0, const float fp)
+    {
+        if (fm <= 0.0f || f0 <= 0.0f || fp <= 0.0f)
+            return peak_parabolic(fm, f0, fp);
+        return peak_parabolic(log(fm), log(f0), log(fp));
+    }
+
+    // hann-windowed sinc, the window has a half width of half_width
+    __attribute__((always_inline))
+    float windowed_sinc(const float x, const float half_width)
+    {
+        if (fabs(x) >= half_width)
+            return 0.0f;
+        const float px = M_PI_F*x;
+        const float sinc = (x == 0.0f) ? 1.0f : native_sin(px)/px;
+        return sinc*0.5f*(1.0f + native_cos(px/half_width));
+    }
+
+    // normalize the correlation surface on the fly, find the location of its max,
+    //  and extract the (normalized) zoom window around it, in one pass over the surface
+    // the surface itself is left un-normalized
+    // max_loc is (col, row) of the peak, the zoom window (zoom_width, zoom_height) starts
+    //  at max_loc + (offsetx, offsety), values outside the region are set to 0
+    // the sub-pixel position of the peak, relative to max_loc, is estimated by
+    //  estimator = 0: none (oversampled separately), (0, 0) is written
+    //  estimator = 1: parabolic fit on the 3x3 neighbourhood
+    //  estimator = 2: gaussian fit on the 3x3 neighbourhood
+    //  estimator = 3: max of the sinc-interpolated zoom window over (-1, 1) at 1/factor spacing
+    // with coherent = 1, the surface is complex and its magnitude is normalized
+    // the signal-to-noise ratio, snr = peak^2/(mean of value^2 outside the peak neighbourhood
+    //  (2*stat_half+1)^2, or over the whole surface if the neighbourhood covers it), and the covariance of the offset (xx, yy, xy), in pixel_scale^2 per pixel^2,
+    //  from the curvature at the peak, are written for each window
+    // this kernel is called with globalSize = {localSize, batch}, localSize = {localSize, 1}
+    // the body is inlined with constant sizes for the correlation of a run (see below)
+    __attribute__((always_inline))
+    void correlation_peak_zoom(
+        __global const float2* surface, // only the real part matters
+        __global const float2* referenceSum, // (sum, sum square)
+        __global const float2* searchSat,
+        __global int2* max_loc,
+        __global float2* zoom,
+        __global float2* subpixel,
+        __local float* scratch_max, // localSize
+        __local int* scratch_loc, // localSize
+        __local float* tile, // zoom_width*zoom_height
+        __local float2* scratch_sum, // localSize
+        __global float* snr,
+        __global float* cov, // 3 per window
+        const int regionx, const int regiony, // correlation surface region
+        const int storage_width, const int storage_height, // matrix size for storing the correlation surface
+        const int window_width, const int window_height, // reference window size
+        const int search_window_width, const int search_window_height, // search window size
+        const int zoom_width, const int zoom_height,
+        const int offsetx, const int offsety,
+        const int estimator, const int factor,
+        const int coherent,
+        const int stat_half, const float pixel_scale)
+    {
+        const int batch = get_global_id(1);
+
+        surface += batch*storage_width*storage_height;
+        searchSat += batch*search_window_width*search_window_height;
+        zoom += batch*zoom_width*zoom_height;
+
+        const float2 reference_sum = referenceSum[batch];
+        const float size_recip = native_recip((float)(window_width*window_height));
+        const float size_recip2 = native_recip((float)(storage_width*storage_height)); //fft norm
+
+        // coarse peak search
+        float max_value = -FLT_MAX;
+        int max_index = 0;
+        float energy = 0.0f;
+        for (int id = get_local_id(0); id < regionx*regiony; id += get_local_size(0))
+        {
+            const int y = id / regionx;
+            const int x = id - y*regionx;
+            const float2 c = surface[mad24(y, storage_width, x)];
+            const float val = correlation_normalize_value(coherent ? length(c) : c.x,
+                reference_sum, searchSat, x, y, window_width, window_height, search_window_width,
+                size_recip, size_recip2);
+            energy += val*val;
+            if (val > max_value) {
+                max_value = val;
+                max_index = id;
+            }
+        }
+        work_group_reduce_max_location(&max_value, &max_index, scratch_max, scratch_loc);
+
+        const int peakx = max_index % regionx;
+        const int peaky = max_index / regionx;
+        if (get_local_id(0) == 0)
+            max_loc[batch] = (int2)(peakx, peaky);
+
+        // energy (and its count) in the peak neighbourhood
+        const int x0 = max(peakx - stat_half, 0);
+        const int y0 = max(peaky - stat_half, 0);
+        const int stat_width = min(peakx + stat_half + 1, regionx) - x0;
+        const int stat_height = min(peaky + stat_half + 1, regiony) - y0;
+        float peak_energy = 0.0f;
+        for (int id = get_local_id(0); id < stat_width*stat_height; id += get_local_size(0))
+        {
+            const int y = y0 + id / stat_width;
+            const int x = x0 + id % stat_width;
+            const float2 c = surface[mad24(y, storage_width, x)];
+            const float val = correlation_normalize_value(coherent ? length(c) : c.x,
+                reference_sum, searchSat, x, y, window_width, window_height, search_window_width,
+                size_recip, size_recip2);
+            peak_energy += val*val;
+        }
+        const float2 energies = work_group_reduce_sum2((float2)(energy, peak_energy), scratch_sum);
+        if (get_local_id(0) == 0) {
+            const int count = regionx*regiony - stat_width*stat_height;
+            const float noise = (count > 0) ? (energies.x - energies.y)/(float)count
+                : energies.x/(float)(regionx*regiony);
+            snr[batch] = (noise > 0.0f) ? max_value*max_value/noise : 0.0f;
+        }
+
+        // zoom window, normalized again from the surface
+        for (int id = get_local_id(0); id < zoom_width*zoom_height; id += get_local_size(0))
+        {
+            const int idy = id / zoom_width;
+            const int idx = id - idy*zoom_width;
+            const int x = peakx + offsetx + idx;
+            const int y = peaky + offsety + idy;
+            float val = 0.0f;
+            if (x >= 0 && x < regionx && y >= 0 && y < regiony) {
+                const float2 c = surface[mad24(y, storage_width, x)];
+                val = correlation_normalize_value(coherent ? length(c) : c.x,
+                    reference_sum, searchSat, x, y, window_width, window_height, search_window_width,
+                    size_recip, size_recip2);
+            }
+            zoom[id] = (float2)(val, 0.0f);
+            tile[id] = val;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // the peak in the zoom window
+        const int cx = -offsetx;
+        const int cy = -offsety;
+
+        // covariance from the curvature at the peak (as in ampcor)
+        if (get_local_id(0) == 0) {
+            float3 variance = (float3)(99.0f, 99.0f, 0.0f);
+            if (cx > 0 && cx < zoom_width-1 && cy > 0 && cy < zoom_height-1
+                && peakx > 0 && peakx < regionx-1 && peaky > 0 && peaky < regiony-1) {
+                const float scale2 = pixel_scale*pixel_scale;
+                const float window_size = window_width*window_height/scale2;
+                const int c = mad24(cy, zoom_width, cx);
+                float dxx = -(tile[c+1] + tile[c-1] - 2.0f*max_value)*scale2*window_size;
+                float dyy = -(tile[c+zoom_width] + tile[c-zoom_width] - 2.0f*max_value)*scale2*window_size;
+                float dxy = (tile[c+zoom_width+1] + tile[c-zoom_width-1]
+                    - tile[c+zoom_width-1] - tile[c-zoom_width+1])*0.25f*scale2*window_size;
+                float n2 = fmax(1.0f - max_value, 0.0f);
+                const float n4 = n2*n2*0.5f*window_size;
+                n2 *= 2.0f;
+                const float u = dxy*dxy - dxx*dyy;
+                const float u2 = u*u;
+                if (fabs(u) > 1.0e-2f)
+                    variance = (float3)((-n2*u*dyy + n4*(dyy*dyy + dxy*dxy))/u2,
+                        (-n2*u*dxx + n4*(dxx*dxx + dxy*dxy))/u2,
+                        ((n2*u - n4*(dxx + dyy))*dxy)/u2);
+            }
+            vstore3(variance, batch, cov);
+        }
+
+        if (estimator == 1 || estimator == 2) {
+            if (get_local_id(0) == 0) {
+                float2 frac = (float2)(0.0f, 0.0f);
+                // no fit at the edges of the region
+                if (peakx > 0 && peakx < regionx-1 && cx > 0 && cx < zoom_width-1) {
+                    const float fm = tile[mad24(cy, zoom_width, cx-1)];
+                    const float fp = tile[mad24(cy, zoom_width, cx+1)];
+                    frac.x = (estimator == 1) ? peak_parabolic(fm, max_value, fp) : peak_gaussian(fm, max_value, fp);
+                }
+                if (peaky > 0 && peaky < regiony-1 && cy > 0 && cy < zoom_height-1) {
+                    const float fm = tile[mad24(cy-1, zoom_width, cx)];
+                    const float fp = tile[mad24(cy+1, zoom_width, cx)];
+                    frac.y = (estimator == 1) ? peak_parabolic(fm, max_value, fp) : peak_gaussian(fm, max_value, fp);
+                }
+                subpixel[batch] = frac;
+            }
+        }
+        else if (estimator == 3) {
+            // evaluate the interpolated surface on a (2*factor+1)^2 grid
+            const int n = 2*factor+1;
+            const float step = native_recip((float)factor);
+            const float half_width = (float)(min(zoom_width, zoom_height)/2);
+            max_value = -FLT_MAX;
+            max_index = 0;
+            for (int id = get_local_id(0); id < n*n; id += get_local_size(0))
+            {
+                const int v = id / n;
+                const int u = id - v*n;
+                const float tx = (u - factor)*step;
+                const float ty = (v - factor)*step;
+                float val = 0.0f;
+                for (int j = 0; j < zoom_height; j++)
+                {
+                    const float wy = windowed_sinc(ty - (j - cy), half_width);
+                    if (wy == 0.0f)
+                        continue;
+                    float row = 0.0f;
+                    for (int i = 0; i < zoom_width; i++)
+                        row += tile[mad24(j, zoom_width, i)]*windowed_sinc(tx - (i - cx), half_width);
+                    val += wy*row;
+                }
+                if (val > max_value) {
+                    max_value = val;
+                    max_index = id;
+                }
+            }
+            work_group_reduce_max_location(&max_value, &max_index, scratch_max, scratch_loc);
+            if (get_local_id(0) == 0)
+                subpixel[batch] = (float2)((max_index % n - factor)*step, (max_index / n - factor)*step);
+        }
+        else if (get_local_id(0) == 0) {
+            subpixel[batch] = (float2)(0.0f, 0.0f);
+        }
+    } // end of correlation_peak_zoom
+
+    // with the sizes of the correlation defined at build time (CL_AMPCOR_CORRELATION_SIZES),
+    //  the windows of that size use a specialized copy, e.g., with the divisions by constants
+    __kernel void correlation_normalize_peak_zoom(
+        __global const float2* surface, // only the real part matters
+        __global const float2* referenceSum, // (sum, sum square)
+        __global const float2* searchSat,
+        __global int2* max_loc,
+        __global float2* zoom,
+        __global float2* subpixel,
+        __local float* scratch_max, // localSize
+        __local int* scratch_loc, // localSize
+        __local float* tile, // zoom_width*zoom_height
+        __local float2* scratch_sum, // localSize
+        __global float* snr,
+        __global float* cov, // 3 per window
+        const int regionx, const int regiony, // correlation surface region
+        const int storage_width, const int storage_height, // matrix size for storing the correlation surface
+        const int window_width, const int window_height, // reference window size
+        const int search_window_width, const int search_window_height, // search window size
+        const int zoom_width, const int zoom_height,
+        const int offsetx, const int offsety,
+        const int estimator, const int factor,
+        const int coherent,
+        const int stat_half, const float pixel_scale)
+    {
+#ifdef CL_AMPCOR_CORRELATION_SIZES
+        if (regionx == CL_AMPCOR_REGION_WIDTH && regiony == CL_AMPCOR_REGION_HEIGHT
+            && storage_width == CL_AMPCOR_STORAGE_WIDTH && storage_height == CL_AMPCOR_STORAGE_HEIGHT
+            && window_width == CL_AMPCOR_WINDOW_WIDTH && window_height == CL_AMPCOR_WINDOW_HEIGHT
+            && search_window_width == CL_AMPCOR_SEARCH_WIDTH && search_window_height == CL_AMPCOR_SEARCH_HEIGHT
+            && zoom_width == CL_AMPCOR_ZOOM_SIZE && zoom_height == CL_AMPCOR_ZOOM_SIZE
+            && offsetx == -CL_AMPCOR_ZOOM_SIZE/2 && offsety == -CL_AMPCOR_ZOOM_SIZE/2) {
+            correlation_peak_zoom(surface, referenceSum, searchSat, max_loc, zoom, subpixel,
+                scratch_max, scratch_loc, tile, scratch_sum, snr, cov,
+                CL_AMPCOR_REGION_WIDTH, CL_AMPCOR_REGION_HEIGHT,
+                CL_AMPCOR_STORAGE_WIDTH, CL_AMPCOR_STORAGE_HEIGHT,
+                CL_AMPCOR_WINDOW_WIDTH, CL_AMPCOR_WINDOW_HEIGHT,
+                CL_AMPCOR_SEARCH_WIDTH, CL_AMPCOR_SEARCH_HEIGHT,
+                CL_AMPCOR_ZOOM_SIZE, CL_AMPCOR_ZOOM_SIZE,
+                -CL_AMPCOR_ZOOM_SIZE/2, -CL_AMPCOR_ZOOM_SIZE/2,
+                estimator, factor, coherent, stat_half, pixel_scale);
+            return;
+        }
+#endif
+        correlation_peak_zoom(surface, referenceSum, searchSat, max_loc, zoom, subpixel,
+            scratch_max, scratch_loc, tile, scratch_sum, snr, cov,
+            regionx, regiony, storage_width, storage_height,
+            window_width, window_height, search_window_width, search_window_height,
+            zoom_width, zoom_height, offsetx, offsety,
+            estimator, factor, coherent, stat_half, pixel_scale);
+    } // end of correlation_normalize_peak_zoom
 
     __kernel void matrix_transpose(
         const uint rows,
@@ -0,0 +1,209 @@
+// OpenCL Reduction Kernels
+// multi-work-group, batched reductions, using sub-group operations when available
+// (CL_AMPCOR_SUBGROUPS is defined by the host for OpenCL C 2.0 devices with cl_khr_subgroups)
+
+std::string Reduction_CL_code = R"(
+
+    #if defined(CL_AMPCOR_SUBGROUPS) && defined(cl_khr_subgroups)
+        #pragma OPENCL EXTENSION cl_khr_subgroups : enable
+        #define AMPCOR_USE_SUBGROUPS
+    #endif
+
+    // reduce (sum, sum square) over a work-group, the result is returned to all work-items
+    // scratch needs (at least) get_local_size(0) elements
+    // must be called by all work-items in the work-group
+    float2 work_group_reduce_sum2(float2 value, __local float2* scratch)
+    {
+        const int localIndex = get_local_id(0);
+    #ifdef AMPCOR_USE_SUBGROUPS
+        // reduce within each sub-group at first
+        value.x = sub_group_reduce_add(value.x);
+        value.y = sub_group_reduce_add(value.y);
+        if (get_sub_group_local_id() == 0)
+            scratch[get_sub_group_id()] = value;
+        int active = get_num_sub_groups();
+    #else
+        scratch[localIndex] = value;
+        int active = get_local_size(0);
+    #endif
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // tree reduction, active is not necessarily in power of 2
+        while (active > 1)
+        {
+            const int half = (active + 1) >> 1;
+            if (localIndex < active - half)
+                scratch[localIndex] += scratch[localIndex + half];
+            barrier(CLK_LOCAL_MEM_FENCE);
+            active = half;
+        }
+        const float2 result = scratch[0];
+        // scratch may be reused after return
+        barrier(CLK_LOCAL_MEM_FENCE);
+        return result;
+    }
+
+    // reduce (max value, location) over a work-group, ties go to the smaller location
+    // the result is returned to all work-items
+    // scratch_max/scratch_loc need (at least) get_local_size(0) elements
+    // must be called by all work-items in the work-group
+    void work_group_reduce_max_location(float* value, int* location,
+        __local float* scratch_max, __local int* scratch_loc)
+    {
+        const int localIndex = get_local_id(0);
+    #ifdef AMPCOR_USE_SUBGROUPS
+        // reduce within each sub-group at first
+        const float sub_max = sub_group_reduce_max(*value);
+        const int sub_loc = sub_group_reduce_min(*value == sub_max ? *location : INT_MAX);
+        if (get_sub_group_local_id() == 0) {
+            scratch_max[get_sub_group_id()] = sub_max;
+            scratch_loc[get_sub_group_id()] = sub_loc;
+        }
+        int active = get_num_sub_groups();
+    #else
+        scratch_max[localIndex] = *value;
+        scratch_loc[localIndex] = *location;
+        int active = get_local_size(0);
+    #endif
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // tree reduction, active is not necessarily in power of 2
+        while (active > 1)
+        {
+            const int half = (active + 1) >> 1;
+            if (localIndex < active - half)
+            {
+                const float other = scratch_max[localIndex + half];
+                const int other_loc = scratch_loc[localIndex + half];
+                if (other > scratch_max[localIndex]
+                    || (other == scratch_max[localIndex] && other_loc < scratch_loc[localIndex]))
+                {
+                    scratch_max[localIndex] = other;
+                    scratch_loc[localIndex] = other_loc;
+                }
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+            active = half;
+        }
+        *value = scratch_max[0];
+        *location = scratch_loc[0];
+        // scratch may be reused after return
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // work-efficient (Blelloch) exclusive prefix sum of n (in power of 2) elements in local memory
+    //  by a work-group of n/2 work-items; the total is returned to all work-items
+    // must be called by all work-items in the work-group
+    float2 work_group_exclusive_scan_sum2(__local float2* temp, const int n)
+    {
+        const int localIndex = get_local_id(0);
+
+        // up-sweep (reduce) phase
+        int offset = 1;
+        for (int d = n >> 1; d > 0; d >>= 1)
+        {
+            barrier(CLK_LOCAL_MEM_FENCE);
+            if (localIndex < d)
+            {
+                int i = offset*(2*localIndex+1)-1;
+                int j = offset*(2*localIndex+2)-1;
+                temp[j] += temp[i];
+            }
+            offset <<= 1;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        const float2 total = temp[n-1];
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (localIndex == 0)
+            temp[n-1] = (float2)(0.0f, 0.0f);
+
+        // down-sweep phase
+        for (int d = 1; d < n; d <<= 1)
+        {
+            offset >>= 1;
+            barrier(CLK_LOCAL_MEM_FENCE);
+            if (localIndex < d)
+            {
+                int i = offset*(2*localIndex+1)-1;
+                int j = offset*(2*localIndex+2)-1;
+                float2 t = temp[i];
+                temp[i] = temp[j];
+                temp[j] += t;
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        return total;
+    }
+
+    // first pass: partial max (real part) and its location over the region (width, height)
+    //  of each image in the batch, stored with (stride, batch_stride)
+    // this kernel is called with globalSize = {groups*localSize, batch}, localSize = {localSize, 1}
+    // each work-group writes partial_max/partial_loc[batch*groups + group]
+    __kernel void matrix_max_location_partial(
+        __global const float2* input,
+        __global float* partial_max,
+        __global int* partial_loc,
+        __local float* scratch_max,
+        __local int* scratch_loc,
+        const int width, const int height,
+        const int stride, const int batch_stride)
+    {
+        const int batch = get_global_id(1);
+        const int groups = get_num_groups(0);
+
+        input += batch*batch_stride;
+
+        float max_value = -FLT_MAX;
+        int max_loc = 0;
+        for (int id = get_global_id(0); id < width*height; id += get_global_size(0))
+        {
+            const int row = id / width;
+            const int col = id - row*width;
+            const float val = input[mad24(row, stride, col)].x;
+            if (val > max_value) {
+                max_value = val;
+                max_loc = id;
+            }
+        }
+        work_group_reduce_max_location(&max_value, &max_loc, scratch_max, scratch_loc);
+        if (get_local_id(0) == 0) {
+            const int index = mad24(batch, groups, (int)get_group_id(0));
+            partial_max[index] = max_value;
+            partial_loc[index] = max_loc;
+        }
+    }
+
+    // second pass: reduce the partial max/location of each image in the batch
+    //  and return the location as (col, row)
+    // this kernel is called with globalSize = {localSize, batch}, localSize = {localSize, 1}
+    __kernel void matrix_max_location_finish(
+        __global const float* partial_max,
+        __global const int* partial_loc,
+        __global int2* maxloc,
+        __local float* scratch_max,
+        __local int* scratch_loc,
+        const int groups,
+        const int width)
+    {
+        const int batch = get_global_id(1);
+        partial_max += batch*groups;
+        partial_loc += batch*groups;
+
+        float max_value = -FLT_MAX;
+        int max_loc = 0;
+        for (int i = get_local_id(0); i < groups; i += get_local_size(0))
+        {
+            const float val = partial_max[i];
+            const int loc = partial_loc[i];
+            if (val > max_value || (val == max_value && loc < max_loc)) {
+                max_value = val;
+                max_loc = loc;
+            }
+        }
+        work_group_reduce_max_location(&max_value, &max_loc, scratch_max, scratch_loc);
+        if (get_local_id(0) == 0)
+            maxloc[batch] = (int2)(max_loc % width, max_loc / width); // (col, row)
+    }
+
+)";
+// end of file
@@ -0,0 +1,321 @@
+// OpenCL Window Kernels
+// gather windows from image strips and prepare them for correlation
+
+std::string Window_CL_code = R"(
+
+    // gather the pixel (col, row) of a window at origin from an image strip
+    // pixels outside the strip are returned as 0
+    __attribute__((always_inline))
+    float2 window_gather_pixel(__global const float2* strip,
+        const int strip_width, const int strip_height,
+        const int2 origin, const int col, const int row)
+    {
+        const int x = origin.x + col;
+        const int y = origin.y + row;
+        return (x >= 0 && x < strip_width && y >= 0 && y < strip_height)
+            ? strip[mad24(y, strip_width, x)] : (float2)(0.0f, 0.0f);
+    }
+
+    // amplitude of the pixel (col, row) of a window decimated by decimation,
+    //  averaged over decimation x decimation pixels of the strip
+    __attribute__((always_inline))
+    float window_gather_amplitude(__global const float2* strip,
+        const int strip_width, const int strip_height,
+        const int2 origin, const int col, const int row, const int decimation)
+    {
+        if (decimation == 1)
+            return length(window_gather_pixel(strip, strip_width, strip_height, origin, col, row));
+        float sum = 0.0f;
+        for (int j = 0; j < decimation; j++)
+            for (int i = 0; i < decimation; i++)
+                sum += length(window_gather_pixel(strip, strip_width, strip_height, origin,
+                    mad24(col, decimation, i), mad24(row, decimation, j)));
+        return sum/(float)(decimation*decimation);
+    }
+
+    // a window pixel for correlation and its contribution to the statistics
+    //  coherent = 0: the (decimated) amplitude, with (value, value^2)
+    //  coherent = 1: the complex value (decimation is ignored), with (0, |value|^2),
+    //    so that the normalization reduces to |C|/sqrt(sum|R|^2 sum|S|^2)
+    __attribute__((always_inline))
+    float2 window_gather_value(__global const float2* strip,
+        const int strip_width, const int strip_height,
+        const int2 origin, const int col, const int row, const int decimation,
+        const int coherent, float2* stat)
+    {
+        if (coherent) {
+            const float2 value = window_gather_pixel(strip, strip_width, strip_height, origin, col, row);
+            *stat = (float2)(0.0f, dot(value, value));
+            return value;
+        }
+        const float amplitude = window_gather_amplitude(strip, strip_width, strip_height,
+            origin, col, row, decimation);
+        *stat = (float2)(amplitude, amplitude*amplitude);
+        return (float2)(amplitude, 0.0f);
+    }
+
+    // gather complex windows (width, height) from an image strip and pad zeros to (p_width, p_height)
+    // origins are the (col, row) of the first pixel of each window in the strip
+    // this kernel is called with globalSize = {p_width, p_height, batch}
+    __kernel void window_gather_complex(
+        __global const float2* strip,
+        const int strip_width, const int strip_height,
+        __global const int2* origins,
+        __global float2* windows,
+        const int width, const int height)
+    {
+        const int col = get_global_id(0);
+        const int row = get_global_id(1);
+        const int batch = get_global_id(2);
+        const int p_width = get_global_size(0);
+        const int p_height = get_global_size(1);
+
+        windows += batch*p_width*p_height;
+        windows[mad24(row, p_width, col)] = (row < height && col < width)
+            ? window_gather_pixel(strip, strip_width, strip_height, origins[batch], col, row)
+            : (float2)(0.0f, 0.0f);
+    }
+
+    // gather reference windows (width, height) from an image strip, take amplitudes,
+    //  pad zeros to (p_width, p_height), and compute the sum and sum square of each window,
+    //  in one pass over the raw pixels
+    // origins are the (col, row) of the first pixel of each window in the strip
+    // with decimation > 1, each window pixel is the mean amplitude of decimation x decimation strip pixels
+    // with coherent = 1, the complex pixels are kept, see window_gather_value
+    // this kernel is called with globalSize = {localSize, batch}, localSize = {localSize, 1}
+    __kernel void window_gather_amplitude_sum2(
+        __global const float2* strip,
+        const int strip_width, const int strip_height,
+        __global const int2* origins,
+        __global float2* windows,
+        __global float2* sum2,
+        __local float2* scratch, // localSize
+        const int width, const int height,
+        const int p_width, const int p_height,
+        const int decimation, const int coherent)
+    {
+        const int batch = get_global_id(1);
+        const int2 origin = origins[batch];
+        windows += batch*p_width*p_height;
+
+        float2 sum = (float2)(0.0f, 0.0f);
+        for (int i = get_local_id(0); i < p_width*p_height; i += get_local_size(0))
+        {
+            const int row = i / p_width;
+            const int col = i - row*p_width;
+            float2 value = (float2)(0.0f, 0.0f);
+            if (row < height && col < width) {
+                float2 stat;
+                value = window_gather_value(strip, strip_width, strip_height, origin, col, row,
+                    decimation, coherent, &stat);
+                sum += stat;
+            }
+            windows[i] = value;
+        }
+        sum = work_group_reduce_sum2(sum, scratch);
+        if (get_local_id(0) == 0)
+            sum2[batch] = sum;
+    }
+
+    // gather search windows (width, height) from an image strip, take amplitudes,
+    //  pad zeros to (p_width, p_height), and compute the prefix sums along rows of the sum area
+    //  table of (value, value^2) of each window (width, height), in one pass over the raw pixels
+    // 1) each row is loaded by the work-group, scanned in local memory (Blelloch),
+    //    and written to both the window and the table
+    // 2) the prefix sums along columns are left to window_sat2_scan_columns
+    // decimation and coherent are the same as in window_gather_amplitude_sum2
+    // this kernel is called with globalSize = {localSize, batch}, localSize = {localSize, 1}
+    //  localSize in power of 2
+    __kernel void window_gather_amplitude_sat2(
+        __global const float2* strip,
+        const int strip_width, const int strip_height,
+        __global const int2* origins,
+        __global float2* windows,
+        __global float2* sat2,
+        __local float2* temp, // 2*localSize
+        const int width, const int height,
+        const int p_width, const int p_height,
+        const int decimation, const int coherent)
+    {
+        const int localIndex = get_local_id(0);
+        const int localSize = get_local_size(0);
+        const int n = localSize << 1;
+        const int batch = get_global_id(1);
+        const int2 origin = origins[batch];
+
+        windows += batch*p_width*p_height;
+        sat2 += batch*width*height;
+
+        const int ai = localIndex;
+        const int bi = localIndex + localSize;
+
+        // amplitudes and prefix sums along rows
+        for (int row = 0; row < p_height; row++)
+        {
+            __global float2* window_row = windows + row*p_width;
+            // zero-padded rows (uniform over the work-group)
+            if (row >= height) {
+                for (int col = localIndex; col < p_width; col += localSize)
+                    window_row[col] = (float2)(0.0f, 0.0f);
+                continue;
+            }
+
+            __global float2* sat_row = sat2 + row*width;
+            float2 carry = (float2)(0.0f, 0.0f);
+            for (int start = 0; start < p_width; start += n)
+            {
+                const int cola = start + ai;
+                const int colb = start + bi;
+                float2 a = (float2)(0.0f, 0.0f);
+                float2 b = (float2)(0.0f, 0.0f);
+                const float2 va = (cola < width) ? window_gather_value(strip, strip_width, strip_height,
+                    origin, cola, row, decimation, coherent, &a) : (float2)(0.0f, 0.0f);
+                const float2 vb = (colb < width) ? window_gather_value(strip, strip_width, strip_height,
+                    origin, colb, row, decimation, coherent, &b) : (float2)(0.0f, 0.0f);
+                if (cola < p_width)
+                    window_row[cola] = va;
+                if (colb < p_width)
+                    window_row[colb] = vb;
+
+                // prefix sum of the chunk
+                temp[ai] = a;
+                temp[bi] = b;
+                const float2 total = work_group_exclusive_scan_sum2(temp, n);
+                if (cola < width)
+                    sat_row[cola] = carry + temp[ai] + a;
+                if (colb < width)
+                    sat_row[colb] = carry + temp[bi] + b;
+                carry += total;
+            }
+        }
+    }
+
+    // prefix sums along the columns of the tables from window_gather_amplitude_sat2,
+    //  to complete the sum area tables (width, height)
+    // one work-group per column, scanned in chunks of 2*localSize with a carry (Blelloch)
+    // this kernel is called with globalSize = {localSize, width, batch}, localSize = {localSize, 1, 1}
+    //  localSize in power of 2
+    __kernel void window_sat2_scan_columns(
+        __global float2* sat2,
+        __local float2* temp, // 2*localSize
+        const int width, const int height)
+    {
+        const int localIndex = get_local_id(0);
+        const int n = get_local_size(0) << 1;
+        const int col = get_global_id(1);
+        const int batch = get_global_id(2);
+
+        sat2 += mad24(batch, width*height, col);
+
+        const int ai = localIndex;
+        const int bi = localIndex + (n >> 1);
+
+        float2 carry = (float2)(0.0f, 0.0f);
+        for (int start = 0; start < height; start += n)
+        {
+            const int rowa = start + ai;
+            const int rowb = start + bi;
+            const float2 a = (rowa < height) ? sat2[rowa*width] : (float2)(0.0f, 0.0f);
+            const float2 b = (rowb < height) ? sat2[rowb*width] : (float2)(0.0f, 0.0f);
+            temp[ai] = a;
+            temp[bi] = b;
+            const float2 total = work_group_exclusive_scan_sum2(temp, n);
+            if (rowa < height)
+                sat2[rowa*width] = carry + temp[ai] + a;
+            if (rowb < height)
+                sat2[rowb*width] = carry + temp[bi] + b;
+            carry += total;
+        }
+    }
+
+    // the statistics of the amplitudes of a window (width, height) at origin in an image strip:
+    //  (sum, sum square) of the amplitudes shifted by the amplitude of the first pixel, the number
+    //  of zero pixels and the sum square of the amplitudes, reduced over the work-group,
+    //  returned to all work-items
+    // the shift keeps the variance of bright, nearly uniform windows from cancelling out in float
+    // must be called by all work-items in the work-group
+    float4 window_statistics(__global const float2* strip,
+        const int strip_width, const int strip_height,
+        const int2 origin, const int width, const int height,
+        __local float2* scratch)
+    {
+        const float shift = length(window_gather_pixel(strip, strip_width, strip_height, origin, 0, 0));
+        float2 sum = (float2)(0.0f, 0.0f);
+        float2 zeros = (float2)(0.0f, 0.0f); // (zeros, sum square)
+        for (int i = get_local_id(0); i < width*height; i += get_local_size(0))
+        {
+            const int row = i / width;
+            const int col = i - row*width;
+            const float amplitude = length(window_gather_pixel(strip, strip_width, strip_height,
+                origin, col, row));
+            const float deviation = amplitude - shift;
+            sum += (float2)(deviation, deviation*deviation);
+            zeros += (float2)((amplitude == 0.0f) ? 1.0f : 0.0f, amplitude*amplitude);
+        }
+        sum = work_group_reduce_sum2(sum, scratch);
+        zeros = work_group_reduce_sum2(zeros, scratch);
+        return (float4)(sum.x, sum.y, zeros.x, zeros.y);
+    }
+
+    // a window has no data if its amplitudes have (nearly) zero variance
+    //  or more than max_zero_fraction of its pixels are zero
+    // n^2 variance = n sum (a-shift)^2 - (sum (a-shift))^2, relative to n sum a^2
+    __attribute__((always_inline))
+    int window_has_data(const float4 stat, const int size, const float max_zero_fraction)
+    {
+        const float n = (float)size;
+        const float variance = stat.y*n - stat.x*stat.x;
+        return (variance > 1.0e-5f*stat.w*n) && (stat.z <= max_zero_fraction*n);
+    }
+
+    // flag the windows with data, valid = 1, in both the reference (width, height)
+    //  and the search (search_width, search_height) windows
+    // this kernel is called with globalSize = {localSize, windows}, localSize = {localSize, 1}
+    __kernel void window_valid(
+        __global const float2* reference_strip,
+        const int reference_strip_width, const int reference_strip_height,
+        __global const int2* reference_origins,
+        __global const float2* secondary_strip,
+        const int secondary_strip_width, const int secondary_strip_height,
+        __global const int2* secondary_origins,
+        __global int* valid,
+        __local float2* scratch, // localSize
+        const int width, const int height,
+        const int search_width, const int search_height,
+        const float max_zero_fraction)
+    {
+        const int window = get_global_id(1);
+        const float4 reference = window_statistics(reference_strip,
+            reference_strip_width, reference_strip_height, reference_origins[window],
+            width, height, scratch);
+        const float4 secondary = window_statistics(secondary_strip,
+            secondary_strip_width, secondary_strip_height, secondary_origins[window],
+            search_width, search_height, scratch);
+        if (get_local_id(0) == 0)
+            valid[window] = window_has_data(reference, width*height, max_zero_fraction)
+                && window_has_data(secondary, search_width*search_height, max_zero_fraction);
+    }
+
+    // shift the window origins by the offsets found in a coarse (decimated) search
+    // a max location at lag L of the coarse correlation surface is a shift of L*decimation - half_range,
+    //  clamped to (-max_shift, max_shift) so that the fine search stays within the full search range
+    // origins_out = origins_in + max_shift + shift, the origins of the fine search windows,
+    //  with half range of (half_range - max_shift)
+    // this kernel is called with globalSize = {batch}
+    __kernel void window_origins_shift(
+        __global const int2* origins_in,
+        __global const int2* max_loc,
+        __global int2* origins_out,
+        __global int2* shifts,
+        const int decimation,
+        const int2 half_range,
+        const int2 max_shift)
+    {
+        const int batch = get_global_id(0);
+        const int2 shift = clamp(max_loc[batch]*decimation - half_range, -max_shift, max_shift);
+        origins_out[batch] = origins_in[batch] + max_shift + shift;
+        shifts[batch] = shift;
+    }
+
+)";
+// end of file
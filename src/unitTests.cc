@@ -1,29 +1,114 @@
 // shell command wrapper
+//
+// usage: clTests [gpu|cpu|all]
+//
+// Accuracy and performance of the kernels: each kernel is run over a sweep of sizes and checked
+//  against a double-precision CPU reference, FFT2D (and the FFT2D plans), correlation_direct and
+//  the ZoomOversampler by the relative rms error, the window gathers (windows, sums and sum area
+//  tables) by the max error, correlation_normalize_peak_zoom by the max error of the coefficients,
+//  the sub-pixel offsets and the covariance, and by the relative error of the snr,
+//  window_valid, the MaxLocationReduction, window_origins_shift, matrix_fft_padding
+//  and matrix_transpose exactly.
+// The kernel time (from the profiling events), the achieved bandwidth and GFLOP/s are reported
+//  next to the device peaks, measured with a buffer copy and a multiply-add loop.
+// The exit code is non-zero if any kernel fails its accuracy check.
 
 #include <iostream>
+#include <iomanip>
+#include <sstream>
 #include <vector>
+#include <complex>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <algorithm>
 #include <cmath>
 #include <random>
+#include <cstdlib>
 #include "clHelper.h"
 #include "clFFT2d.h"
 #include "clProgram.h"
+#include "clReduction.h"
+#include "clOversampler.h"
+
+// the tolerances, for float kernels (with native math functions) versus double references
+const double fftTolerance = 1.0e-4;       // relative rms error
+const double sumTolerance = 1.0e-5;       // max error relative to the max value
+const double satTolerance = 1.0e-4;       // max error relative to the max value, of the sum area tables
+const double normalizeTolerance = 2.0e-3; // max error of the correlation coefficients
+const double snrTolerance = 1.0e-2;       // relative error of the snr
+const double estimatorTolerance = 1.0e-3; // max error of the sub-pixel offsets (pixels) and of the covariance (relative)
+
+// runs, times and reports the tests
+struct Harness {
+    clHandle& handle;
+    cl::CommandQueue queue;
+    int repeats = 10;
+    double peakBandwidth = 0.0; // GB/s
+    double peakGflops = 0.0;
+    int failures = 0;
+
+    Harness(clHandle& handle_);
+    // ms per launch, from the profiling events
+    double time(cl::Kernel& kernel, const cl::NDRange& global, const cl::NDRange& local);
+    // ms per launch, from the host clock, for processors with several kernels
+    double time(const std::function<void()>& launch);
+    void header();
+    // one line of the report, and the accuracy check
+    void report(const std::string& kernel, const std::string& size,
+        const double error, const double tolerance,
+        const double ms, const double bytes, const double flops);
+};
 
 void deviceQuery(clHandle& handle);
-void fft2dTest(clHandle& handle);
+void peakTest(Harness& harness);
+void fft2dKernelTest(Harness& harness);
+void fft2dTest(Harness& harness);
+void gatherTest(Harness& harness);
+void windowValidTest(Harness& harness);
+void directTest(Harness& harness);
+void maxLocationTest(Harness& harness);
+void snrTest(Harness& harness);
+void peakZoomTest(Harness& harness);
+void zoomOversamplerTest(Harness& harness);
+void originsShiftTest(Harness& harness);
+void paddingTest(Harness& harness);
+void transposeTest(Harness& harness);
 
 
-int main() {
+int main(int argc, char* argv[]) {
 
     // ******* OpenCL initialization *********
     // initialize the opencl handles
-    clHandle handle(CL_DEVICE_TYPE_GPU);
+    const std::string device = argc > 1 ? argv[1] : "gpu";
+    clHandle handle(device == "cpu" ? CL_DEVICE_TYPE_CPU
+        : device == "all" ? CL_DEVICE_TYPE_ALL : CL_DEVICE_TYPE_GPU);
     // build the kernel program
     handle.program = cl::Ampcor::Program(handle.context);
 
     // run tests
     deviceQuery(handle);
-    fft2dTest(handle);
+    Harness harness(handle);
+    peakTest(harness);
+    fft2dKernelTest(harness);
+    fft2dTest(harness);
+    gatherTest(harness);
+    windowValidTest(harness);
+    directTest(harness);
+    maxLocationTest(harness);
+    snrTest(harness);
+    peakZoomTest(harness);
+    zoomOversamplerTest(harness);
+    originsShiftTest(harness);
+    paddingTest(harness);
+    transposeTest(harness);
+
     // all done
+    if (harness.failures > 0) {
+        std::cout << harness.failures << " accuracy checks failed \n";
+        return EXIT_FAILURE;
+    }
+    std::cout << "All accuracy checks passed \n";
     return 0;
 }
 
@@ -53,73 +138,1189 @@ void deviceQuery(clHandle& handle)
     std::cout << std::endl;
 }
 
-void fft2dTest(clHandle& handle)
+Harness::Harness(clHandle& handle_) :
+    handle(handle_), queue(handle_.context, handle_.device, CL_QUEUE_PROFILING_ENABLE)
 {
-    std::cout << "Testing FFT2D ......\n";
+}
 
-    // get references for cl handles
-    cl::Context& context = handle.context;
-    cl::Device& device = handle.device;
-    cl::Program& program = handle.program;
-
-    // create a command queue
-    cl::CommandQueue queue(context, device);
-
-    // Create input and output vectors
-    const int width = 8;
-    const int height = 4;
-    const size_t nsize = sizeof(cl_float2)*width*height;
-
-    // Create OpenCL device buffers for the input and output vectors
-    cl::Buffer bufferA(context, CL_MEM_READ_WRITE, nsize);
-
-    // initialize and set values on host
-    std::vector<cl_float2> A(width*height);
-    for (int i = 0; i < height; i++) {
-        for(int j=0; j < width; j++)
-        {
-            int id = i*width +j;
-            A[id].x =   (float)j/width;
-            A[id].y = 0.0f;
-        }
-    }
-
-    // create the FFT2d plan
-    cl::FFT::FFT2DPlan fft2d(handle, width, height, bufferA,
-        CL_FFT_FORWARD);
-    cl::FFT::FFT2DPlan ifft2d(handle, width, height, bufferA,
-        CL_FFT_INVERSE);
-
-    // copy data to device
-    CL_CHECK_ERROR(queue.enqueueWriteBuffer(bufferA, CL_TRUE, 0, nsize, A.data()));
-    // fft
-    fft2d.execute(queue);
-    // check results
-    buffer_print<cl_float2>(queue, bufferA, width, height, "after fft" );
-
-    // inverse fft
-    ifft2d.execute(queue);
-    // check results
-    buffer_print<cl_float2>(queue, bufferA, width, height, "after ifft" );
-
-    std::random_device rd;
-    std::mt19937 engine(rd());
-    std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
-    // change the values to matrix
-    for (auto& ai : A) {
-        ai.x = distribution(engine);
-        ai.y = 0.0f;
-    }
-    // repeat fft
-    CL_CHECK_ERROR(queue.enqueueWriteBuffer(bufferA, CL_TRUE, 0, nsize, A.data()));
-    buffer_print<cl_float2>(queue, bufferA, width, height, "a new random matrix" );
-    fft2d.execute(queue);
-    buffer_print<cl_float2>(queue, bufferA, width, height, "after fft w/ new matrix" );
-    // inverse fft
-    ifft2d.execute(queue);
-    // check results
-    buffer_print<cl_float2>(queue, bufferA, width, height, "after ifft (not normalized)" );
-    // all done
+void Harness::header()
+{
+    std::cout << std::left << std::setw(24) << "kernel" << std::setw(22) << "size" << std::right
+        << std::setw(12) << "error" << std::setw(12) << "tolerance" << std::setw(8) << "result"
+        << std::setw(12) << "time(ms)" << std::setw(18) << "GB/s (peak %)"
+        << std::setw(20) << "GFLOP/s (peak %)" << "\n";
+}
 
-    queue.finish();
+double Harness::time(cl::Kernel& kernel, const cl::NDRange& global, const cl::NDRange& local)
+{
+    // warm up
+    CL_CHECK_ERROR(queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, local));
+    std::vector<cl::Event> events(repeats);
+    for (auto& event : events)
+        CL_CHECK_ERROR(queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, local, nullptr, &event));
+    CL_CHECK_ERROR(queue.finish());
+    double ns = 0.0;
+    for (auto& event : events)
+        ns += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    return ns*1.0e-6/repeats;
 }
+
+double Harness::time(const std::function<void()>& launch)
+{
+    launch();
+    CL_CHECK_ERROR(queue.finish());
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++)
+        launch();
+    CL_CHECK_ERROR(queue.finish());
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()/repeats;
+}
+
+void Harness::report(const std::string& kernel, const std::string& size,
+    const double error, const double tolerance,
+    const double ms, const double bytes, const double flops)
+{
+    // nan errors fail
+    const bool passed = error <= tolerance;
+    if (!passed)
+        failures++;
+    const double gbps = bytes/ms*1.0e-6;
+    const double gflops = flops/ms*1.0e-6;
+    std::ostringstream bandwidth, compute;
+    bandwidth << std::fixed << std::setprecision(1) << gbps << " (" << std::setprecision(0)
+        << (peakBandwidth > 0.0 ? 100.0*gbps/peakBandwidth : 0.0) << "%)";
+    compute << std::fixed << std::setprecision(1) << gflops << " (" << std::setprecision(0)
+        << (peakGflops > 0.0 ? 100.0*gflops/peakGflops : 0.0) << "%)";
+    std::cout << std::left << std::setw(24) << kernel << std::setw(22) << size << std::right
+        << std::scientific << std::setprecision(2) << std::setw(12) << error << std::setw(12) << tolerance
+        << std::setw(8) << (passed ? "pass" : "FAIL")
+        << std::fixed << std::setprecision(4) << std::setw(12) << ms
+        << std::setw(18) << bandwidth.str() << std::setw(20) << compute.str() << "\n"
+        << std::defaultfloat;
+}
+
+namespace {
+    // deterministic inputs
+    std::mt19937 engine(20231001);
+
+    std::vector<cl_float2> randomMatrix(const size_t n, const float low, const float high)
+    {
+        std::uniform_real_distribution<float> distribution(low, high);
+        std::vector<cl_float2> matrix(n);
+        for (auto& value : matrix)
+            value = make_float2(distribution(engine), distribution(engine));
+        return matrix;
+    }
+
+    std::string sizeString(const int width, const int height, const int batch = 1)
+    {
+        return std::to_string(width) + "x" + std::to_string(height)
+            + (batch > 1 ? "x" + std::to_string(batch) : "");
+    }
+
+    // in-place radix-2 FFT in double, exp(-i 2 pi jk/N) for direction = 1
+    void fftReference(std::complex<double>* data, const int length, const int stride, const int direction)
+    {
+        for (int i = 1, j = 0; i < length; i++) {
+            int bit = length >> 1;
+            for (; j & bit; bit >>= 1)
+                j ^= bit;
+            j ^= bit;
+            if (i < j)
+                std::swap(data[i*stride], data[j*stride]);
+        }
+        for (int m = 2; m <= length; m <<= 1) {
+            const std::complex<double> wm = std::polar(1.0, -direction*2.0*M_PI/m);
+            for (int k = 0; k < length; k += m) {
+                std::complex<double> w = 1.0;
+                for (int j = 0; j < m/2; j++) {
+                    const std::complex<double> t = w*data[(k+j+m/2)*stride];
+                    data[(k+j+m/2)*stride] = data[(k+j)*stride] - t;
+                    data[(k+j)*stride] += t;
+                    w *= wm;
+                }
+            }
+        }
+    }
+
+    // relative rms error of a float result versus the double reference
+    double relativeError(const std::vector<cl_float2>& result, const std::vector<std::complex<double>>& reference)
+    {
+        double error2 = 0.0, norm2 = 0.0;
+        for (size_t i = 0; i < result.size(); i++) {
+            error2 += std::norm(std::complex<double>(result[i].x, result[i].y) - reference[i]);
+            norm2 += std::norm(reference[i]);
+        }
+        return std::sqrt(error2/norm2);
+    }
+
+    std::vector<std::complex<double>> toDouble(const std::vector<cl_float2>& matrix)
+    {
+        std::vector<std::complex<double>> result(matrix.size());
+        for (size_t i = 0; i < matrix.size(); i++)
+            result[i] = std::complex<double>(matrix[i].x, matrix[i].y);
+        return result;
+    }
+
+    // max error of the real and imaginary parts, each relative to its max in the reference
+    //  (absolute if that is 0), infinite for non-finite results
+    double maxRelativeError(const std::vector<cl_float2>& result, const std::vector<std::complex<double>>& reference)
+    {
+        double maxx = 0.0, maxy = 0.0, errorx = 0.0, errory = 0.0;
+        for (size_t i = 0; i < result.size(); i++) {
+            if (!std::isfinite(result[i].x) || !std::isfinite(result[i].y))
+                return INFINITY;
+            maxx = std::max(maxx, std::fabs(reference[i].real()));
+            maxy = std::max(maxy, std::fabs(reference[i].imag()));
+            errorx = std::max(errorx, std::fabs(result[i].x - reference[i].real()));
+            errory = std::max(errory, std::fabs(result[i].y - reference[i].imag()));
+        }
+        return std::max(maxx > 0.0 ? errorx/maxx : errorx, maxy > 0.0 ? errory/maxy : errory);
+    }
+
+    // band-limited interpolation of a line of n samples (with stride) to outSize points (with outStride),
+    //  at t = n/2 + (m - outSize/2)/factor, or m/factor if not centered: the dft of the line over
+    //  the frequencies [-n/2, n - n/2), evaluated at t, un-normalized as by the inverse fft
+    void bandInterpolation(const std::complex<double>* in, const int n, const int stride,
+        std::complex<double>* out, const int outSize, const int outStride, const int factor, const bool centered)
+    {
+        std::vector<std::complex<double>> spectrum(n, 0.0);
+        for (int k = 0; k < n; k++)
+            for (int j = 0; j < n; j++)
+                spectrum[k] += in[j*stride]*std::polar(1.0, -2.0*M_PI*k*j/n);
+        for (int m = 0; m < outSize; m++) {
+            const double t = centered ? n/2 + static_cast<double>(m - outSize/2)/factor : static_cast<double>(m)/factor;
+            std::complex<double> value = 0.0;
+            for (int k = -n/2; k < n - n/2; k++)
+                value += spectrum[(k + n) % n]*std::polar(1.0, 2.0*M_PI*k*t/n);
+            out[m*outStride] = value;
+        }
+    }
+
+    // the work-group size for a kernel, limited to the device, in power of 2
+    int groupSize(Harness& harness, cl::Kernel& kernel, const int n)
+    {
+        size_t maxwg;
+        CL_CHECK_ERROR(kernel.getWorkGroupInfo(harness.handle.device, CL_KERNEL_WORK_GROUP_SIZE, &maxwg));
+        return static_cast<int>(std::min(prev_power_of_2(maxwg), prev_power_of_2(static_cast<size_t>(std::max(n, 1)))));
+    }
+
+    // a batch of windows to correlate, as the gather kernels prepare them: the search windows
+    //  (amplitudes), the reference windows cut from them at a random lag with noise, the reference
+    //  (sum, sum square), the search sum area tables of (value, value^2), and the correlation surfaces,
+    //  scaled as by the un-normalized fft, with the correlation coefficients in double
+    // with smoothing > 1, the search windows are averaged over smoothing x smoothing pixels and the
+    //  reference windows are cut at a sub-pixel lag (bilinear), for a smooth peak off the integer lags
+    struct CorrelationCase {
+        int window, search, region, storage, batch;
+        std::vector<cl_float2> searchWindows;
+        std::vector<double> referenceWindows;
+        std::vector<cl_float2> referenceSums, searchSats, surface;
+        std::vector<double> coefficients; // region x region per window
+    };
+
+    CorrelationCase correlationCase(const int window, const int halfRange, const int batch,
+        const int smoothing = 1)
+    {
+        CorrelationCase c;
+        c.window = window;
+        c.search = window + 2*halfRange;
+        c.region = 2*halfRange + 1;
+        c.storage = next_power_of_2(c.search);
+        c.batch = batch;
+        const int search = c.search, region = c.region, storage = c.storage;
+        const size_t windowSize = static_cast<size_t>(window)*window;
+        const size_t searchSize = static_cast<size_t>(search)*search;
+        const size_t storageSize = static_cast<size_t>(storage)*storage;
+
+        c.searchWindows = randomMatrix(searchSize*batch, 0.0f, 1.0f);
+        if (smoothing > 1) {
+            const std::vector<cl_float2> raw = c.searchWindows;
+            for (int b = 0; b < batch; b++)
+                for (int y = 0; y < search; y++)
+                    for (int x = 0; x < search; x++) {
+                        double mean = 0.0;
+                        for (int j = 0; j < smoothing; j++)
+                            for (int i = 0; i < smoothing; i++)
+                                mean += raw[b*searchSize + ((y+j) % search)*search + (x+i) % search].x;
+                        c.searchWindows[b*searchSize + y*search + x].x = mean/(smoothing*smoothing);
+                    }
+        }
+        const std::vector<cl_float2> noise = randomMatrix(windowSize*batch, 0.0f, 0.2f);
+        c.referenceWindows.resize(windowSize*batch);
+        c.referenceSums.resize(batch);
+        c.searchSats.resize(searchSize*batch);
+        c.surface.assign(storageSize*batch, make_float2(0.0f, 0.0f));
+        c.coefficients.resize(static_cast<size_t>(region)*region*batch);
+        std::uniform_int_distribution<int> lag(0, smoothing > 1 ? region-2 : region-1);
+        std::uniform_real_distribution<double> fraction(0.0, 1.0);
+        for (int b = 0; b < batch; b++) {
+            const cl_float2* s = c.searchWindows.data() + b*searchSize;
+            double* r = c.referenceWindows.data() + b*windowSize;
+            const int lagx = lag(engine), lagy = lag(engine);
+            const double fx = smoothing > 1 ? fraction(engine) : 0.0;
+            const double fy = smoothing > 1 ? fraction(engine) : 0.0;
+            double sum = 0.0, sum2 = 0.0;
+            for (int y = 0; y < window; y++)
+                for (int x = 0; x < window; x++) {
+                    // the neighbours at +1 are only read for a fraction > 0, within the search window
+                    const cl_float2* p = s + (y+lagy)*search + x+lagx;
+                    const double top = (1.0-fx)*p[0].x + (fx > 0.0 ? fx*p[1].x : 0.0);
+                    const double bottom = fy > 0.0 ? (1.0-fx)*p[search].x + (fx > 0.0 ? fx*p[search+1].x : 0.0) : 0.0;
+                    const double value = (1.0-fy)*top + fy*bottom + noise[b*windowSize + y*window + x].x;
+                    r[y*window + x] = value;
+                    sum += value;
+                    sum2 += value*value;
+                }
+            c.referenceSums[b] = make_float2(sum, sum2);
+            // sum area table of the search window
+            for (int y = 0; y < search; y++) {
+                double rowSum = 0.0, rowSum2 = 0.0;
+                for (int x = 0; x < search; x++) {
+                    const double value = s[y*search + x].x;
+                    rowSum += value;
+                    rowSum2 += value*value;
+                    cl_float2& sat = c.searchSats[b*searchSize + y*search + x];
+                    const cl_float2 above = y > 0 ? c.searchSats[b*searchSize + (y-1)*search + x] : make_float2(0.0f, 0.0f);
+                    sat = make_float2(rowSum + above.x, rowSum2 + above.y);
+                }
+            }
+            // the correlation, scaled as by the un-normalized fft, and the coefficients
+            for (int ly = 0; ly < region; ly++)
+                for (int lx = 0; lx < region; lx++) {
+                    double correlation = 0.0, searchSum = 0.0, searchSum2 = 0.0;
+                    for (int y = 0; y < window; y++)
+                        for (int x = 0; x < window; x++) {
+                            const double value = s[(y+ly)*search + x+lx].x;
+                            correlation += r[y*window + x]*value;
+                            searchSum += value;
+                            searchSum2 += value*value;
+                        }
+                    c.surface[b*storageSize + ly*storage + lx].x = correlation*storageSize;
+                    const double n = static_cast<double>(windowSize);
+                    c.coefficients[(b*region + ly)*region + lx] = (correlation - sum*searchSum/n)
+                        /std::sqrt((sum2 - sum*sum/n)*(searchSum2 - searchSum*searchSum/n));
+                }
+        }
+        return c;
+    }
+
+    // the outputs of correlation_normalize_peak_zoom, and the kernel time
+    struct PeakZoom {
+        std::vector<cl_int2> maxLoc;
+        std::vector<cl_float2> zoom, subpixel;
+        std::vector<cl_float> snr, cov;
+        double ms;
+    };
+
+    // the peak search of the pipeline, with a zoom window (zoomSize x zoomSize) centered at the peak
+    PeakZoom peakZoom(Harness& harness, const CorrelationCase& c, const int zoomSize,
+        const int estimator, const int factor, const int statHalf)
+    {
+        cl::Context& context = harness.handle.context;
+        const int batch = c.batch;
+        cl::Buffer surfaceBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            c.surface.size()*sizeof(cl_float2), const_cast<cl_float2*>(c.surface.data()));
+        cl::Buffer sumBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            c.referenceSums.size()*sizeof(cl_float2), const_cast<cl_float2*>(c.referenceSums.data()));
+        cl::Buffer satBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            c.searchSats.size()*sizeof(cl_float2), const_cast<cl_float2*>(c.searchSats.data()));
+        cl::Buffer maxLocBuffer(context, CL_MEM_WRITE_ONLY, batch*sizeof(cl_int2));
+        cl::Buffer zoomBuffer(context, CL_MEM_WRITE_ONLY, batch*zoomSize*zoomSize*sizeof(cl_float2));
+        cl::Buffer subpixelBuffer(context, CL_MEM_WRITE_ONLY, batch*sizeof(cl_float2));
+        cl::Buffer snrBuffer(context, CL_MEM_WRITE_ONLY, batch*sizeof(cl_float));
+        cl::Buffer covBuffer(context, CL_MEM_WRITE_ONLY, 3*batch*sizeof(cl_float));
+
+        cl::Kernel kernel(harness.handle.program, "correlation_normalize_peak_zoom");
+        const int local = groupSize(harness, kernel, c.region*c.region);
+        int argIndex = 0;
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, surfaceBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, sumBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, satBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, maxLocBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, zoomBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, subpixelBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, cl::Local(local*sizeof(cl_float))));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, cl::Local(local*sizeof(cl_int))));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, cl::Local(zoomSize*zoomSize*sizeof(cl_float))));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, cl::Local(local*sizeof(cl_float2))));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, snrBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, covBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, c.region));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, c.region));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, c.storage));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, c.storage));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, c.window));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, c.window));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, c.search));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, c.search));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, zoomSize));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, zoomSize));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, -zoomSize/2));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, -zoomSize/2));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, estimator));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, factor));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, 0)); // amplitudes
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, statHalf));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, 1.0f));
+        const cl::NDRange global(local, batch), localRange(local, 1);
+        CL_CHECK_ERROR(harness.queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, localRange));
+
+        PeakZoom result;
+        result.maxLoc.resize(batch);
+        result.zoom.resize(static_cast<size_t>(batch)*zoomSize*zoomSize);
+        result.subpixel.resize(batch);
+        result.snr.resize(batch);
+        result.cov.resize(3*batch);
+        CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(maxLocBuffer, CL_TRUE, 0, batch*sizeof(cl_int2), result.maxLoc.data()));
+        CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(zoomBuffer, CL_TRUE, 0,
+            result.zoom.size()*sizeof(cl_float2), result.zoom.data()));
+        CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(subpixelBuffer, CL_TRUE, 0, batch*sizeof(cl_float2), result.subpixel.data()));
+        CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(snrBuffer, CL_TRUE, 0, batch*sizeof(cl_float), result.snr.data()));
+        CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(covBuffer, CL_TRUE, 0, 3*batch*sizeof(cl_float), result.cov.data()));
+        result.ms = harness.time(kernel, global, localRange);
+        return result;
+    }
+}
+
+void peakTest(Harness& harness)
+{
+    cl::Context& context = harness.handle.context;
+    // bandwidth, a device-to-device copy
+    const size_t bytes = 64 << 20;
+    cl::Buffer source(context, CL_MEM_READ_WRITE, bytes);
+    cl::Buffer target(context, CL_MEM_READ_WRITE, bytes);
+    CL_CHECK_ERROR(harness.queue.enqueueFillBuffer(source, 0.0f, 0, bytes));
+    double ns = 0.0;
+    for (int i = 0; i <= harness.repeats; i++) {
+        cl::Event event;
+        CL_CHECK_ERROR(harness.queue.enqueueCopyBuffer(source, target, 0, 0, bytes, nullptr, &event));
+        CL_CHECK_ERROR(event.wait());
+        // the first copy is a warm-up
+        if (i > 0)
+            ns += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    }
+    harness.peakBandwidth = 2.0*bytes*harness.repeats/ns;
+
+    // compute, independent chains of multiply-adds
+    const std::string source_code = R"(
+    __kernel void peak_mad(__global float* output, const float a, const float b)
+    {
+        float x0 = get_global_id(0), x1 = x0 + 1.0f, x2 = x0 + 2.0f, x3 = x0 + 3.0f;
+        float x4 = x0 + 4.0f, x5 = x0 + 5.0f, x6 = x0 + 6.0f, x7 = x0 + 7.0f;
+        for (int i = 0; i < 128; i++) {
+            x0 = mad(x0, a, b); x1 = mad(x1, a, b); x2 = mad(x2, a, b); x3 = mad(x3, a, b);
+            x4 = mad(x4, a, b); x5 = mad(x5, a, b); x6 = mad(x6, a, b); x7 = mad(x7, a, b);
+        }
+        output[get_global_id(0)] = x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7;
+    }
+    )";
+    cl::Program program(context, source_code);
+    try {
+        program.build({harness.handle.device});
+    } catch (const cl::Error& e) {
+        std::cerr << "Failed to build the peak kernel: "
+            << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(harness.handle.device) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const int n = 1 << 20;
+    cl::Buffer output(context, CL_MEM_WRITE_ONLY, n*sizeof(cl_float));
+    cl::Kernel kernel(program, "peak_mad");
+    CL_CHECK_ERROR(kernel.setArg(0, output));
+    CL_CHECK_ERROR(kernel.setArg(1, 0.999f));
+    CL_CHECK_ERROR(kernel.setArg(2, 0.001f));
+    const double ms = harness.time(kernel, cl::NDRange(n), cl::NullRange);
+    harness.peakGflops = 2.0*8*128*n/ms*1.0e-6;
+
+    std::cout << "Measured peaks: " << std::fixed << std::setprecision(1)
+        << harness.peakBandwidth << " GB/s (copy), " << harness.peakGflops << " GFLOP/s (mad) \n"
+        << std::defaultfloat;
+    harness.header();
+}
+
+// the FFT2D kernel, along rows and along columns of a batch of lines
+void fft2dKernelTest(Harness& harness)
+{
+    cl::Context& context = harness.handle.context;
+    const size_t localMemory = harness.handle.device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+    // about 1M elements per test
+    for (int length = 4; length <= 4096; length <<= 1) {
+        if (length*sizeof(cl_float2) > localMemory)
+            break;
+        const int lines = std::max(1, (1 << 20)/length);
+        for (const int stride : {1, lines}) {
+            const int direction = (stride == 1) ? CL_FFT_FORWARD : CL_FFT_INVERSE;
+            std::vector<cl_float2> matrix = randomMatrix(static_cast<size_t>(length)*lines, -1.0f, 1.0f);
+            std::vector<std::complex<double>> reference = toDouble(matrix);
+            for (int line = 0; line < lines; line++)
+                if (stride == 1)
+                    fftReference(reference.data() + static_cast<size_t>(line)*length, length, 1, direction);
+                else
+                    fftReference(reference.data() + line, length, lines, direction);
+
+            const size_t bytes = matrix.size()*sizeof(cl_float2);
+            cl::Buffer buffer(context, CL_MEM_READ_WRITE, bytes);
+            CL_CHECK_ERROR(harness.queue.enqueueWriteBuffer(buffer, CL_TRUE, 0, bytes, matrix.data()));
+            cl::Kernel kernel(harness.handle.program, "FFT2D");
+            CL_CHECK_ERROR(kernel.setArg(0, direction));
+            CL_CHECK_ERROR(kernel.setArg(1, length));
+            CL_CHECK_ERROR(kernel.setArg(2, static_cast<cl_int>(std::log2(length))));
+            CL_CHECK_ERROR(kernel.setArg(3, stride));
+            CL_CHECK_ERROR(kernel.setArg(4, buffer));
+            CL_CHECK_ERROR(kernel.setArg(5, cl::Local(length*sizeof(cl_float2))));
+            const int local = groupSize(harness, kernel, length/2);
+            const cl::NDRange global(local, lines), localRange(local, 1);
+            CL_CHECK_ERROR(harness.queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, localRange));
+            CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(buffer, CL_TRUE, 0, bytes, matrix.data()));
+
+            const double ms = harness.time(kernel, global, localRange);
+            harness.report("FFT2D", std::to_string(length) + (stride == 1 ? " row x" : " col x") + std::to_string(lines),
+                relativeError(matrix, reference), fftTolerance,
+                ms, 2.0*bytes, 5.0*length*std::log2(length)*lines);
+        }
+    }
+}
+
+// the FFT2D plans (codelets for the short lengths, FFT2D otherwise), forward and inverse
+void fft2dTest(Harness& harness)
+{
+    cl::Context& context = harness.handle.context;
+    const std::vector<std::pair<int, int>> shapes = {{8, 4}, {32, 32}, {64, 64}, {128, 64},
+        {64, 256}, {256, 256}, {512, 512}, {1024, 1024}};
+    for (const auto& shape : shapes) {
+        const int width = shape.first;
+        const int height = shape.second;
+        const int batch = std::max(1, (1 << 20)/(width*height));
+        std::vector<cl_float2> matrix = randomMatrix(static_cast<size_t>(width)*height*batch, -1.0f, 1.0f);
+        const std::vector<std::complex<double>> input = toDouble(matrix);
+        std::vector<std::complex<double>> reference = input;
+        for (int b = 0; b < batch; b++) {
+            std::complex<double>* data = reference.data() + static_cast<size_t>(b)*width*height;
+            for (int row = 0; row < height; row++)
+                fftReference(data + row*width, width, 1, CL_FFT_FORWARD);
+            for (int col = 0; col < width; col++)
+                fftReference(data + col, height, width, CL_FFT_FORWARD);
+        }
+
+        const size_t bytes = matrix.size()*sizeof(cl_float2);
+        cl::Buffer buffer(context, CL_MEM_READ_WRITE, bytes);
+        cl::FFT::FFT2DPlan fft2d(harness.handle, width, height, buffer, CL_FFT_FORWARD, batch);
+        cl::FFT::FFT2DPlan ifft2d(harness.handle, width, height, buffer, CL_FFT_INVERSE, batch);
+        const double flops = 5.0*width*height*std::log2(width*height)*batch;
+
+        // forward
+        CL_CHECK_ERROR(harness.queue.enqueueWriteBuffer(buffer, CL_TRUE, 0, bytes, matrix.data()));
+        fft2d.execute(harness.queue);
+        CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(buffer, CL_TRUE, 0, bytes, matrix.data()));
+        const double forwardError = relativeError(matrix, reference);
+
+        // inverse, back to the input (not normalized)
+        ifft2d.execute(harness.queue);
+        CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(buffer, CL_TRUE, 0, bytes, matrix.data()));
+        for (size_t i = 0; i < input.size(); i++)
+            reference[i] = input[i]*static_cast<double>(width*height);
+        const double inverseError = relativeError(matrix, reference);
+
+        harness.report("FFT2DPlan forward", sizeString(width, height, batch), forwardError, fftTolerance,
+            harness.time([&]() { fft2d.execute(harness.queue); }), 4.0*bytes, flops);
+        harness.report("FFT2DPlan inverse", sizeString(width, height, batch), inverseError, fftTolerance,
+            harness.time([&]() { ifft2d.execute(harness.queue); }), 4.0*bytes, flops);
+    }
+}
+
+// the fused gather of the windows from an image strip: the (decimated) amplitudes, or the complex values
+//  for coherent correlation, zero-padded, with the (sum, sum square) of the reference windows and the
+//  sum area tables of the search windows; the rows (in the gather) and the columns of the tables are
+//  scanned in chunks of 2*localSize with a carry, which the small work-groups exercise
+void gatherTest(Harness& harness)
+{
+    cl::Context& context = harness.handle.context;
+    struct Case { int width, height, decimation, coherent, local; };
+    const std::vector<Case> cases = {{64, 64, 1, 0, 32}, {100, 60, 1, 0, 16}, {72, 40, 2, 0, 8},
+        {48, 48, 1, 1, 4}, {300, 20, 1, 0, 64}};
+    const int batch = 8;
+    const int margin = 8;
+    for (const auto& k : cases) {
+        const int stripWidth = k.width*k.decimation + 2*margin;
+        const int stripHeight = k.height*k.decimation + 2*margin;
+        const int pWidth = next_power_of_2(k.width);
+        const int pHeight = next_power_of_2(k.height);
+        const std::vector<cl_float2> strip = randomMatrix(static_cast<size_t>(stripWidth)*stripHeight, -1.0f, 1.0f);
+        // some windows are partly outside the strip, where the pixels are 0
+        std::uniform_int_distribution<int> offset(-margin, 3*margin);
+        std::vector<cl_int2> origins(batch);
+        for (auto& origin : origins)
+            origin = make_int2(offset(engine), offset(engine));
+
+        // the padded windows, the (value, value^2) of each pixel, their sums and sum area tables
+        const size_t windowSize = static_cast<size_t>(k.width)*k.height;
+        std::vector<std::complex<double>> windows(static_cast<size_t>(pWidth)*pHeight*batch, 0.0);
+        std::vector<std::complex<double>> stats(windowSize*batch), sums(batch, 0.0), sats(windowSize*batch);
+        for (int b = 0; b < batch; b++) {
+            auto pixel = [&](const int col, const int row) {
+                const int x = origins[b].x + col;
+                const int y = origins[b].y + row;
+                return (x >= 0 && x < stripWidth && y >= 0 && y < stripHeight)
+                    ? std::complex<double>(strip[y*stripWidth + x].x, strip[y*stripWidth + x].y)
+                    : std::complex<double>(0.0, 0.0);
+            };
+            for (int row = 0; row < k.height; row++)
+                for (int col = 0; col < k.width; col++) {
+                    std::complex<double>& value = windows[(static_cast<size_t>(b)*pHeight + row)*pWidth + col];
+                    const size_t i = b*windowSize + row*k.width + col;
+                    if (k.coherent) {
+                        value = pixel(col, row);
+                        stats[i] = std::complex<double>(0.0, std::norm(value));
+                    }
+                    else {
+                        double amplitude = 0.0;
+                        for (int j = 0; j < k.decimation; j++)
+                            for (int l = 0; l < k.decimation; l++)
+                                amplitude += std::abs(pixel(col*k.decimation + l, row*k.decimation + j));
+                        amplitude /= k.decimation*k.decimation;
+                        value = amplitude;
+                        stats[i] = std::complex<double>(amplitude, amplitude*amplitude);
+                    }
+                    sums[b] += stats[i];
+                    sats[i] = stats[i] + (col > 0 ? sats[i-1] : 0.0) + (row > 0 ? sats[i-k.width] : 0.0)
+                        - (col > 0 && row > 0 ? sats[i-k.width-1] : 0.0);
+                }
+        }
+
+        cl::Buffer stripBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            strip.size()*sizeof(cl_float2), const_cast<cl_float2*>(strip.data()));
+        cl::Buffer originBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            origins.size()*sizeof(cl_int2), origins.data());
+        cl::Buffer windowBuffer(context, CL_MEM_READ_WRITE, windows.size()*sizeof(cl_float2));
+        for (const bool table : {false, true}) {
+            const std::vector<std::complex<double>>& reference = table ? sats : sums;
+            cl::Buffer statBuffer(context, CL_MEM_WRITE_ONLY, reference.size()*sizeof(cl_float2));
+            // not initialized, the kernels write all elements of the padded windows
+            CL_CHECK_ERROR(harness.queue.enqueueFillBuffer(windowBuffer, make_float2(NAN, NAN), 0,
+                windows.size()*sizeof(cl_float2)));
+            cl::Kernel kernel(harness.handle.program, table ? "window_gather_amplitude_sat2" : "window_gather_amplitude_sum2");
+            // as the pipeline, but the search windows with (up to) k.local work-items
+            const int local = groupSize(harness, kernel, table ? k.local : 256);
+            int argIndex = 0;
+            CL_CHECK_ERROR(kernel.setArg(argIndex++, stripBuffer));
+            CL_CHECK_ERROR(kernel.setArg(argIndex++, stripWidth));
+            CL_CHECK_ERROR(kernel.setArg(argIndex++, stripHeight));
+            CL_CHECK_ERROR(kernel.setArg(argIndex++, originBuffer));
+            CL_CHECK_ERROR(kernel.setArg(argIndex++, windowBuffer));
+            CL_CHECK_ERROR(kernel.setArg(argIndex++, statBuffer));
+            CL_CHECK_ERROR(kernel.setArg(argIndex++, cl::Local((table ? 2 : 1)*local*sizeof(cl_float2))));
+            CL_CHECK_ERROR(kernel.setArg(argIndex++, k.width));
+            CL_CHECK_ERROR(kernel.setArg(argIndex++, k.height));
+            CL_CHECK_ERROR(kernel.setArg(argIndex++, pWidth));
+            CL_CHECK_ERROR(kernel.setArg(argIndex++, pHeight));
+            CL_CHECK_ERROR(kernel.setArg(argIndex++, k.decimation));
+            CL_CHECK_ERROR(kernel.setArg(argIndex++, k.coherent));
+            const cl::NDRange global(local, batch), localRange(local, 1);
+            // the tables are completed by the scan along columns, with (up to) k.local work-items too
+            cl::Kernel columns(harness.handle.program, "window_sat2_scan_columns");
+            const int columnLocal = groupSize(harness, columns, k.local);
+            CL_CHECK_ERROR(columns.setArg(0, statBuffer));
+            CL_CHECK_ERROR(columns.setArg(1, cl::Local(2*columnLocal*sizeof(cl_float2))));
+            CL_CHECK_ERROR(columns.setArg(2, k.width));
+            CL_CHECK_ERROR(columns.setArg(3, k.height));
+            const cl::NDRange columnGlobal(columnLocal, k.width, batch), columnLocalRange(columnLocal, 1, 1);
+            auto launch = [&]() {
+                CL_CHECK_ERROR(harness.queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, localRange));
+                if (table)
+                    CL_CHECK_ERROR(harness.queue.enqueueNDRangeKernel(columns, cl::NullRange,
+                        columnGlobal, columnLocalRange));
+            };
+            launch();
+            std::vector<cl_float2> windowOutput(windows.size()), statOutput(reference.size());
+            CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(windowBuffer, CL_TRUE, 0,
+                windowOutput.size()*sizeof(cl_float2), windowOutput.data()));
+            CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(statBuffer, CL_TRUE, 0,
+                statOutput.size()*sizeof(cl_float2), statOutput.data()));
+
+            const double error = std::max(maxRelativeError(windowOutput, windows), maxRelativeError(statOutput, reference));
+            const double pixels = static_cast<double>(windowSize)*k.decimation*k.decimation*batch;
+            harness.report(table ? "window_gather_sat2" : "window_gather_sum2",
+                sizeString(k.width, k.height, batch) + (k.coherent ? " coherent" : " dec " + std::to_string(k.decimation))
+                    + (table ? " wg " + std::to_string(local) : ""),
+                error, table ? satTolerance : sumTolerance, harness.time(launch),
+                (pixels + windows.size() + statOutput.size())*sizeof(cl_float2), 6.0*pixels);
+        }
+    }
+}
+
+// the windows with data: both the reference and the search window have a non-zero variance of the
+//  amplitudes and at most max_zero_fraction zero pixels; the windows are, in turn, random, with
+//  a constant reference, a constant search window, 30% and 5% zeros in the reference, bright with
+//  1% noise, and the search window half outside the strip
+void windowValidTest(Harness& harness)
+{
+    cl::Context& context = harness.handle.context;
+    struct Case { int width, height, searchWidth, searchHeight; };
+    const std::vector<Case> cases = {{32, 32, 48, 48}, {64, 64, 96, 96}, {128, 128, 160, 160}, {20, 36, 40, 60}};
+    const float maxZeroFraction = 0.1f;
+    const int kinds = 7;
+    const int batch = 4*kinds;
+    for (const auto& k : cases) {
+        // the search windows side by side, the reference windows in their middle
+        const int stripWidth = k.searchWidth*batch;
+        const int stripHeight = k.searchHeight;
+        std::vector<cl_float2> reference = randomMatrix(static_cast<size_t>(stripWidth)*stripHeight, -1.0f, 1.0f);
+        std::vector<cl_float2> secondary = randomMatrix(static_cast<size_t>(stripWidth)*stripHeight, -1.0f, 1.0f);
+        std::vector<cl_int2> referenceOrigins(batch), secondaryOrigins(batch);
+        std::normal_distribution<float> noise(0.0f, 10.0f);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        for (int b = 0; b < batch; b++) {
+            const int kind = b % kinds;
+            secondaryOrigins[b] = make_int2(b*k.searchWidth, kind == 6 ? -k.searchHeight/2 : 0);
+            referenceOrigins[b] = make_int2(b*k.searchWidth + (k.searchWidth-k.width)/2, (k.searchHeight-k.height)/2);
+            for (int y = 0; y < k.searchHeight; y++)
+                for (int x = 0; x < k.searchWidth; x++) {
+                    const size_t i = static_cast<size_t>(y)*stripWidth + b*k.searchWidth + x;
+                    if (kind == 1)
+                        reference[i] = make_float2(0.5f, -0.5f);
+                    else if (kind == 2)
+                        secondary[i] = make_float2(2.0f, 0.0f);
+                    else if ((kind == 3 && uniform(engine) < 0.3f) || (kind == 4 && uniform(engine) < 0.05f))
+                        reference[i] = make_float2(0.0f, 0.0f);
+                    else if (kind == 5) {
+                        reference[i] = make_float2(1000.0f + noise(engine), 0.0f);
+                        secondary[i] = make_float2(1000.0f + noise(engine), 0.0f);
+                    }
+                }
+        }
+        auto hasData = [&](const std::vector<cl_float2>& strip, const cl_int2 origin, const int width, const int height) {
+            double sum = 0.0, sum2 = 0.0;
+            int zeros = 0;
+            for (int row = 0; row < height; row++)
+                for (int col = 0; col < width; col++) {
+                    const int x = origin.x + col;
+                    const int y = origin.y + row;
+                    const double amplitude = (x >= 0 && x < stripWidth && y >= 0 && y < stripHeight)
+                        ? std::hypot(strip[y*stripWidth + x].x, strip[y*stripWidth + x].y) : 0.0;
+                    sum += amplitude;
+                    sum2 += amplitude*amplitude;
+                    zeros += (amplitude == 0.0);
+                }
+            const double n = static_cast<double>(width)*height;
+            return (sum2*n - sum*sum > 1.0e-5*sum2*n) && (zeros <= maxZeroFraction*n);
+        };
+
+        cl::Buffer referenceBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            reference.size()*sizeof(cl_float2), reference.data());
+        cl::Buffer secondaryBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            secondary.size()*sizeof(cl_float2), secondary.data());
+        cl::Buffer referenceOriginBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            batch*sizeof(cl_int2), referenceOrigins.data());
+        cl::Buffer secondaryOriginBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            batch*sizeof(cl_int2), secondaryOrigins.data());
+        cl::Buffer validBuffer(context, CL_MEM_WRITE_ONLY, batch*sizeof(cl_int));
+        cl::Kernel kernel(harness.handle.program, "window_valid");
+        const int local = groupSize(harness, kernel, 256);
+        int argIndex = 0;
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, referenceBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, stripWidth));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, stripHeight));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, referenceOriginBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, secondaryBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, stripWidth));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, stripHeight));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, secondaryOriginBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, validBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, cl::Local(local*sizeof(cl_float2))));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, k.width));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, k.height));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, k.searchWidth));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, k.searchHeight));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, maxZeroFraction));
+        const cl::NDRange global(local, batch), localRange(local, 1);
+        CL_CHECK_ERROR(harness.queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, localRange));
+        std::vector<cl_int> valid(batch);
+        CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(validBuffer, CL_TRUE, 0, batch*sizeof(cl_int), valid.data()));
+
+        // the number of mismatched flags
+        double error = 0.0;
+        for (int b = 0; b < batch; b++) {
+            const bool expected = hasData(reference, referenceOrigins[b], k.width, k.height)
+                && hasData(secondary, secondaryOrigins[b], k.searchWidth, k.searchHeight);
+            if (valid[b] != (expected ? 1 : 0))
+                error++;
+        }
+        const double pixels = (static_cast<double>(k.width)*k.height + static_cast<double>(k.searchWidth)*k.searchHeight)*batch;
+        harness.report("window_valid", sizeString(k.width, k.height, batch), error, 0.0,
+            harness.time(kernel, global, localRange), pixels*sizeof(cl_float2), 6.0*pixels);
+    }
+}
+
+// the direct (spatial-domain) correlation, with the work-groups of the Correlator
+//  and the template staged in tiles of tileHeight rows, scaled as by the un-normalized fft
+void directTest(Harness& harness)
+{
+    cl::Context& context = harness.handle.context;
+    struct Case { int window, halfRange, tileHeight; };
+    const std::vector<Case> cases = {{16, 4, 16}, {32, 8, 5}, {64, 4, 32}, {48, 16, 7}};
+    const int batch = 16;
+    for (const auto& k : cases) {
+        const int search = k.window + 2*k.halfRange;
+        const int region = 2*k.halfRange + 1;
+        const int storage = next_power_of_2(search);
+        const size_t storageSize = static_cast<size_t>(storage)*storage;
+        // the windows in the (padded) storage of the correlator
+        std::vector<cl_float2> reference(storageSize*batch, make_float2(0.0f, 0.0f));
+        const std::vector<cl_float2> secondary = randomMatrix(storageSize*batch, 0.0f, 1.0f);
+        const std::vector<cl_float2> templates = randomMatrix(static_cast<size_t>(k.window)*k.window*batch, 0.0f, 1.0f);
+        for (int b = 0; b < batch; b++)
+            for (int y = 0; y < k.window; y++)
+                for (int x = 0; x < k.window; x++)
+                    reference[b*storageSize + y*storage + x] = templates[(static_cast<size_t>(b)*k.window + y)*k.window + x];
+
+        std::vector<std::complex<double>> correlation(static_cast<size_t>(region)*region*batch);
+        for (int b = 0; b < batch; b++)
+            for (int ly = 0; ly < region; ly++)
+                for (int lx = 0; lx < region; lx++) {
+                    double sum = 0.0;
+                    for (int y = 0; y < k.window; y++)
+                        for (int x = 0; x < k.window; x++)
+                            sum += static_cast<double>(reference[b*storageSize + y*storage + x].x)
+                                *secondary[b*storageSize + (y+ly)*storage + x+lx].x;
+                    correlation[(static_cast<size_t>(b)*region + ly)*region + lx] = sum*storageSize;
+                }
+
+        cl::Buffer referenceBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            reference.size()*sizeof(cl_float2), reference.data());
+        cl::Buffer secondaryBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            secondary.size()*sizeof(cl_float2), const_cast<cl_float2*>(secondary.data()));
+        cl::Buffer correlationBuffer(context, CL_MEM_READ_WRITE, storageSize*batch*sizeof(cl_float2));
+        cl::Kernel kernel(harness.handle.program, "correlation_direct");
+        size_t maxWorkGroupSize;
+        CL_CHECK_ERROR(kernel.getWorkGroupInfo(harness.handle.device, CL_KERNEL_WORK_GROUP_SIZE, &maxWorkGroupSize));
+        const int localx = std::min(next_power_of_2(region), static_cast<cl::size_type>(8));
+        const int localy = std::min(std::min(next_power_of_2(region), std::max(maxWorkGroupSize/localx, static_cast<size_t>(1))),
+            static_cast<cl::size_type>(8));
+        int argIndex = 0;
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, referenceBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, secondaryBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, correlationBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, cl::Local(k.tileHeight*k.window*sizeof(cl_float))));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, k.window));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, k.window));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, region));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, region));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, storage));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, static_cast<int>(storageSize)));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, k.tileHeight));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, static_cast<cl_float>(storageSize)));
+        const cl::NDRange global((region+localx-1)/localx*localx, (region+localy-1)/localy*localy, batch);
+        const cl::NDRange localRange(localx, localy, 1);
+        CL_CHECK_ERROR(harness.queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, localRange));
+        std::vector<cl_float2> output(storageSize*batch);
+        CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(correlationBuffer, CL_TRUE, 0,
+            output.size()*sizeof(cl_float2), output.data()));
+        std::vector<cl_float2> result(correlation.size());
+        for (int b = 0; b < batch; b++)
+            for (int ly = 0; ly < region; ly++)
+                for (int lx = 0; lx < region; lx++)
+                    result[(static_cast<size_t>(b)*region + ly)*region + lx] = output[b*storageSize + ly*storage + lx];
+
+        const double n = static_cast<double>(region)*region*batch;
+        harness.report("correlation_direct", sizeString(k.window, k.window, batch) + " region " + std::to_string(region),
+            relativeError(result, correlation), fftTolerance, harness.time(kernel, global, localRange),
+            (2.0*storageSize*batch + n)*sizeof(cl_float2), 2.0*n*k.window*k.window);
+    }
+}
+
+// the location of the max of the real part, in two passes (MaxLocationReduction), with ties
+//  in every other image, which go to the first location in row-major order
+void maxLocationTest(Harness& harness)
+{
+    cl::Context& context = harness.handle.context;
+    struct Case { int width, height, stride, batch; };
+    const std::vector<Case> cases = {{17, 17, 32, 64}, {65, 65, 128, 16}, {100, 60, 128, 8},
+        {257, 257, 512, 4}, {1024, 512, 1024, 1}};
+    for (const auto& k : cases) {
+        const size_t batchStride = static_cast<size_t>(k.stride)*k.height;
+        std::vector<cl_float2> input = randomMatrix(batchStride*k.batch, 0.0f, 1.0f);
+        std::uniform_int_distribution<int> col(0, k.width-1), row(0, k.height-1);
+        std::vector<cl_int2> peaks(k.batch);
+        for (int b = 0; b < k.batch; b++) {
+            cl_int2 peak = make_int2(col(engine), row(engine));
+            input[b*batchStride + peak.y*k.stride + peak.x].x = 2.0f;
+            if (b % 2) {
+                const cl_int2 tie = make_int2(col(engine), row(engine));
+                input[b*batchStride + tie.y*k.stride + tie.x].x = 2.0f;
+                if (tie.y*k.width + tie.x < peak.y*k.width + peak.x)
+                    peak = tie;
+            }
+            peaks[b] = peak;
+        }
+
+        cl::Buffer inputBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            input.size()*sizeof(cl_float2), input.data());
+        cl::Buffer outputBuffer(context, CL_MEM_WRITE_ONLY, k.batch*sizeof(cl_int2));
+        cl::Ampcor::MaxLocationReduction reduction(harness.handle, k.width, k.height,
+            k.stride, static_cast<int>(batchStride), inputBuffer, outputBuffer, k.batch);
+        reduction.execute(harness.queue);
+        std::vector<cl_int2> output(k.batch);
+        CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(outputBuffer, CL_TRUE, 0, k.batch*sizeof(cl_int2), output.data()));
+
+        // the number of mismatched locations
+        double error = 0.0;
+        for (int b = 0; b < k.batch; b++)
+            if (output[b].x != peaks[b].x || output[b].y != peaks[b].y)
+                error++;
+        const double n = static_cast<double>(k.width)*k.height*k.batch;
+        harness.report("max_location (2 passes)", sizeString(k.width, k.height, k.batch), error, 0.0,
+            harness.time([&]() { reduction.execute(harness.queue); }), n*sizeof(cl_float2), n);
+    }
+}
+
+// the snr of the peak search: peak^2 over the mean of the other correlation^2 outside the peak
+//  neighbourhood, which the host limits to about half of the surface (stat_size 21 by default),
+//  and without the limit, on a small surface covered by the neighbourhood, a finite, positive snr
+void snrTest(Harness& harness)
+{
+    const int batch = 16;
+    for (const int halfRange : {4, 8, 16, 32}) {
+        for (const bool limited : {true, false}) {
+            if (!limited && halfRange > 4)
+                continue;
+            const CorrelationCase c = correlationCase(32, halfRange, batch);
+            const int region = c.region;
+            const int statHalf = limited ? std::min(21/2, (region-1)/4) : 21/2;
+            const PeakZoom result = peakZoom(harness, c, 8, 0, 16, statHalf);
+
+            double error = 0.0;
+            for (int b = 0; b < batch; b++) {
+                const double* coefficients = c.coefficients.data() + static_cast<size_t>(b)*region*region;
+                const int peak = static_cast<int>(std::max_element(coefficients, coefficients + region*region) - coefficients);
+                const int peakx = peak % region, peaky = peak / region;
+                double energy = 0.0, peakEnergy = 0.0;
+                int count = 0;
+                for (int y = 0; y < region; y++)
+                    for (int x = 0; x < region; x++) {
+                        const double value2 = coefficients[y*region + x]*coefficients[y*region + x];
+                        energy += value2;
+                        if (std::abs(x - peakx) <= statHalf && std::abs(y - peaky) <= statHalf)
+                            peakEnergy += value2;
+                        else
+                            count++;
+                    }
+                const double noise = count > 0 ? (energy - peakEnergy)/count : energy/(region*region);
+                const double snr = coefficients[peak]*coefficients[peak]/noise;
+                // nan or zero snr fail
+                error = std::max(error, (std::isfinite(result.snr[b]) && result.snr[b] > 0.0f)
+                    ? std::fabs(result.snr[b] - snr)/snr : INFINITY);
+            }
+            const double n = static_cast<double>(region)*region*batch;
+            harness.report("snr (peak_zoom)", sizeString(region, region, batch) + " stat " + std::to_string(2*statHalf+1),
+                error, snrTolerance, result.ms, n*(sizeof(cl_float) + 4.0*sizeof(cl_float2)), 40.0*n);
+        }
+    }
+}
+
+// the peak search on smooth surfaces with the peak at sub-pixel lags: the location of the peak and
+//  the zoom window against the correlation coefficients, and, evaluated in double on the zoom window
+//  of the kernel, the sub-pixel offsets of each estimator and the covariance from the curvature
+//  (the sinc estimator picks a point of a 1/factor grid, near ties may be off by one step)
+void peakZoomTest(Harness& harness)
+{
+    const int batch = 16;
+    const int zoomSize = 8;
+    const int factor = 16;
+    const std::vector<std::pair<std::string, int>> estimators = {{"parabolic", 1}, {"gaussian", 2}, {"sinc", 3}};
+    for (const int halfRange : {4, 8, 16, 32}) {
+        const CorrelationCase c = correlationCase(32, halfRange, batch, 3);
+        const int region = c.region;
+        const int statHalf = std::min(21/2, (region-1)/4);
+        const std::string size = sizeString(region, region, batch);
+        const double n = static_cast<double>(region)*region*batch;
+        const double bytes = n*(sizeof(cl_float) + 4.0*sizeof(cl_float2));
+        double zoomError = 0.0, covError = 0.0, ms = 0.0;
+        for (const auto& estimator : estimators) {
+            const PeakZoom result = peakZoom(harness, c, zoomSize, estimator.second, factor, statHalf);
+            ms = result.ms;
+            double error = 0.0;
+            for (int b = 0; b < batch; b++) {
+                const double* coefficients = c.coefficients.data() + static_cast<size_t>(b)*region*region;
+                const int peak = static_cast<int>(std::max_element(coefficients, coefficients + region*region) - coefficients);
+                const int peakx = peak % region, peaky = peak / region;
+                if (result.maxLoc[b].x != peakx || result.maxLoc[b].y != peaky) {
+                    zoomError = INFINITY;
+                    continue;
+                }
+                // the zoom window, centered at the peak, 0 outside the region
+                std::vector<double> tile(zoomSize*zoomSize);
+                for (int j = 0; j < zoomSize; j++)
+                    for (int i = 0; i < zoomSize; i++) {
+                        const int x = peakx - zoomSize/2 + i;
+                        const int y = peaky - zoomSize/2 + j;
+                        const double value = (x >= 0 && x < region && y >= 0 && y < region) ? coefficients[y*region + x] : 0.0;
+                        tile[j*zoomSize + i] = result.zoom[b*zoomSize*zoomSize + j*zoomSize + i].x;
+                        zoomError = std::max(zoomError, std::isfinite(tile[j*zoomSize + i])
+                            ? std::fabs(tile[j*zoomSize + i] - value) : INFINITY);
+                    }
+                const int cx = zoomSize/2, cy = zoomSize/2;
+                const int center = cy*zoomSize + cx;
+                const double f0 = tile[center];
+
+                // the sub-pixel offsets
+                auto parabolic = [](const double fm, const double f, const double fp) {
+                    const double denom = fm - 2.0*f + fp;
+                    return denom < 0.0 ? std::min(std::max(0.5*(fm - fp)/denom, -0.5), 0.5) : 0.0;
+                };
+                auto fit = [&](const double fm, const double f, const double fp) {
+                    if (estimator.second == 1 || fm <= 0.0 || f <= 0.0 || fp <= 0.0)
+                        return parabolic(fm, f, fp);
+                    return parabolic(std::log(fm), std::log(f), std::log(fp));
+                };
+                double fx = 0.0, fy = 0.0;
+                if (estimator.second < 3) {
+                    if (peakx > 0 && peakx < region-1)
+                        fx = fit(tile[center-1], f0, tile[center+1]);
+                    if (peaky > 0 && peaky < region-1)
+                        fy = fit(tile[center-zoomSize], f0, tile[center+zoomSize]);
+                }
+                else {
+                    const double halfWidth = zoomSize/2;
+                    auto windowedSinc = [&](const double x) {
+                        if (std::fabs(x) >= halfWidth)
+                            return 0.0;
+                        const double px = M_PI*x;
+                        return (x == 0.0 ? 1.0 : std::sin(px)/px)*0.5*(1.0 + std::cos(px/halfWidth));
+                    };
+                    double maxValue = -INFINITY;
+                    for (int v = -factor; v <= factor; v++)
+                        for (int u = -factor; u <= factor; u++) {
+                            const double tx = static_cast<double>(u)/factor, ty = static_cast<double>(v)/factor;
+                            double value = 0.0;
+                            for (int j = 0; j < zoomSize; j++)
+                                for (int i = 0; i < zoomSize; i++)
+                                    value += tile[j*zoomSize + i]*windowedSinc(tx - (i - cx))*windowedSinc(ty - (j - cy));
+                            if (value > maxValue) {
+                                maxValue = value;
+                                fx = tx;
+                                fy = ty;
+                            }
+                        }
+                }
+                const double offsetError = std::max(std::fabs(result.subpixel[b].x - fx), std::fabs(result.subpixel[b].y - fy));
+                error = std::max(error, std::isfinite(offsetError) ? offsetError : INFINITY);
+
+                // the covariance (xx, yy, xy), relative to the larger variance, pixel_scale = 1
+                double xx = 99.0, yy = 99.0, xy = 0.0;
+                if (peakx > 0 && peakx < region-1 && peaky > 0 && peaky < region-1) {
+                    const double windowSize = static_cast<double>(c.window)*c.window;
+                    const double dxx = -(tile[center+1] + tile[center-1] - 2.0*f0)*windowSize;
+                    const double dyy = -(tile[center+zoomSize] + tile[center-zoomSize] - 2.0*f0)*windowSize;
+                    const double dxy = (tile[center+zoomSize+1] + tile[center-zoomSize-1]
+                        - tile[center+zoomSize-1] - tile[center-zoomSize+1])*0.25*windowSize;
+                    const double n2 = 2.0*std::max(1.0 - f0, 0.0);
+                    const double n4 = 0.125*n2*n2*windowSize;
+                    const double u = dxy*dxy - dxx*dyy;
+                    if (std::fabs(u) > 1.0e-2) {
+                        xx = (-n2*u*dyy + n4*(dyy*dyy + dxy*dxy))/(u*u);
+                        yy = (-n2*u*dxx + n4*(dxx*dxx + dxy*dxy))/(u*u);
+                        xy = ((n2*u - n4*(dxx + dyy))*dxy)/(u*u);
+                    }
+                }
+                const float* cov = result.cov.data() + 3*b;
+                const double variance = std::max(std::fabs(xx), std::fabs(yy));
+                const double relative = std::max(std::max(std::fabs(cov[0] - xx), std::fabs(cov[1] - yy)), std::fabs(cov[2] - xy))/variance;
+                covError = std::max(covError, std::isfinite(relative) ? relative : INFINITY);
+            }
+            harness.report("peak_zoom " + estimator.first, size, error,
+                estimator.second == 3 ? 1.0/factor : estimatorTolerance, result.ms, bytes, 40.0*n);
+        }
+        harness.report("peak_zoom location/zoom", size, zoomError, normalizeTolerance, ms, bytes, 40.0*n);
+        harness.report("peak_zoom covariance", size, covError, estimatorTolerance, ms, bytes, 40.0*n);
+    }
+}
+
+// the oversampling by a zoom dft (ZoomOversampler), centered for the correlation surfaces and not
+//  centered for the raw windows of any size, against the band-limited interpolation in double
+void zoomOversamplerTest(Harness& harness)
+{
+    cl::Context& context = harness.handle.context;
+    struct Case { int inWidth, inHeight, outWidth, outHeight, factor; bool centered; int batch; };
+    const std::vector<Case> cases = {{16, 16, 32, 32, 16, true, 64}, {8, 8, 33, 33, 16, true, 64},
+        {9, 9, 18, 18, 2, false, 64}, {72, 40, 144, 80, 2, false, 8}, {5, 7, 20, 28, 4, false, 64}};
+    for (const auto& k : cases) {
+        const size_t inSize = static_cast<size_t>(k.inWidth)*k.inHeight;
+        const size_t outSize = static_cast<size_t>(k.outWidth)*k.outHeight;
+        const std::vector<cl_float2> input = randomMatrix(inSize*k.batch, -1.0f, 1.0f);
+        const std::vector<std::complex<double>> image = toDouble(input);
+        // along columns, then rows
+        std::vector<std::complex<double>> columns(static_cast<size_t>(k.outHeight)*k.inWidth*k.batch);
+        std::vector<std::complex<double>> reference(outSize*k.batch);
+        for (int b = 0; b < k.batch; b++) {
+            for (int x = 0; x < k.inWidth; x++)
+                bandInterpolation(image.data() + b*inSize + x, k.inHeight, k.inWidth,
+                    columns.data() + static_cast<size_t>(b)*k.outHeight*k.inWidth + x, k.outHeight, k.inWidth,
+                    k.factor, k.centered);
+            for (int y = 0; y < k.outHeight; y++)
+                bandInterpolation(columns.data() + (static_cast<size_t>(b)*k.outHeight + y)*k.inWidth, k.inWidth, 1,
+                    reference.data() + b*outSize + y*k.outWidth, k.outWidth, 1, k.factor, k.centered);
+        }
+
+        cl::Buffer inputBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            input.size()*sizeof(cl_float2), const_cast<cl_float2*>(input.data()));
+        cl::Buffer outputBuffer(context, CL_MEM_READ_WRITE, reference.size()*sizeof(cl_float2));
+        cl::Ampcor::ZoomOversampler oversampler(harness.handle, k.inWidth, k.inHeight, k.outWidth, k.outHeight,
+            k.factor, inputBuffer, outputBuffer, k.batch, k.centered);
+        oversampler.execute(harness.queue);
+        std::vector<cl_float2> output(reference.size());
+        CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(outputBuffer, CL_TRUE, 0,
+            output.size()*sizeof(cl_float2), output.data()));
+
+        harness.report(k.centered ? "ZoomOversampler" : "ZoomOversampler raw",
+            sizeString(k.inWidth, k.inHeight) + "->" + sizeString(k.outWidth, k.outHeight, k.batch),
+            relativeError(output, reference), fftTolerance,
+            harness.time([&]() { oversampler.execute(harness.queue); }),
+            (inSize + outSize)*k.batch*sizeof(cl_float2),
+            8.0*(static_cast<double>(k.outHeight)*k.inHeight*k.inWidth + static_cast<double>(outSize)*k.inWidth)*k.batch);
+    }
+}
+
+// the shift of the search windows by the coarse search, clamped to the margin of the fine search
+void originsShiftTest(Harness& harness)
+{
+    cl::Context& context = harness.handle.context;
+    struct Case { int decimation; cl_int2 halfRange, maxShift; };
+    const std::vector<Case> cases = {{4, make_int2(32, 32), make_int2(28, 28)},
+        {2, make_int2(16, 8), make_int2(12, 6)}, {8, make_int2(64, 48), make_int2(56, 40)}};
+    const int batch = 1000;
+    for (const auto& k : cases) {
+        std::vector<cl_int2> origins(batch), maxLoc(batch);
+        std::uniform_int_distribution<int> origin(0, 10000);
+        std::uniform_int_distribution<int> lagx(0, 2*k.halfRange.x/k.decimation), lagy(0, 2*k.halfRange.y/k.decimation);
+        for (int b = 0; b < batch; b++) {
+            origins[b] = make_int2(origin(engine), origin(engine));
+            maxLoc[b] = make_int2(lagx(engine), lagy(engine));
+        }
+
+        cl::Buffer originBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, batch*sizeof(cl_int2), origins.data());
+        cl::Buffer maxLocBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, batch*sizeof(cl_int2), maxLoc.data());
+        cl::Buffer fineBuffer(context, CL_MEM_WRITE_ONLY, batch*sizeof(cl_int2));
+        cl::Buffer shiftBuffer(context, CL_MEM_WRITE_ONLY, batch*sizeof(cl_int2));
+        cl::Kernel kernel(harness.handle.program, "window_origins_shift");
+        int argIndex = 0;
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, originBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, maxLocBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, fineBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, shiftBuffer));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, k.decimation));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, k.halfRange));
+        CL_CHECK_ERROR(kernel.setArg(argIndex++, k.maxShift));
+        const cl::NDRange global(batch);
+        CL_CHECK_ERROR(harness.queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, cl::NullRange));
+        std::vector<cl_int2> fine(batch), shifts(batch);
+        CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(fineBuffer, CL_TRUE, 0, batch*sizeof(cl_int2), fine.data()));
+        CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(shiftBuffer, CL_TRUE, 0, batch*sizeof(cl_int2), shifts.data()));
+
+        // the number of mismatched windows
+        double error = 0.0;
+        for (int b = 0; b < batch; b++) {
+            const int shiftx = std::min(std::max(maxLoc[b].x*k.decimation - k.halfRange.x, -k.maxShift.x), k.maxShift.x);
+            const int shifty = std::min(std::max(maxLoc[b].y*k.decimation - k.halfRange.y, -k.maxShift.y), k.maxShift.y);
+            if (shifts[b].x != shiftx || shifts[b].y != shifty
+                || fine[b].x != origins[b].x + k.maxShift.x + shiftx || fine[b].y != origins[b].y + k.maxShift.y + shifty)
+                error++;
+        }
+        harness.report("window_origins_shift", std::to_string(batch) + " dec " + std::to_string(k.decimation), error, 0.0,
+            harness.time(kernel, global, cl::NullRange), 4.0*batch*sizeof(cl_int2), 0.0);
+    }
+}
+
+// zero padding in the middle of the spectra, for fft oversampling
+void paddingTest(Harness& harness)
+{
+    cl::Context& context = harness.handle.context;
+    const std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> sizes = {
+        {{8, 8}, {16, 16}}, {{32, 32}, {64, 64}}, {{64, 32}, {256, 128}}, {{128, 128}, {512, 512}}};
+    const int batch = 4;
+    for (const auto& size : sizes) {
+        const int inWidth = size.first.first, inHeight = size.first.second;
+        const int outWidth = size.second.first, outHeight = size.second.second;
+        const std::vector<cl_float2> input = randomMatrix(static_cast<size_t>(inWidth)*inHeight*batch, -1.0f, 1.0f);
+
+        // the quadrants are moved to the corners
+        std::vector<cl_float2> reference(static_cast<size_t>(outWidth)*outHeight*batch, make_float2(0.0f, 0.0f));
+        for (int b = 0; b < batch; b++)
+            for (int y = 0; y < inHeight; y++)
+                for (int x = 0; x < inWidth; x++) {
+                    const int outx = x < inWidth/2 ? x : x + outWidth - inWidth;
+                    const int outy = y < inHeight/2 ? y : y + outHeight - inHeight;
+                    reference[(static_cast<size_t>(b)*outHeight + outy)*outWidth + outx]
+                        = input[(static_cast<size_t>(b)*inHeight + y)*inWidth + x];
+                }
+
+        cl::Buffer inputBuffer(context, CL_MEM_READ_ONLY, input.size()*sizeof(cl_float2));
+        cl::Buffer outputBuffer(context, CL_MEM_READ_WRITE, reference.size()*sizeof(cl_float2));
+        CL_CHECK_ERROR(harness.queue.enqueueWriteBuffer(inputBuffer, CL_TRUE, 0,
+            input.size()*sizeof(cl_float2), input.data()));
+        // not initialized by zeros, the kernel writes all elements
+        CL_CHECK_ERROR(harness.queue.enqueueFillBuffer(outputBuffer, make_float2(NAN, NAN), 0,
+            reference.size()*sizeof(cl_float2)));
+        cl::Kernel kernel(harness.handle.program, "matrix_fft_padding");
+        CL_CHECK_ERROR(kernel.setArg(0, inputBuffer));
+        CL_CHECK_ERROR(kernel.setArg(1, outputBuffer));
+        CL_CHECK_ERROR(kernel.setArg(2, inWidth));
+        CL_CHECK_ERROR(kernel.setArg(3, inHeight));
+        CL_CHECK_ERROR(kernel.setArg(4, outWidth));
+        CL_CHECK_ERROR(kernel.setArg(5, outHeight));
+        const cl::NDRange global(outWidth/2, outHeight/2, batch);
+        CL_CHECK_ERROR(harness.queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, cl::NullRange));
+        std::vector<cl_float2> output(reference.size());
+        CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(outputBuffer, CL_TRUE, 0,
+            output.size()*sizeof(cl_float2), output.data()));
+
+        // the number of mismatched elements
+        double error = 0.0;
+        for (size_t i = 0; i < output.size(); i++)
+            if (!(output[i].x == reference[i].x && output[i].y == reference[i].y))
+                error++;
+        harness.report("matrix_fft_padding", sizeString(inWidth, inHeight) + "->" + sizeString(outWidth, outHeight, batch),
+            error, 0.0, harness.time(kernel, global, cl::NullRange),
+            (input.size() + reference.size())*sizeof(cl_float2), 0.0);
+    }
+}
+
+// transpose, two by two elements
+void transposeTest(Harness& harness)
+{
+    cl::Context& context = harness.handle.context;
+    const std::vector<std::pair<int, int>> sizes = {{64, 64}, {256, 512}, {1024, 1024}, {2048, 512}};
+    for (const auto& size : sizes) {
+        const int rows = size.first;
+        const int cols = size.second;
+        const std::vector<cl_float2> input = randomMatrix(static_cast<size_t>(rows)*cols, -1.0f, 1.0f);
+
+        cl::Buffer inputBuffer(context, CL_MEM_READ_WRITE, input.size()*sizeof(cl_float2));
+        cl::Buffer outputBuffer(context, CL_MEM_READ_WRITE, input.size()*sizeof(cl_float2));
+        CL_CHECK_ERROR(harness.queue.enqueueWriteBuffer(inputBuffer, CL_TRUE, 0,
+            input.size()*sizeof(cl_float2), input.data()));
+        cl::Kernel kernel(harness.handle.program, "matrix_transpose");
+        CL_CHECK_ERROR(kernel.setArg(0, static_cast<cl_uint>(rows)));
+        CL_CHECK_ERROR(kernel.setArg(1, static_cast<cl_uint>(cols)));
+        CL_CHECK_ERROR(kernel.setArg(2, inputBuffer));
+        CL_CHECK_ERROR(kernel.setArg(3, outputBuffer));
+        const cl::NDRange global(cols/2, rows/2);
+        CL_CHECK_ERROR(harness.queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, cl::NullRange));
+        std::vector<cl_float2> output(input.size());
+        CL_CHECK_ERROR(harness.queue.enqueueReadBuffer(outputBuffer, CL_TRUE, 0,
+            output.size()*sizeof(cl_float2), output.data()));
+
+        // the number of mismatched elements
+        double error = 0.0;
+        for (int row = 0; row < rows; row++)
+            for (int col = 0; col < cols; col++) {
+                const cl_float2& a = input[static_cast<size_t>(row)*cols + col];
+                const cl_float2& t = output[static_cast<size_t>(col)*rows + row];
+                if (!(a.x == t.x && a.y == t.y))
+                    error++;
+            }
+        harness.report("matrix_transpose", sizeString(cols, rows), error, 0.0,
+            harness.time(kernel, global, cl::NullRange), 2.0*input.size()*sizeof(cl_float2), 0.0);
+    }
+}
+
+// end of file